@@ -19,6 +19,7 @@ typedef safe_obj<field_t, spinlock_t> safe_obj_field_t;
 #include <cds/init.h>       // for cds::Initialize and cds::Terminate
 #include <cds/container/skip_list_map_rcu.h>    // cds::container::SkipListMap<>
 #include <cds/container/bronson_avltree_map_rcu.h>  // cds::container::BronsonAVLTreeMap<>
+#include <cds/container/feldman_hashmap_rcu.h>      // cds::container::FeldmanHashMap<>
 #include <cds/urcu/general_buffered.h>   // gc<general_buffered> - general purpose RCU with deferred (buffered) reclamation
 typedef cds::urcu::gc< cds::urcu::general_buffered<> >  rcu_gpb;    // high performance (higher than other 4 RCU implementations)
 
@@ -192,6 +193,58 @@ void benchmark_safe_map(T &test_map,
 }
 
 
+// for concurrent_flat_map<> and olc_btree<>: find() without locks, update() under the lock of the group or leaf
+template<typename T>
+void benchmark_optimistic_map(T &test_map,
+    size_t const iterations_count, size_t const percent_write, const bool measure_latency = false)
+{
+    const unsigned int seed = (unsigned)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<size_t> index_distribution(0, test_map.size() - 1);
+    std::chrono::high_resolution_clock::time_point hrc_end, hrc_start = std::chrono::high_resolution_clock::now();
+    double max_time = 0;
+    std::vector<double> median_arr;
+
+    for (size_t i = 0; i < iterations_count; ++i) {
+        int const rnd_index = (int)index_distribution(generator);
+        bool const write_flag = (percent_distribution(generator) < percent_write);
+        int const num_op = (write_flag) ? i % 2 : read_op;   // (insert_op, delete_op), read_op
+
+        if (measure_latency) {
+            hrc_end = std::chrono::high_resolution_clock::now();
+            const double cur_time = std::chrono::duration<double>(hrc_end - hrc_start).count();
+            max_time = std::max(max_time, cur_time);
+            if (median_arr.size() == 0) median_arr.resize(std::min(median_array_size, iterations_count));
+            if (i < median_arr.size()) median_arr[i] = cur_time;
+            hrc_start = std::chrono::high_resolution_clock::now();
+        }
+
+        bool success_op;
+        switch (num_op) {
+        case insert_op:
+            test_map.emplace(rnd_index, field_t(rnd_index, rnd_index));
+            break;
+        case delete_op:
+            success_op = test_map.erase(rnd_index);
+            break;
+        case read_op: {
+            field_t field;
+            if (test_map.find(rnd_index, field))        // optimistic read - without locks
+                success_op = test_map.update(rnd_index, [](field_t &val) {
+                    volatile int money = val.money;     // get value
+                    val.money += 10;                    // update value
+                });
+        }
+            break;
+        default: std::cout << "\n wrong way! \n";  break;
+        }
+    }
+
+    safe_vec_max_latency->push_back(max_time);
+    safe_vec_median_latency->insert(safe_vec_median_latency->end(), median_arr.begin(), median_arr.end());
+}
+
+
 template<typename T>
 void benchmark_map_partitioned(T &test_map,
     size_t const iterations_count, size_t const percent_write, const bool measure_latency = false)
@@ -257,9 +310,12 @@ int main(int argc, char** argv)
 	if (argc >= 2) {
 		custom_max_threads = std::stoi(std::string(argv[1]));		// max threads
 	}
+	if (argc >= 3) {
+		percent_write = std::stoi(std::string(argv[2]));		// % of write operations
+	}
 
     std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
-    std::cout << "Benchmark thread-safe ORDERED associative containers with size = " << container_size << std::endl;
+    std::cout << "Benchmark thread-safe ORDERED (and hash) associative containers with size = " << container_size << std::endl;
     std::cout << "Threads = " << vec_thread.size() << ", iterations per thread = " << iterations_count << std::endl;
     std::cout << "Time & MOps - steady_clock, is_steady = " << std::chrono::steady_clock::is_steady << ", num/den = " <<
         (double)std::chrono::steady_clock::period::num << " / " << std::chrono::steady_clock::period::den << std::endl;
@@ -286,6 +342,17 @@ int main(int argc, char** argv)
 	// The requirement of RCU lock during iterating means that deletion of the elements(i.e.erase) is not possible.
 	cds::container::SkipListMap< rcu_gpb, int, field_t > skiplist_map;
 
+	// http://libcds.sourceforge.net/doc/cds-api/classcds_1_1container_1_1_feldman_hash_map.html
+	// Hash map based on a multi-level array of pointers to nodes (hash trie), lock-free.
+	cds::container::FeldmanHashMap< rcu_gpb, int, field_t > feldman_hash_map;
+
+	// SAFE_PTR
+	// concurrent hash map with open addressing: keys and values inline, optimistic reads by versions of groups of slots
+	concurrent_flat_map<int, field_t> flat_map(container_size);
+
+	// B+tree with optimistic lock coupling: readers validate versions of nodes, writers lock only the nodes they change
+	olc_btree<int, field_t> olc_tree;
+
 
 	// SAFE_PTR
 	// thread-safe ordered std::map by using execute around pointer idiom with contention-free shared-lock
@@ -293,6 +360,10 @@ int main(int argc, char** argv)
 
 	// thread-safe custom partitioned ordered-map based on std::map by using execute around pointer idiom with contention-free shared-lock
 	safe_map_partitioned_t<int, safe_obj_field_t, contfree_safe_ptr> safe_map_part_contfree(0, container_size, container_size / 10); // from 0 to 100 000 by step 10 000
+
+	// the same with B+tree sf::btree_map instead of std::map
+	contfree_safe_ptr< btree_map<int, safe_obj_field_t> > safe_btree_contfree;
+	safe_map_partitioned_t<int, safe_obj_field_t, contfree_safe_ptr, btree_map<int, safe_obj_field_t>> safe_btree_part_contfree(0, container_size, container_size / 10);
 	
 
     // Initialize libcds
@@ -326,18 +397,30 @@ int main(int argc, char** argv)
 			std_map.clear();
 			branson_avltree_map.clear();
 			skiplist_map.clear();
+			feldman_hash_map.clear();
+			flat_map.clear();
+			olc_tree.clear();
 			safe_map_contfree->clear();
 			safe_map_part_contfree.clear();
+			safe_btree_contfree->clear();
+			safe_btree_part_contfree.clear();
 
 			// init maps
+			std::vector<std::pair<int, field_t>> rows;
 			for (size_t i = 0; i < container_size; ++i)
 			{
+				rows.emplace_back(i, field_t(i, i));
 				std_map.emplace(i, field_t(i, i));
 				branson_avltree_map.emplace(i, field_t(i, i));
 				skiplist_map.emplace(i, field_t(i, i));
-				safe_map_contfree->emplace(i, field_t(i, i));
-				safe_map_part_contfree.emplace(i, field_t(i, i));
+				feldman_hash_map.emplace(i, field_t(i, i));
+				flat_map.emplace(i, field_t(i, i));
+				olc_tree.emplace(i, field_t(i, i));
 			}
+			bulk_load(safe_map_contfree, rows.begin(), rows.end());
+			safe_map_part_contfree.bulk_load(rows.begin(), rows.end());
+			bulk_load(safe_btree_contfree, rows.begin(), rows.end());
+			safe_btree_part_contfree.bulk_load(rows.begin(), rows.end());
 
 			std::chrono::steady_clock::time_point steady_start, steady_end;
 			double took_time = 0;
@@ -414,6 +497,78 @@ int main(int argc, char** argv)
 
 
 
+			std::cout << "FeldmanHashMap:   ";
+			steady_start = std::chrono::steady_clock::now();
+			for (auto &i : vec_thread)
+				i = std::move(std::thread([&]()
+			{
+				benchmark_cds_map(feldman_hash_map, iterations_count, percent_write, measure_latency);
+
+			}));
+			for (auto &i : vec_thread) i.join();
+			steady_end = std::chrono::steady_clock::now();
+			took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+			std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000));
+			if (measure_latency) {
+				std::sort(safe_vec_median_latency->begin(), safe_vec_median_latency->end());
+				std::cout << " \t " << (safe_vec_median_latency->at(safe_vec_median_latency->size() / 2) * 1000000) <<
+					" \t " << (safe_vec_median_latency->at(vec_thread.size()) * 1000000) <<
+					" \t " << *std::max_element(safe_vec_max_latency->begin(), safe_vec_max_latency->end()) * 1000000;
+			}
+			std::cout << std::endl;
+			safe_vec_max_latency->clear();
+			safe_vec_median_latency->clear();
+
+
+
+			std::cout << "concurrent_flat_map:";
+			steady_start = std::chrono::steady_clock::now();
+			for (auto &i : vec_thread)
+				i = std::move(std::thread([&]()
+			{
+				benchmark_optimistic_map(flat_map, iterations_count, percent_write, measure_latency);
+
+			}));
+			for (auto &i : vec_thread) i.join();
+			steady_end = std::chrono::steady_clock::now();
+			took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+			std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000));
+			if (measure_latency) {
+				std::sort(safe_vec_median_latency->begin(), safe_vec_median_latency->end());
+				std::cout << " \t " << (safe_vec_median_latency->at(safe_vec_median_latency->size() / 2) * 1000000) <<
+					" \t " << (safe_vec_median_latency->at(vec_thread.size()) * 1000000) <<
+					" \t " << *std::max_element(safe_vec_max_latency->begin(), safe_vec_max_latency->end()) * 1000000;
+			}
+			std::cout << std::endl;
+			safe_vec_max_latency->clear();
+			safe_vec_median_latency->clear();
+
+
+
+			std::cout << "olc_btree:        ";
+			steady_start = std::chrono::steady_clock::now();
+			for (auto &i : vec_thread)
+				i = std::move(std::thread([&]()
+			{
+				benchmark_optimistic_map(olc_tree, iterations_count, percent_write, measure_latency);
+
+			}));
+			for (auto &i : vec_thread) i.join();
+			steady_end = std::chrono::steady_clock::now();
+			took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+			std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000));
+			if (measure_latency) {
+				std::sort(safe_vec_median_latency->begin(), safe_vec_median_latency->end());
+				std::cout << " \t " << (safe_vec_median_latency->at(safe_vec_median_latency->size() / 2) * 1000000) <<
+					" \t " << (safe_vec_median_latency->at(vec_thread.size()) * 1000000) <<
+					" \t " << *std::max_element(safe_vec_max_latency->begin(), safe_vec_max_latency->end()) * 1000000;
+			}
+			std::cout << std::endl;
+			safe_vec_max_latency->clear();
+			safe_vec_median_latency->clear();
+
+
+
 			std::cout << "safe_map_contfree:  ";
 			steady_start = std::chrono::steady_clock::now();
 			for (auto &i : vec_thread)
@@ -437,6 +592,29 @@ int main(int argc, char** argv)
 			safe_vec_median_latency->clear();
 
 
+			std::cout << "safe_btree_contfree:";
+			steady_start = std::chrono::steady_clock::now();
+			for (auto &i : vec_thread)
+				i = std::move(std::thread([&]()
+			{
+				benchmark_safe_map(safe_btree_contfree, iterations_count, percent_write, measure_latency);
+
+			}));
+			for (auto &i : vec_thread) i.join();
+			steady_end = std::chrono::steady_clock::now();
+			took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+			std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000));
+			if (measure_latency) {
+				std::sort(safe_vec_median_latency->begin(), safe_vec_median_latency->end());
+				std::cout << " \t " << (safe_vec_median_latency->at(safe_vec_median_latency->size() / 2) * 1000000) <<
+					" \t " << (safe_vec_median_latency->at(vec_thread.size()) * 1000000) <<
+					" \t " << *std::max_element(safe_vec_max_latency->begin(), safe_vec_max_latency->end()) * 1000000;
+			}
+			std::cout << std::endl;
+			safe_vec_max_latency->clear();
+			safe_vec_median_latency->clear();
+
+
 			std::cout << "safe_map_part_contfree:";
 			steady_start = std::chrono::steady_clock::now();
 			for (auto &i : vec_thread)
@@ -457,7 +635,31 @@ int main(int argc, char** argv)
 			}
 			std::cout << std::endl;
 			safe_vec_max_latency->clear();
-			safe_vec_median_latency->clear();			
+			safe_vec_median_latency->clear();
+
+
+			std::cout << "safe_btree_part_contfree:";
+			steady_start = std::chrono::steady_clock::now();
+			for (auto &i : vec_thread)
+				i = std::move(std::thread([&]()
+			{
+				benchmark_map_partitioned(safe_btree_part_contfree, iterations_count, percent_write, measure_latency);
+
+			}));
+			for (auto &i : vec_thread) i.join();
+			steady_end = std::chrono::steady_clock::now();
+			took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+			std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000));
+			if (measure_latency) {
+				std::sort(safe_vec_median_latency->begin(), safe_vec_median_latency->end());
+				std::cout << " \t " << (safe_vec_median_latency->at(safe_vec_median_latency->size() / 2) * 1000000) <<
+					" \t " << (safe_vec_median_latency->at(vec_thread.size()) * 1000000) <<
+					" \t " << *std::max_element(safe_vec_max_latency->begin(), safe_vec_max_latency->end()) * 1000000;
+			}
+			std::cout << std::endl;
+			safe_vec_max_latency->clear();
+			safe_vec_median_latency->clear();
+			
 
 			if (t_num >= custom_max_threads) break;
 		}
@@ -263,6 +263,60 @@ void benchmark_safe_map(T &test_map,
 }
 
 
+// for olc_btree<>: find() without locks, update() under the lock of the leaf
+template<typename T>
+void benchmark_optimistic_map(T &test_map,
+    size_t const iterations_count, size_t const percent_write, std::function<void(void)> burn_cpu, const bool measure_latency = false)
+{
+    const unsigned int seed = (unsigned)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<size_t> index_distribution(0, test_map.size() - 1);
+    std::chrono::high_resolution_clock::time_point hrc_end, hrc_start = std::chrono::high_resolution_clock::now();
+    double max_time = 0;
+    std::vector<double> median_arr;
+
+    for (size_t i = 0; i < iterations_count; ++i) {
+        int const rnd_index = (int)index_distribution(generator);
+        bool const write_flag = (percent_distribution(generator) < percent_write);
+        int const num_op = (write_flag) ? i % 2 : read_op;   // (insert_op, delete_op), read_op
+
+        if (measure_latency) {
+            hrc_end = std::chrono::high_resolution_clock::now();
+            const double cur_time = std::chrono::duration<double>(hrc_end - hrc_start).count();
+            max_time = std::max(max_time, cur_time);
+            if (median_arr.size() == 0) median_arr.resize(std::min(median_array_size, iterations_count));
+            if (i < median_arr.size()) median_arr[i] = cur_time;
+            hrc_start = std::chrono::high_resolution_clock::now();
+        }
+
+		burn_cpu(); // We simulate real work
+
+        bool success_op;
+        switch (num_op) {
+        case insert_op:
+            test_map.emplace(rnd_index, field_t(rnd_index, rnd_index));
+            break;
+        case delete_op:
+            success_op = test_map.erase(rnd_index);
+            break;
+        case read_op: {
+            field_t field;
+            if (test_map.find(rnd_index, field))        // optimistic read - without locks
+                success_op = test_map.update(rnd_index, [](field_t &val) {
+                    volatile int money = val.money;     // get value
+                    val.money += 10;                    // update value
+                });
+        }
+            break;
+        default: std::cout << "\n wrong way! \n";  break;
+        }
+    }
+
+    safe_vec_max_latency->push_back(max_time);
+    safe_vec_median_latency->insert(safe_vec_median_latency->end(), median_arr.begin(), median_arr.end());
+}
+
+
 template<typename T>
 void benchmark_map_partitioned(T &test_map,
     size_t const iterations_count, size_t const percent_write, std::function<void(void)> burn_cpu, const bool measure_latency = false)
@@ -331,8 +385,16 @@ int main(int argc, char** argv)
 		custom_max_threads = std::stoi(std::string(argv[1]));		// max threads
 	}
 
+	size_t burn_cpu_iterations = 9000;	// size of real work between each multithread data exchange
+	if (argc >= 3) {
+		burn_cpu_iterations = std::stoi(std::string(argv[2]));
+	}
+	if (argc >= 4) {
+		percent_write = std::stoi(std::string(argv[3]));		// % of write operations
+	}
+
 	// simulate a work of real program
-	std::function<void(void)> burn_cpu = []() { for (volatile int i = 0; i < 9000; ++i); };
+	std::function<void(void)> burn_cpu = [burn_cpu_iterations]() { for (volatile size_t i = 0; i < burn_cpu_iterations; ++i); };
 	{
 		std::chrono::steady_clock::time_point steady_start, steady_end;
 		double took_time = 0;
@@ -383,8 +445,17 @@ int main(int argc, char** argv)
 	// The requirement of RCU lock during iterating means that deletion of the elements(i.e.erase) is not possible.
 	cds::container::SkipListMap< rcu_gpb, int, field_t > skiplist_map;
 
+	// SAFE_PTR
+	// B+tree with optimistic lock coupling: readers validate versions of nodes, writers lock only the nodes they change
+	olc_btree<int, field_t> olc_tree;
+
 
 	// SAFE_PTR
+	// thread-safe ordered std::map with exclusive locks: kernel mutex, spin-lock and adaptive spin-then-park mutex
+	recursive_mutex_safe_ptr< std::map<int, safe_obj_field_t> > safe_map_recursive_mutex;
+	safe_ptr< std::map<int, safe_obj_field_t>, recursive_spinlock_t > safe_map_spinlock;
+	safe_ptr< std::map<int, safe_obj_field_t>, adaptive_mutex<> > safe_map_adaptive_mutex;
+
 	// thread-safe ordered std::map by using execute around pointer idiom with contention-free shared-lock
 	contfree_safe_ptr< std::map<int, safe_obj_field_t> > safe_map_contfree;
 
@@ -424,19 +495,29 @@ int main(int argc, char** argv)
 			std_sm_map.clear();
 			branson_avltree_map.clear();
 			skiplist_map.clear();
+			olc_tree.clear();
+			safe_map_recursive_mutex->clear();
+			safe_map_spinlock->clear();
+			safe_map_adaptive_mutex->clear();
 			safe_map_contfree->clear();
 			safe_map_part_contfree.clear();
 
 			// init maps
+			std::vector<std::pair<int, field_t>> rows;
 			for (size_t i = 0; i < container_size; ++i)
 			{
+				rows.emplace_back(i, field_t(i, i));
 				std_map.emplace(i, field_t(i, i));
 				std_sm_map.emplace(i, field_t(i, i));
 				branson_avltree_map.emplace(i, field_t(i, i));
 				skiplist_map.emplace(i, field_t(i, i));
-				safe_map_contfree->emplace(i, field_t(i, i));
-				safe_map_part_contfree.emplace(i, field_t(i, i));
+				olc_tree.emplace(i, field_t(i, i));
 			}
+			bulk_load(safe_map_recursive_mutex, rows.begin(), rows.end());
+			bulk_load(safe_map_spinlock, rows.begin(), rows.end());
+			bulk_load(safe_map_adaptive_mutex, rows.begin(), rows.end());
+			bulk_load(safe_map_contfree, rows.begin(), rows.end());
+			safe_map_part_contfree.bulk_load(rows.begin(), rows.end());
 
 			std::chrono::steady_clock::time_point steady_start, steady_end;
 			double took_time = 0;
@@ -538,6 +619,99 @@ int main(int argc, char** argv)
 
 
 
+			std::cout << "olc_btree:        ";
+			steady_start = std::chrono::steady_clock::now();
+			for (auto &i : vec_thread)
+				i = std::move(std::thread([&]()
+			{
+				benchmark_optimistic_map(olc_tree, iterations_count, percent_write, burn_cpu, measure_latency);
+
+			}));
+			for (auto &i : vec_thread) i.join();
+			steady_end = std::chrono::steady_clock::now();
+			took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+			std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000));
+			if (measure_latency) {
+				std::sort(safe_vec_median_latency->begin(), safe_vec_median_latency->end());
+				std::cout << " \t " << (safe_vec_median_latency->at(safe_vec_median_latency->size() / 2) * 1000000) <<
+					" \t " << (safe_vec_median_latency->at(vec_thread.size()) * 1000000) <<
+					" \t " << *std::max_element(safe_vec_max_latency->begin(), safe_vec_max_latency->end()) * 1000000;
+			}
+			std::cout << std::endl;
+			safe_vec_max_latency->clear();
+			safe_vec_median_latency->clear();
+
+
+
+			std::cout << "safe_map_recursive_mutex:";
+			steady_start = std::chrono::steady_clock::now();
+			for (auto &i : vec_thread)
+				i = std::move(std::thread([&]()
+			{
+				benchmark_safe_map(safe_map_recursive_mutex, iterations_count, percent_write, burn_cpu, measure_latency);
+
+			}));
+			for (auto &i : vec_thread) i.join();
+			steady_end = std::chrono::steady_clock::now();
+			took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+			std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000));
+			if (measure_latency) {
+				std::sort(safe_vec_median_latency->begin(), safe_vec_median_latency->end());
+				std::cout << " \t " << (safe_vec_median_latency->at(safe_vec_median_latency->size() / 2) * 1000000) <<
+					" \t " << (safe_vec_median_latency->at(vec_thread.size()) * 1000000) <<
+					" \t " << *std::max_element(safe_vec_max_latency->begin(), safe_vec_max_latency->end()) * 1000000;
+			}
+			std::cout << std::endl;
+			safe_vec_max_latency->clear();
+			safe_vec_median_latency->clear();
+
+
+			std::cout << "safe_map_spinlock:  ";
+			steady_start = std::chrono::steady_clock::now();
+			for (auto &i : vec_thread)
+				i = std::move(std::thread([&]()
+			{
+				benchmark_safe_map(safe_map_spinlock, iterations_count, percent_write, burn_cpu, measure_latency);
+
+			}));
+			for (auto &i : vec_thread) i.join();
+			steady_end = std::chrono::steady_clock::now();
+			took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+			std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000));
+			if (measure_latency) {
+				std::sort(safe_vec_median_latency->begin(), safe_vec_median_latency->end());
+				std::cout << " \t " << (safe_vec_median_latency->at(safe_vec_median_latency->size() / 2) * 1000000) <<
+					" \t " << (safe_vec_median_latency->at(vec_thread.size()) * 1000000) <<
+					" \t " << *std::max_element(safe_vec_max_latency->begin(), safe_vec_max_latency->end()) * 1000000;
+			}
+			std::cout << std::endl;
+			safe_vec_max_latency->clear();
+			safe_vec_median_latency->clear();
+
+
+			std::cout << "safe_map_adaptive_mutex:";
+			steady_start = std::chrono::steady_clock::now();
+			for (auto &i : vec_thread)
+				i = std::move(std::thread([&]()
+			{
+				benchmark_safe_map(safe_map_adaptive_mutex, iterations_count, percent_write, burn_cpu, measure_latency);
+
+			}));
+			for (auto &i : vec_thread) i.join();
+			steady_end = std::chrono::steady_clock::now();
+			took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+			std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000));
+			if (measure_latency) {
+				std::sort(safe_vec_median_latency->begin(), safe_vec_median_latency->end());
+				std::cout << " \t " << (safe_vec_median_latency->at(safe_vec_median_latency->size() / 2) * 1000000) <<
+					" \t " << (safe_vec_median_latency->at(vec_thread.size()) * 1000000) <<
+					" \t " << *std::max_element(safe_vec_max_latency->begin(), safe_vec_max_latency->end()) * 1000000;
+			}
+			std::cout << std::endl;
+			safe_vec_max_latency->clear();
+			safe_vec_median_latency->clear();
+
+
 			std::cout << "safe_map_contfree:  ";
 			steady_start = std::chrono::steady_clock::now();
 			for (auto &i : vec_thread)
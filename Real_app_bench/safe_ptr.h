@@ -18,17 +18,69 @@
 #include <random>
 #include <iomanip>
 #include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <functional>
+#include <exception>
+#include <limits>
+#include <tuple>
+#include <iterator>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
 
-//#define SHARED_MTX   // C++14
+// Autodetect C++14
+#if (__cplusplus >= 201402L || _MSC_VER >= 1900)
+#define SHARED_MTX
+#include <shared_mutex>
+#endif
+
+// Autodetect C++20 coroutines
+#if defined(__cpp_impl_coroutine)
+#define COROUTINE_MTX
+#include <coroutine>
+#endif
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>    // adaptive_mutex parks on futex
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#include <malloc.h>     // _aligned_malloc() for slabs of node_pool_allocator<>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SNAPSHOT_MMAP
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>   // safe_map_partitioned_t::load_snapshot() maps the file to memory
+#endif
 
-#ifdef SHARED_MTX
-#include <shared_mutex>   // C++14
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+#include <emmintrin.h>  // btree_map searches int keys in a node by SSE2
 #endif
 
 namespace sf {
 
+    struct recursive_lock_t {};     // recursion policy of adaptive_mutex<>: the same thread can lock it many times
+    struct non_recursive_lock_t {};
+
+    template<typename recursion_policy_t = recursive_lock_t, unsigned max_spin_ticks = 20000>
+    class adaptive_mutex;
 
-    template<typename T, typename mutex_t = std::recursive_mutex, typename x_lock_t = std::unique_lock<mutex_t>,
+    struct async_executor_t;
+    template<typename T, typename mutex_t, bool shared> class async_lock_t;    // awaitable: co_await sp.xlock()
+    template<bool shared, typename T, typename mutex_t, typename callback_t>
+    void lock_with_callback(T *obj, mutex_t &mtx, callback_t &&callback, async_executor_t *executor);
+
+    // forwarding constructors are disabled for the only argument of its own class - for them copy and move constructors are used
+    template<typename self_t, typename... Args> struct is_self_arg : std::false_type {};
+    template<typename self_t, typename arg_t> struct is_self_arg<self_t, arg_t> : std::is_base_of<self_t, typename std::decay<arg_t>::type> {};
+
+    template<typename T, typename mutex_t = adaptive_mutex<>, typename x_lock_t = std::unique_lock<mutex_t>,
         typename s_lock_t = std::unique_lock<mutex_t >>
         // std::shared_lock<std::shared_timed_mutex>, when mutex_t = std::shared_timed_mutex
     class safe_ptr {
@@ -72,7 +124,10 @@ namespace sf {
             template<typename, typename, typename, typename> friend class safe_obj;
             template<typename some_type> friend struct xlocked_safe_ptr;
             template<typename some_type> friend struct slocked_safe_ptr;
+            template<size_t, typename, size_t, size_t> friend class lock_timed_any;
             template<typename, typename, size_t, size_t> friend class lock_timed_transaction;
+            template<typename, typename, template<class> class, typename, typename> friend class safe_map_partitioned_t;
+            template<typename, typename, template<class> class, typename, typename> friend class safe_unordered_map_partitioned_t;
 #if (_MSC_VER && _MSC_VER == 1900)
             template<class... mutex_types> friend class std::lock_guard;  // MSVS2015
 #else
@@ -83,21 +138,41 @@ namespace sf {
 #endif
 
         public:
-            template<typename... Args>
-            safe_ptr(Args... args) : ptr(std::make_shared<T>(args...)), mtx_ptr(std::make_shared<mutex_t>()) {}
+            template<typename... Args, typename = typename std::enable_if<!is_self_arg<safe_ptr, Args...>::value>::type>
+            safe_ptr(Args &&...args) : ptr(std::make_shared<T>(std::forward<Args>(args)...)), mtx_ptr(std::make_shared<mutex_t>()) {}
 
             auto_lock_t<x_lock_t> operator -> () { return auto_lock_t<x_lock_t>(get_obj_ptr(), *get_mtx_ptr()); }
             auto_lock_obj_t<x_lock_t> operator * () { return auto_lock_obj_t<x_lock_t>(get_obj_ptr(), *get_mtx_ptr()); }
             const auto_lock_t<s_lock_t> operator -> () const { return auto_lock_t<s_lock_t>(get_obj_ptr(), *get_mtx_ptr()); }
             const auto_lock_obj_t<s_lock_t> operator * () const { return auto_lock_obj_t<s_lock_t>(get_obj_ptr(), *get_mtx_ptr()); }
 
+            // asynchronous locks: auto x_obj = co_await sp.xlock(); (C++20) or sp.xlock([](T &obj) {...}); - callback is called
+            // when the lock is acquired. With async_shared_mutex the waiter doesn't block the thread and is resumed by unlock()
+            // in the unlocking thread or by the executor, with other mutexes the lock is blocking.
+            async_lock_t<T, mutex_t, false> xlock(async_executor_t *executor = nullptr) const {
+                return async_lock_t<T, mutex_t, false>(get_obj_ptr(), *get_mtx_ptr(), executor);
+            }
+            async_lock_t<T, mutex_t, true> slock(async_executor_t *executor = nullptr) const {
+                return async_lock_t<T, mutex_t, true>(get_obj_ptr(), *get_mtx_ptr(), executor);
+            }
+            template<typename callback_t, typename = typename std::enable_if<!std::is_convertible<callback_t, async_executor_t *>::value>::type>
+            void xlock(callback_t &&callback, async_executor_t *executor = nullptr) const {
+                lock_with_callback<false>(get_obj_ptr(), *get_mtx_ptr(), std::forward<callback_t>(callback), executor);
+            }
+            template<typename callback_t, typename = typename std::enable_if<!std::is_convertible<callback_t, async_executor_t *>::value>::type>
+            void slock(callback_t &&callback, async_executor_t *executor = nullptr) const {
+                lock_with_callback<true>(get_obj_ptr(), *get_mtx_ptr(), std::forward<callback_t>(callback), executor);
+            }
+
             typedef mutex_t mtx_t;
             typedef T obj_t;
             typedef x_lock_t xlock_t;
             typedef s_lock_t slock_t;
     };
 
-    template<typename T> using default_safe_ptr = safe_ptr<T, std::recursive_mutex, std::unique_lock<std::recursive_mutex>, std::unique_lock<std::recursive_mutex>>;
+    template<typename T> using default_safe_ptr = safe_ptr<T, adaptive_mutex<>, std::unique_lock<adaptive_mutex<>>, std::unique_lock<adaptive_mutex<>>>;
+
+    template<typename T> using recursive_mutex_safe_ptr = safe_ptr<T, std::recursive_mutex, std::unique_lock<std::recursive_mutex>, std::unique_lock<std::recursive_mutex>>;
 
 #ifdef SHARED_MTX // C++14
     template<typename T> using shared_mutex_safe_ptr =
@@ -105,7 +180,7 @@ namespace sf {
 #endif
     // ---------------------------------------------------------------
 
-    template<typename T, typename mutex_t = std::recursive_mutex, typename x_lock_t = std::unique_lock<mutex_t>,
+    template<typename T, typename mutex_t = adaptive_mutex<>, typename x_lock_t = std::unique_lock<mutex_t>,
         typename s_lock_t = std::unique_lock<mutex_t >>
     class safe_obj {
         protected:
@@ -120,10 +195,13 @@ namespace sf {
             using auto_nolock_t = typename safe_ptr<T, mutex_t, x_lock_t, s_lock_t>::auto_nolock_t;
             template<typename some_type> friend struct xlocked_safe_ptr;
             template<typename some_type> friend struct slocked_safe_ptr;
+            template<size_t, typename, size_t, size_t> friend class lock_timed_any;
+            template<typename, typename, size_t, size_t> friend class lock_timed_transaction;
         public:
-            template<typename... Args>
-            safe_obj(Args... args) : obj(args...) {}
+            template<typename... Args, typename = typename std::enable_if<!is_self_arg<safe_obj, Args...>::value>::type>
+            safe_obj(Args &&...args) : obj(std::forward<Args>(args)...) {}
             safe_obj(safe_obj const& safe_obj) { std::lock_guard<mutex_t> lock(safe_obj.mtx); obj = safe_obj.obj; }
+            safe_obj(safe_obj &&safe_obj) { std::lock_guard<mutex_t> lock(safe_obj.mtx); obj = std::move(safe_obj.obj); }
             explicit operator T() const { s_lock_t lock(mtx); T obj_tmp = obj; return obj_tmp; };
 
             auto_lock_t<x_lock_t> operator -> () { return auto_lock_t<x_lock_t>(get_obj_ptr(), *get_mtx_ptr()); }
@@ -131,6 +209,22 @@ namespace sf {
             const auto_lock_t<s_lock_t> operator -> () const { return auto_lock_t<s_lock_t>(get_obj_ptr(), *get_mtx_ptr()); }
             const auto_lock_obj_t<s_lock_t> operator * () const { return auto_lock_obj_t<s_lock_t>(get_obj_ptr(), *get_mtx_ptr()); }
 
+            // asynchronous locks - the same as in safe_ptr<>
+            async_lock_t<T, mutex_t, false> xlock(async_executor_t *executor = nullptr) const {
+                return async_lock_t<T, mutex_t, false>(get_obj_ptr(), *get_mtx_ptr(), executor);
+            }
+            async_lock_t<T, mutex_t, true> slock(async_executor_t *executor = nullptr) const {
+                return async_lock_t<T, mutex_t, true>(get_obj_ptr(), *get_mtx_ptr(), executor);
+            }
+            template<typename callback_t, typename = typename std::enable_if<!std::is_convertible<callback_t, async_executor_t *>::value>::type>
+            void xlock(callback_t &&callback, async_executor_t *executor = nullptr) const {
+                lock_with_callback<false>(get_obj_ptr(), *get_mtx_ptr(), std::forward<callback_t>(callback), executor);
+            }
+            template<typename callback_t, typename = typename std::enable_if<!std::is_convertible<callback_t, async_executor_t *>::value>::type>
+            void slock(callback_t &&callback, async_executor_t *executor = nullptr) const {
+                lock_with_callback<true>(get_obj_ptr(), *get_mtx_ptr(), std::forward<callback_t>(callback), executor);
+            }
+
             typedef mutex_t mtx_t;
             typedef T obj_t;
             typedef x_lock_t xlock_t;
@@ -139,13 +233,15 @@ namespace sf {
     // ---------------------------------------------------------------
 
     // hide ptr
-    template<typename T, typename mutex_t = std::recursive_mutex, typename x_lock_t = std::unique_lock<mutex_t>,
+    template<typename T, typename mutex_t = adaptive_mutex<>, typename x_lock_t = std::unique_lock<mutex_t>,
         typename s_lock_t = std::unique_lock<mutex_t >>
     class safe_hide_ptr : protected safe_ptr<T, mutex_t, x_lock_t, s_lock_t> {
         public:
-            template<typename... Args> safe_hide_ptr(Args... args) : safe_ptr<T, mutex_t, x_lock_t, s_lock_t>(args...) {}
+            template<typename... Args, typename = typename std::enable_if<!is_self_arg<safe_hide_ptr, Args...>::value>::type>
+            safe_hide_ptr(Args &&...args) : safe_ptr<T, mutex_t, x_lock_t, s_lock_t>(std::forward<Args>(args)...) {}
 
             friend struct link_safe_ptrs;
+            template<size_t, typename, size_t, size_t> friend class lock_timed_any;
             template<typename, typename, size_t, size_t> friend class lock_timed_transaction;
             template<typename some_type> friend struct xlocked_safe_ptr;
             template<typename some_type> friend struct slocked_safe_ptr;
@@ -160,14 +256,16 @@ namespace sf {
     };
 
     // hide obj
-    template<typename T, typename mutex_t = std::recursive_mutex, typename x_lock_t = std::unique_lock<mutex_t>,
+    template<typename T, typename mutex_t = adaptive_mutex<>, typename x_lock_t = std::unique_lock<mutex_t>,
         typename s_lock_t = std::unique_lock<mutex_t >>
     class safe_hide_obj : protected safe_obj<T, mutex_t, x_lock_t, s_lock_t> {
         public:
-            template<typename... Args> safe_hide_obj(Args... args) : safe_obj<T, mutex_t, x_lock_t, s_lock_t>(args...) {}
+            template<typename... Args, typename = typename std::enable_if<!is_self_arg<safe_hide_obj, Args...>::value>::type>
+            safe_hide_obj(Args &&...args) : safe_obj<T, mutex_t, x_lock_t, s_lock_t>(std::forward<Args>(args)...) {}
             explicit operator T() const { return static_cast< safe_obj<T, mutex_t, x_lock_t, s_lock_t> >(*this); };
 
             friend struct link_safe_ptrs;
+            template<size_t, typename, size_t, size_t> friend class lock_timed_any;
             template<typename, typename, size_t, size_t> friend class lock_timed_transaction;
             template<typename some_type> friend struct xlocked_safe_ptr;
             template<typename some_type> friend struct slocked_safe_ptr;
@@ -182,6 +280,18 @@ namespace sf {
     };
     // ---------------------------------------------------------------
 
+    // unlinks group members in destructor - returned by link_safe_ptrs::link_temporary()
+    template<typename mutex_t>
+    class lock_group_link_t {
+        std::vector<std::shared_ptr<mutex_t>> members;
+    public:
+        lock_group_link_t(std::vector<std::shared_ptr<mutex_t>> &&mtxs) : members(std::move(mtxs)) {}
+        lock_group_link_t(lock_group_link_t&& other) : members(std::move(other.members)) { other.members.clear(); }
+        ~lock_group_link_t() { for (auto &i : members) mutex_t::unlink(*i); }
+        lock_group_link_t(const lock_group_link_t&) = delete;
+        lock_group_link_t& operator=(const lock_group_link_t&) = delete;
+    };
+
     struct link_safe_ptrs {
         template<typename T1, typename... Args>
         link_safe_ptrs(T1 &first_ptr, Args&... args) {
@@ -191,7 +301,296 @@ namespace sf {
             std::shared_ptr<std::lock_guard<mutex_t>> locks[] = { std::make_shared<std::lock_guard<mutex_t>>(*args.mtx_ptr) ... };
             std::shared_ptr<mutex_t> mtxs[] = { (args.mtx_ptr = first_ptr.mtx_ptr) ... };
         }
+
+        // dynamic lock groups - only for safe_ptrs with mutex_t = lock_group_mutex<> (lock_group_safe_ptr<>)
+        // group = objects with the same current mutex, membership can be changed at any time by any thread
+
+        // link args to the current mutex of first_ptr (until unlink)
+        template<typename T1, typename... Args>
+        static void relink(T1 &first_ptr, Args&... args) {
+            bool const linked[] = { true, (T1::mtx_t::relink(*args.mtx_ptr, first_ptr.mtx_ptr), true) ... };
+            (void)linked;
+        }
+
+        // return each object to its own mutex
+        template<typename... Args>
+        static void unlink(Args&... args) {
+            bool const unlinked[] = { true, (Args::mtx_t::unlink(*args.mtx_ptr), true) ... };
+            (void)unlinked;
+        }
+
+        // temporary link for a batch of operations: objects are unlinked when the returned guard is destroyed
+        template<typename T1, typename... Args>
+        static lock_group_link_t<typename T1::mtx_t> link_temporary(T1 &first_ptr, Args&... args) {
+            relink(first_ptr, args...);
+            return lock_group_link_t<typename T1::mtx_t>({ first_ptr.mtx_ptr, args.mtx_ptr ... });
+        }
+
+        // split group back to per-object mutexes if (contended locks / all locks) > max_contention since the last check
+        template<typename... Args>
+        static bool unlink_if_contended(double const max_contention, Args&... args) {
+            size_t locks = 0, contended = 0;
+            bool const stats[] = { true, (args.mtx_ptr->get_and_reset_stats(locks, contended), true) ... };
+            (void)stats;
+            if (locks == 0 || (double)contended / locks <= max_contention) return false;
+            unlink(args...);
+            return true;
+        }
+    };
+    // ---------------------------------------------------------------
+
+	enum lock_count_t { lock_once, lock_infinity };
+
+	template<size_t lock_count, typename duration = std::chrono::nanoseconds,
+		size_t deadlock_timeout = 100000, size_t spin_iterations = 100>
+		class lock_timed_any {
+		std::vector<std::shared_ptr<void>> locks_ptr_vec;
+		bool success;
+
+		template<typename mtx_t>
+		std::unique_lock<mtx_t> try_lock_one(mtx_t &mtx) const {
+			std::unique_lock<mtx_t> lock(mtx, std::defer_lock_t());
+			for (size_t i = 0; i < spin_iterations; ++i) if (lock.try_lock()) return lock;
+			const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+			//while (!lock.try_lock_for(duration(deadlock_timeout)))    // only for timed mutexes
+			while (!lock.try_lock()) {
+				auto const time_remained = duration(deadlock_timeout) - std::chrono::duration_cast<duration>(std::chrono::steady_clock::now() - start_time);
+				if (time_remained <= duration(0))
+					break;
+				else
+					std::this_thread::sleep_for(time_remained);
+			}
+			return lock;
+		}
+
+		template<typename mtx_t>
+		std::shared_ptr<std::unique_lock<mtx_t>> try_lock_ptr_one(mtx_t &mtx) const {
+			return std::make_shared<std::unique_lock<mtx_t>>(try_lock_one(mtx));
+		}
+
+		public:
+			template<typename... Args>
+			lock_timed_any(Args& ...args) {
+				do {
+					success = true;
+					for (auto &lock_ptr : { try_lock_ptr_one(*args.mtx_ptr.get()) ... }) {
+						locks_ptr_vec.emplace_back(lock_ptr);
+						if (!lock_ptr->owns_lock()) {
+							success = false;
+							locks_ptr_vec.clear();
+							std::this_thread::sleep_for(duration(deadlock_timeout));
+							break;
+						}
+					}
+				} while (!success && lock_count == lock_count_t::lock_infinity);
+			}
+
+			explicit operator bool() const throw() { return success; }
+			lock_timed_any(lock_timed_any&& other) throw() : locks_ptr_vec(other.locks_ptr_vec) { }
+			lock_timed_any(const lock_timed_any&) = delete;
+			lock_timed_any& operator=(const lock_timed_any&) = delete;
+	};
+
+	using lock_timed_any_once = lock_timed_any<lock_count_t::lock_once>;
+	using lock_timed_any_infinity = lock_timed_any<lock_count_t::lock_infinity>;
+	// ---------------------------------------------------------------
+
+    // conflict resolution policies for lock_timed_transaction<> (timestamp: smaller = older)
+    struct wound_wait_t {};     // older transaction wounds (aborts) younger owner, younger one waits for older owner
+    struct wait_die_t {};       // older transaction waits for younger owner, younger one dies (aborts) at once
+
+    namespace transaction_details {
+
+        struct txn_state_t {
+            char avoid_falsesharing_1[64];
+            std::atomic<uint64_t> timestamp;    // 0 - thread isn't in transaction
+            std::atomic<bool> wounded;          // set by older transaction (wound-wait)
+            char avoid_falsesharing_2[64];
+            txn_state_t() : timestamp(0), wounded(false) {}
+        };
+
+        // states are never deleted (only reused by new threads), because other threads
+        // can read the owner of mutex from owner_table() after the owner-thread has finished
+        class txn_state_pool_t {
+            std::mutex mtx;
+            std::vector<txn_state_t *> free_states;
+        public:
+            txn_state_t * get() {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (free_states.empty()) return new txn_state_t();
+                txn_state_t *state = free_states.back();
+                free_states.pop_back();
+                return state;
+            }
+            void put(txn_state_t *state) { std::lock_guard<std::mutex> lock(mtx); free_states.push_back(state); }
+            static txn_state_pool_t& instance() { static txn_state_pool_t *pool = new txn_state_pool_t(); return *pool; }
+        };
+
+        struct thread_txn_state_t {
+            txn_state_t *const ptr;
+            thread_txn_state_t() : ptr(txn_state_pool_t::instance().get()) {}
+            ~thread_txn_state_t() { txn_state_pool_t::instance().put(ptr); }
+        };
+
+        inline txn_state_t& this_thread_state() { thread_local static thread_txn_state_t state; return *state.ptr; }
+
+        inline std::atomic<uint64_t>& timestamp_counter() { static std::atomic<uint64_t> counter(0); return counter; }
+
+        // record of the mutex locked by a transaction - linked into its bucket of owner_table_t while the mutex is locked
+        struct owner_record_t { void const *mtx; txn_state_t *owner; owner_record_t *next; };
+
+        // owners of mutexes locked by transactions: hash table with chaining by the address of the mutex.
+        // Each bucket is locked by its own flag - only to link, unlink or find a record
+        class owner_table_t {
+            enum { buckets_count = 4096 };
+            struct bucket_t { std::atomic<bool> locked; owner_record_t *head; };
+            bucket_t buckets[buckets_count];
+
+            static size_t bucket_index(void const* mtx) {
+                return (size_t)(((uint64_t)(uintptr_t)mtx * 0x9E3779B97F4A7C15ULL) >> 32) % buckets_count;
+            }
+            class bucket_lock_t {
+                bucket_t &bucket;
+            public:
+                explicit bucket_lock_t(bucket_t &b) : bucket(b) { while (bucket.locked.exchange(true, std::memory_order_acquire)) std::this_thread::yield(); }
+                ~bucket_lock_t() { bucket.locked.store(false, std::memory_order_release); }
+            };
+
+        public:
+            void add(owner_record_t &record) {
+                bucket_t &bucket = buckets[bucket_index(record.mtx)];
+                bucket_lock_t lock(bucket);
+                record.next = bucket.head;
+                bucket.head = &record;
+            }
+            void remove(owner_record_t &record) {
+                bucket_t &bucket = buckets[bucket_index(record.mtx)];
+                bucket_lock_t lock(bucket);
+                for (owner_record_t **ptr = &bucket.head; *ptr; ptr = &(*ptr)->next)
+                    if (*ptr == &record) { *ptr = record.next; return; }
+            }
+            // nullptr - the mutex isn't locked by a transaction (or its owner hasn't linked the record yet)
+            txn_state_t * owner_of(void const* mtx) {
+                bucket_t &bucket = buckets[bucket_index(mtx)];
+                bucket_lock_t lock(bucket);
+                for (owner_record_t const *record = bucket.head; record; record = record->next)
+                    if (record->mtx == mtx) return record->owner;
+                return nullptr;
+            }
+        };
+        inline owner_table_t& owner_table() { static owner_table_t table; return table; }    // zero-initialized (static)
+    }
+
+    // multi-object transaction lock: locks all objects or none, in any order without deadlocks.
+    // Each transaction gets a timestamp, conflicts are resolved by conflict_policy_t (wound_wait_t or wait_die_t),
+    // aborted transaction releases all own locks, waits (exponential backoff) and retries with the same timestamp -
+    // so it becomes the oldest one and can't starve.
+    // deadlock_timeout - only a safety net for mutexes locked outside of transactions (their owner is unknown),
+    // spin_iterations - try_lock() before yield().
+    // Only one transaction per thread at a time.
+    template<typename conflict_policy_t = wound_wait_t, typename duration = std::chrono::nanoseconds,
+        size_t deadlock_timeout = 100000000, size_t spin_iterations = 100>
+    class lock_timed_transaction {
+        typedef transaction_details::txn_state_t txn_state_t;
+        struct held_lock_t { void *mtx; void(*unlock)(void *); transaction_details::owner_record_t record; };
+        std::vector<held_lock_t> held_locks;    // reserved for all locks - records linked into owner_table() aren't moved
+        txn_state_t &state;
+        uint64_t timestamp;
+        size_t aborts;
+        bool success;
+
+        template<typename mtx_t> static void unlock_one(void *mtx) { static_cast<mtx_t *>(mtx)->unlock(); }
+
+        // true - abort this transaction
+        static bool resolve_conflict(wound_wait_t, bool older, bool, txn_state_t &owner) {
+            if (older) owner.wounded.store(true, std::memory_order_release);
+            return false;
+        }
+        static bool resolve_conflict(wait_die_t, bool, bool younger, txn_state_t &) { return younger; }
+
+        template<typename mtx_t>
+        bool lock_one(mtx_t &mtx) {
+            transaction_details::owner_table_t &owners = transaction_details::owner_table();
+            std::chrono::steady_clock::time_point start_time;
+
+            for (size_t i = 0;; ++i) {
+                if (mtx.try_lock()) {
+                    held_locks.push_back({ &mtx, &unlock_one<mtx_t>, { &mtx, &state, nullptr } });
+                    owners.add(held_locks.back().record);
+                    return true;
+                }
+                if (state.wounded.load(std::memory_order_acquire)) return false;
+
+                txn_state_t *const owner = owners.owner_of(&mtx);
+                if (owner != nullptr && owner != &state) {
+                    uint64_t const owner_timestamp = owner->timestamp.load(std::memory_order_acquire);
+                    if (owner_timestamp != 0 &&
+                        resolve_conflict(conflict_policy_t(), timestamp < owner_timestamp, timestamp > owner_timestamp, *owner))
+                        return false;
+                }
+
+                if (i == spin_iterations) start_time = std::chrono::steady_clock::now();
+                else if (i > spin_iterations) {
+                    if (std::chrono::steady_clock::now() - start_time > duration(deadlock_timeout)) return false;
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        void release_all() {
+            for (auto it = held_locks.rbegin(); it != held_locks.rend(); ++it) {
+                transaction_details::owner_table().remove(it->record);     // before unlock: the next owner links its own record
+                it->unlock(it->mtx);
+            }
+            held_locks.clear();
+        }
+
+        void backoff(size_t attempt) const {
+            thread_local static std::default_random_engine generator((unsigned)std::hash<std::thread::id>()(std::this_thread::get_id()));
+            size_t const max_wait = (size_t)1000 << std::min<size_t>(attempt, 10);     // 1 usec - 1 msec
+            std::uniform_int_distribution<size_t> wait_distribution(max_wait / 2, max_wait);
+            auto const end_time = std::chrono::steady_clock::now() + std::chrono::nanoseconds(wait_distribution(generator));
+            while (std::chrono::steady_clock::now() < end_time) std::this_thread::yield();
+        }
+
+    public:
+        template<typename... Args>
+        lock_timed_transaction(Args& ...args) : state(transaction_details::this_thread_state()),
+            timestamp(++transaction_details::timestamp_counter()), aborts(0), success(false)
+        {
+            assert(state.timestamp.load() == 0);    // nested transactions aren't supported
+            held_locks.reserve(sizeof...(Args));
+            state.timestamp.store(timestamp, std::memory_order_release);
+            do {
+                state.wounded.store(false, std::memory_order_release);
+                success = true;
+                bool const locked[] = { (success = success && lock_one(*args.get_mtx_ptr())) ... };
+                (void)locked;
+                if (!success) {
+                    release_all();
+                    backoff(aborts++);
+                }
+            } while (!success);
+        }
+
+        ~lock_timed_transaction() {
+            if (!success) return;
+            release_all();
+            state.timestamp.store(0, std::memory_order_release);
+        }
+
+        explicit operator bool() const throw() { return success; }
+        size_t aborts_count() const { return aborts; }
+        uint64_t get_timestamp() const { return timestamp; }
+
+        lock_timed_transaction(lock_timed_transaction&& other) throw() : held_locks(std::move(other.held_locks)), state(other.state),
+            timestamp(other.timestamp), aborts(other.aborts), success(other.success) { other.success = false; }
+        lock_timed_transaction(const lock_timed_transaction&) = delete;
+        lock_timed_transaction& operator=(const lock_timed_transaction&) = delete;
     };
+
+    using lock_transaction_wound_wait = lock_timed_transaction<wound_wait_t>;
+    using lock_transaction_wait_die = lock_timed_transaction<wait_die_t>;
     // ---------------------------------------------------------------
 
     template<typename T>
@@ -227,7 +626,7 @@ namespace sf {
         spinlock_t() { lock_flag.clear(); }
 
         bool try_lock() { return !lock_flag.test_and_set(std::memory_order_acquire); }
-        void lock() { for (volatile size_t i = 0; !try_lock(); ++i) if (i % 100000 == 0) std::this_thread::yield(); }
+        void lock() { for (size_t i = 0; !try_lock(); ++i) if (i % 100000 == 0) std::this_thread::yield(); }
         void unlock() { lock_flag.clear(std::memory_order_release); }
     };
     // ---------------------------------------------------------------
@@ -269,7 +668,7 @@ namespace sf {
         }
 
         void lock() {
-            for (volatile size_t i = 0; !try_lock(); ++i)
+            for (size_t i = 0; !try_lock(); ++i)
                 if (i % 100000 == 0) std::this_thread::yield();
         }
 
@@ -285,6 +684,163 @@ namespace sf {
     };
     // ---------------------------------------------------------------
 
+    namespace adaptive_details {
+        inline void cpu_relax() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+            _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+            __asm__ __volatile__("yield");
+#endif
+        }
+
+        // the cache line of the object is loaded in advance, while the current one is processed
+        inline void prefetch(void const* ptr) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+            _mm_prefetch(static_cast<char const*>(ptr), _MM_HINT_T0);
+#elif defined(__GNUC__)
+            __builtin_prefetch(ptr);
+#else
+            (void)ptr;
+#endif
+        }
+
+        // CPU ticks for spin budget and hold time
+        inline uint64_t ticks() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+            return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+            return __builtin_ia32_rdtsc();
+#else
+            return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        // sleep while value == expected
+        inline void park(std::atomic<uint32_t> &value, uint32_t expected) {
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&value), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#elif defined(__cpp_lib_atomic_wait)   // C++20
+            value.wait(expected);
+#else
+            if (value.load() == expected) std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+        }
+
+        inline void unpark_one(std::atomic<uint32_t> &value) {
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&value), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#elif defined(__cpp_lib_atomic_wait)   // C++20
+            value.notify_one();
+#else
+            (void)value;
+#endif
+        }
+
+        inline bool is_single_core() { static const bool single_core = (std::thread::hardware_concurrency() <= 1); return single_core; }
+    }
+
+    // adaptive spin-then-park mutex: spins (test-and-test-and-set with pause) for a self-tuned number of ticks
+    // = 2 x recent average hold time, if the lock is held longer than max_spin_ticks - parks (futex) without spinning.
+    // recursion_policy_t: recursive_lock_t or non_recursive_lock_t
+    template<typename recursion_policy_t, unsigned max_spin_ticks>
+    class adaptive_mutex {
+        enum { unlocked = 0, locked = 1, locked_with_waiters = 2 };
+        enum { min_spin_ticks = 100, sample_period = 8 };
+        static const bool recursive = std::is_same<recursion_policy_t, recursive_lock_t>::value;
+
+        std::atomic<uint32_t> state;
+        std::atomic<uint32_t> spin_ticks;           // self-tuned spin budget
+        std::atomic<std::thread::id> owner_thread_id;   // only for recursive
+        uint32_t recursive_counter;                 // changed only by owner
+        uint32_t sample_counter;                    // changed only by owner
+        uint64_t hold_start;                        // changed only by owner, 0 - this hold isn't sampled
+
+        void lock_state() {
+            uint32_t cur_state = unlocked;
+            if (state.compare_exchange_strong(cur_state, locked, std::memory_order_acquire)) return;
+
+            if (!adaptive_details::is_single_core()) {
+                uint64_t const budget = spin_ticks.load(std::memory_order_relaxed);
+                uint64_t const start = adaptive_details::ticks();
+                do {
+                    adaptive_details::cpu_relax();
+                    cur_state = state.load(std::memory_order_relaxed);  // test
+                    if (cur_state == unlocked &&                            // and test-and-set
+                        state.compare_exchange_weak(cur_state, locked, std::memory_order_acquire)) return;
+                } while (adaptive_details::ticks() - start < budget);
+            }
+
+            cur_state = state.exchange(locked_with_waiters, std::memory_order_acquire);
+            while (cur_state != unlocked) {
+                adaptive_details::park(state, locked_with_waiters);
+                cur_state = state.exchange(locked_with_waiters, std::memory_order_acquire);
+            }
+        }
+
+        void on_acquired() {
+            if (recursive) {
+                owner_thread_id.store(std::this_thread::get_id(), std::memory_order_relaxed);
+                recursive_counter = 1;
+            }
+            hold_start = (++sample_counter % sample_period == 0) ? adaptive_details::ticks() : 0;
+        }
+
+        void update_spin_ticks() {
+            if (hold_start == 0) return;
+            uint64_t const hold = adaptive_details::ticks() - hold_start;
+            uint64_t const old_ticks = spin_ticks.load(std::memory_order_relaxed);
+            // spinning longer than max_spin_ticks is more expensive than parking
+            uint64_t const target_ticks = (2 * hold <= max_spin_ticks) ? std::max<uint64_t>(2 * hold, min_spin_ticks) : uint64_t(min_spin_ticks);
+            spin_ticks.store((uint32_t)((old_ticks * 7 + target_ticks) / 8), std::memory_order_relaxed);
+        }
+
+    public:
+        adaptive_mutex() : state(unlocked), spin_ticks(max_spin_ticks / 4), owner_thread_id(std::thread::id()),
+            recursive_counter(0), sample_counter(0), hold_start(0) {}
+        adaptive_mutex(adaptive_mutex const&) = delete;
+        adaptive_mutex& operator=(adaptive_mutex const&) = delete;
+
+        void lock() {
+            if (recursive && owner_thread_id.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+                ++recursive_counter;
+                return;
+            }
+            lock_state();
+            on_acquired();
+        }
+
+        bool try_lock() {
+            if (recursive && owner_thread_id.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+                ++recursive_counter;
+                return true;
+            }
+            uint32_t cur_state = unlocked;
+            if (!state.compare_exchange_strong(cur_state, locked, std::memory_order_acquire)) return false;
+            on_acquired();
+            return true;
+        }
+
+        void unlock() {
+            if (recursive) {
+                assert(owner_thread_id.load(std::memory_order_relaxed) == std::this_thread::get_id());
+                if (--recursive_counter > 0) return;
+                owner_thread_id.store(std::thread::id(), std::memory_order_relaxed);
+            }
+            update_spin_ticks();
+            if (state.exchange(unlocked, std::memory_order_release) == locked_with_waiters)
+                adaptive_details::unpark_one(state);
+        }
+
+        unsigned get_spin_ticks() const { return spin_ticks.load(std::memory_order_relaxed); }
+    };
+
+    using adaptive_recursive_mutex = adaptive_mutex<recursive_lock_t>;
+    using adaptive_non_recursive_mutex = adaptive_mutex<non_recursive_lock_t>;
+
+    // ---------------------------------------------------------------
+
     // contention free shared mutex (same-lock-type is recursive for X->X, X->S or S->S locks), but (S->X - is UB)
     template<unsigned contention_free_count = 70, bool shared_flag = false>
     class contention_free_shared_mutex {
@@ -352,8 +908,12 @@ namespace sf {
             thread_local static std::unordered_map<void *, unregister_t> thread_local_index_hashmap;
             // get thread index - in any cases
             auto it = thread_local_index_hashmap.find(this);
-            if (it != thread_local_index_hashmap.cend())
-                set_index = it->second.thread_index;
+            if (it != thread_local_index_hashmap.cend()) {
+                if (it->second.array_slock_ptr == shared_locks_array_ptr)
+                    set_index = it->second.thread_index;
+                else
+                    thread_local_index_hashmap.erase(it);   // deleted contfree-mutex had the same address
+            }
 
             if (index_op == unregister_thread_op) {  // unregister thread
                 if (shared_locks_array[set_index].value == 1) // if isn't shared_lock now
@@ -424,7 +984,7 @@ namespace sf {
                         shared_locks_array[register_index].value.store(recursion_depth + 1, std::memory_order_seq_cst); // if first -> sequential
                         while (want_x_lock.load(std::memory_order_seq_cst)) {
                             shared_locks_array[register_index].value.store(recursion_depth, std::memory_order_seq_cst);
-                            for (volatile size_t i = 0; want_x_lock.load(std::memory_order_seq_cst); ++i) 
+                            for (size_t i = 0; want_x_lock.load(std::memory_order_seq_cst); ++i) 
 								if (i % 100000 == 0) std::this_thread::yield();
                             shared_locks_array[register_index].value.store(recursion_depth + 1, std::memory_order_seq_cst);
                         }
@@ -480,6 +1040,21 @@ namespace sf {
 				++recursive_xlock_count;
             }
 
+            bool try_lock() {
+                if (owner_thread_id.load(std::memory_order_acquire) != get_fast_this_thread_id()) {
+                    bool flag = false;
+                    if (!want_x_lock.compare_exchange_strong(flag, true, std::memory_order_seq_cst)) return false;
+                    for (auto &i : shared_locks_array)
+                        if (i.value.load(std::memory_order_seq_cst) > 1) {   // readers inside
+                            want_x_lock.store(false, std::memory_order_release);
+                            return false;
+                        }
+                    owner_thread_id.store(get_fast_this_thread_id(), std::memory_order_release);
+                }
+                ++recursive_xlock_count;
+                return true;
+            }
+
             void unlock() {
                 assert(recursive_xlock_count > 0);
 				if (--recursive_xlock_count == 0) {
@@ -491,9 +1066,10 @@ namespace sf {
 
     template<typename mutex_t>
     struct shared_lock_guard {
-        mutex_t &ref_mtx;
-        shared_lock_guard(mutex_t &mtx) : ref_mtx(mtx) { ref_mtx.lock_shared(); }
-        ~shared_lock_guard() { ref_mtx.unlock_shared(); }
+        mutex_t *ptr_mtx;
+        shared_lock_guard(mutex_t &mtx) : ptr_mtx(&mtx) { ptr_mtx->lock_shared(); }
+        shared_lock_guard(shared_lock_guard &&other) : ptr_mtx(other.ptr_mtx) { other.ptr_mtx = nullptr; }
+        ~shared_lock_guard() { if (ptr_mtx) ptr_mtx->unlock_shared(); }
     };
 
     using default_contention_free_shared_mutex = contention_free_shared_mutex<>;
@@ -502,69 +1078,4390 @@ namespace sf {
         std::unique_lock<contention_free_shared_mutex<>>, shared_lock_guard<contention_free_shared_mutex<>> >;
     // ---------------------------------------------------------------
 
-    // safe partitioned map
-    template<typename key_t, typename val_t, template<class> class safe_ptr_t = default_safe_ptr,
-        typename container_t = std::map<key_t, val_t>, typename part_t = std::map<key_t, safe_ptr_t<container_t>> >
-    class safe_map_partitioned_t
-    {
-        using safe_container_t = safe_ptr_t<container_t>;
-        typedef typename part_t::iterator part_iterator;
-        typedef typename part_t::const_iterator const_part_iterator;
-        std::shared_ptr<part_t> partition;
+    // adaptive shared mutex: samples its own read/write ratio, contention and wait time, and switches in place between
+    // exclusive spin mode (1 atomic flag), compact reader-writer mode (1 atomic counter) and contention-free mode.
+    // Mode switch: the outermost X-lock owner locks the new mode, publishes it and unlocks the old mode;
+    // each locker validates the mode after the lock and retries if the mode was switched meanwhile.
+    // Recursive for X->X, X->S, and for S->S in all modes except reader-writer (where S->S is allowed only without writers)
+    template<unsigned contention_free_count = 36, unsigned sample_rate = 64, unsigned window_size = 256>
+    class adaptive_rw_lock {
+    public:
+        enum mode_t { spin_mode, rw_mode, contfree_mode };
+        struct stats_t { unsigned reads, writes, contended; uint64_t wait_ticks; };
+
+    private:
+        enum { write_heavy_percent = 30, read_mostly_percent = 5, contended_percent = 5, short_wait_ticks = 2000 };
+
+        std::atomic<int> mode;
+        std::atomic<std::thread::id> owner_thread_id;
+        int recursive_xlock_count;                  // changed only by owner
+        char avoid_falsesharing_1[64];
+
+        std::atomic<bool> spin_flag;                // spin_mode: X- and S-locks are the same exclusive lock
+        char avoid_falsesharing_2[64];
+        std::atomic<int> rw_state;                  // rw_mode: -1 - X-locked, 0 - free, 1... - number of readers
+        char avoid_falsesharing_3[64];
+        contention_free_shared_mutex<contention_free_count> contfree_mtx;   // contfree_mode
+
+        std::atomic<unsigned> sampled_reads, sampled_writes, sampled_contended;  // current window
+        std::atomic<uint64_t> sampled_wait_ticks;
+        std::atomic<unsigned> switches;
+
+        static unsigned& sample_counter() { thread_local static unsigned counter = 0; return counter; }
+        static bool sample_now() { return ++sample_counter() % sample_rate == 0; }
+
+        bool window_full() const {
+            return sampled_reads.load(std::memory_order_relaxed) + sampled_writes.load(std::memory_order_relaxed) >= window_size;
+        }
+
+        void add_sample(bool const write, bool const contended, uint64_t const start) {
+            (write ? sampled_writes : sampled_reads).fetch_add(1, std::memory_order_relaxed);
+            if (contended) {
+                sampled_contended.fetch_add(1, std::memory_order_relaxed);
+                sampled_wait_ticks.fetch_add(adaptive_details::ticks() - start, std::memory_order_relaxed);
+            }
+        }
+
+        // returns true if acquired at the first attempt
+        bool lock_mode(int const m) {
+            if (m == contfree_mode) {
+                if (contfree_mtx.try_lock()) return true;
+                contfree_mtx.lock();
+                return false;
+            }
+            if (try_lock_mode(m)) return true;
+            for (size_t i = 1; !try_lock_mode(m); ++i)
+                if (i % 1000 == 0) std::this_thread::yield(); else adaptive_details::cpu_relax();
+            return false;
+        }
+
+        bool try_lock_mode(int const m) {
+            if (m == spin_mode)
+                return !spin_flag.load(std::memory_order_relaxed) && !spin_flag.exchange(true, std::memory_order_acquire);
+            if (m == rw_mode) {
+                int free_state = 0;
+                return rw_state.load(std::memory_order_relaxed) == 0 &&
+                    rw_state.compare_exchange_strong(free_state, -1, std::memory_order_acquire);
+            }
+            return contfree_mtx.try_lock();
+        }
+
+        void unlock_mode(int const m) {
+            if (m == spin_mode) spin_flag.store(false, std::memory_order_release);
+            else if (m == rw_mode) rw_state.store(0, std::memory_order_release);
+            else contfree_mtx.unlock();
+        }
+
+        // only for rw_mode and contfree_mode, returns true if acquired at the first attempt
+        bool lock_shared_mode(int const m) {
+            if (m == contfree_mode) {
+                contfree_mtx.lock_shared();
+                return true;
+            }
+            bool first = true;
+            for (size_t i = 1;; ++i, first = false) {
+                int cur_state = rw_state.load(std::memory_order_relaxed);
+                if (cur_state >= 0 && rw_state.compare_exchange_weak(cur_state, cur_state + 1, std::memory_order_acquire)) return first;
+                if (i % 1000 == 0) std::this_thread::yield(); else adaptive_details::cpu_relax();
+            }
+        }
+
+        void unlock_shared_mode(int const m) {
+            if (m == contfree_mode) contfree_mtx.unlock_shared();
+            else rw_state.fetch_sub(1, std::memory_order_release);
+        }
+
+        int choose_mode(int const cur_mode) {
+            unsigned const reads = sampled_reads.exchange(0, std::memory_order_relaxed);
+            unsigned const writes = sampled_writes.exchange(0, std::memory_order_relaxed);
+            unsigned const contended = sampled_contended.exchange(0, std::memory_order_relaxed);
+            uint64_t const wait_ticks = sampled_wait_ticks.exchange(0, std::memory_order_relaxed);
+            unsigned const total = reads + writes;
+            if (total == 0) return cur_mode;
+
+            if (writes * 100 > total * write_heavy_percent) return spin_mode;  // readers would hardly run in parallel
+            // spin mode stays while it isn't contended or waits are short - 1 atomic per lock is the cheapest
+            if (cur_mode == spin_mode &&
+                (contended * 100 <= total * contended_percent || wait_ticks <= (uint64_t)total * short_wait_ticks))
+                return spin_mode;
+            return (writes * 100 <= total * read_mostly_percent) ? contfree_mode : rw_mode;
+        }
+
+        // called by the outermost X-lock owner
+        void retune() {
+            int const cur_mode = mode.load(std::memory_order_relaxed);
+            int const new_mode = choose_mode(cur_mode);
+            if (new_mode == cur_mode) return;
+            lock_mode(new_mode);        // can wait only for lockers which haven't validated the mode yet
+            mode.store(new_mode, std::memory_order_release);
+            unlock_mode(cur_mode);
+            switches.fetch_add(1, std::memory_order_relaxed);
+        }
 
     public:
-        typedef std::vector<std::pair<key_t, val_t>> result_vector_t;
+        adaptive_rw_lock() : mode(spin_mode), owner_thread_id(std::thread::id()), recursive_xlock_count(0), spin_flag(false), rw_state(0),
+            sampled_reads(0), sampled_writes(0), sampled_contended(0), sampled_wait_ticks(0), switches(0) {}
+        adaptive_rw_lock(adaptive_rw_lock const&) = delete;
+        adaptive_rw_lock& operator=(adaptive_rw_lock const&) = delete;
 
-        safe_map_partitioned_t() : partition(std::make_shared<part_t>()) { partition->emplace(key_t(), container_t()); }
+        void lock() {
+            auto const this_thread_id = std::this_thread::get_id();
+            if (owner_thread_id.load(std::memory_order_acquire) != this_thread_id) {
+                bool const sample = sample_now();
+                uint64_t const start = sample ? adaptive_details::ticks() : 0;
+                bool contended = false;
+                for (int m = mode.load(std::memory_order_acquire);;) {
+                    contended |= !lock_mode(m);
+                    int const cur_mode = mode.load(std::memory_order_acquire);
+                    if (cur_mode == m) break;
+                    unlock_mode(m);     // mode was switched before we locked it
+                    m = cur_mode;
+                }
+                owner_thread_id.store(this_thread_id, std::memory_order_release);
+                if (sample) add_sample(true, contended, start);
+            }
+            ++recursive_xlock_count;
+        }
 
-        safe_map_partitioned_t(const key_t start, const key_t end, const key_t step) : partition(std::make_shared<part_t>()) {
-            for (key_t i = start; i <= end; i += step) partition->emplace(i, container_t());
+        bool try_lock() {
+            auto const this_thread_id = std::this_thread::get_id();
+            if (owner_thread_id.load(std::memory_order_acquire) != this_thread_id) {
+                int const m = mode.load(std::memory_order_acquire);
+                if (!try_lock_mode(m)) return false;
+                if (mode.load(std::memory_order_acquire) != m) {
+                    unlock_mode(m);
+                    return false;
+                }
+                owner_thread_id.store(this_thread_id, std::memory_order_release);
+            }
+            ++recursive_xlock_count;
+            return true;
         }
 
-        safe_map_partitioned_t(std::initializer_list<key_t> const& il) : partition(std::make_shared<part_t>()) {
-            for (auto &i : il) partition->emplace(i, container_t());
+        void unlock() {
+            assert(recursive_xlock_count > 0);
+            if (recursive_xlock_count == 1 && window_full()) retune();
+            if (--recursive_xlock_count == 0) {
+                owner_thread_id.store(std::thread::id(), std::memory_order_release);
+                unlock_mode(mode.load(std::memory_order_relaxed));
+            }
         }
 
-        part_iterator part_it(key_t const& k) { auto it = partition->lower_bound(k); if (it == partition->cend()) --it; return it; }
-        const_part_iterator part_it(key_t const& k) const { auto it = partition->lower_bound(k); if (it == partition->cend()) --it; return it; }
-        safe_container_t& part(key_t const& k) { return part_it(k)->second; }
-        const safe_container_t& part(key_t const& k) const { return part_it(k)->second; }
-        slocked_safe_ptr<safe_container_t> read_only_part(key_t const& k) const { return slock_safe_ptr(part(k)); }
+        void lock_shared() {
+            if (owner_thread_id.load(std::memory_order_acquire) == std::this_thread::get_id()) {
+                ++recursive_xlock_count;    // X->S or S->S in spin mode
+                return;
+            }
+            bool const sample = sample_now();
+            uint64_t const start = sample ? adaptive_details::ticks() : 0;
+            bool contended = false;
+            for (int m = mode.load(std::memory_order_acquire);;) {
+                if (m == spin_mode) {       // S-lock is exclusive
+                    contended |= !lock_mode(m);
+                    if (mode.load(std::memory_order_acquire) == spin_mode) {
+                        owner_thread_id.store(std::this_thread::get_id(), std::memory_order_release);
+                        ++recursive_xlock_count;
+                        break;
+                    }
+                    unlock_mode(m);
+                }
+                else {
+                    contended |= !lock_shared_mode(m);
+                    if (mode.load(std::memory_order_acquire) == m) break;
+                    unlock_shared_mode(m);
+                }
+                m = mode.load(std::memory_order_acquire);
+            }
+            if (sample) add_sample(false, contended, start);
+        }
 
-        void get_range_equal(const key_t& key, result_vector_t &result_vec) const {
-            result_vec.clear();
-            auto slock_container = slock_safe_ptr(part(key));
-            for (auto it = slock_container->lower_bound(key); it != slock_container->upper_bound(key); ++it)
-                result_vec.emplace_back(*it);
+        void unlock_shared() {
+            if (owner_thread_id.load(std::memory_order_acquire) == std::this_thread::get_id()) {
+                unlock();
+                return;
+            }
+            unlock_shared_mode(mode.load(std::memory_order_acquire));   // mode can't be switched while S-lock is held
+            // read-only workload: readers also retune, if the lock is free
+            if (sample_counter() % sample_rate == 0 && window_full() && try_lock()) unlock();
         }
 
-        void get_range_lower_upper(const key_t& low, const key_t& up, result_vector_t &result_vec) const {
-            result_vec.clear();
-            auto const& const_part = *partition;
-            auto end_it = (const_part.upper_bound(up) == const_part.cend()) ? const_part.cend() : std::next(const_part.upper_bound(up), 1);
-            auto it = const_part.lower_bound(low);
-            if (it == const_part.cend()) --it;
-            for (; it != end_it; ++it)
-                result_vec.insert(result_vec.end(), it->second->lower_bound(low), it->second->upper_bound(up));
+        mode_t get_mode() const { return (mode_t)mode.load(std::memory_order_acquire); }
+        unsigned switches_count() const { return switches.load(std::memory_order_relaxed); }
+        stats_t get_stats() const {
+            return stats_t{ sampled_reads.load(std::memory_order_relaxed), sampled_writes.load(std::memory_order_relaxed),
+                sampled_contended.load(std::memory_order_relaxed), sampled_wait_ticks.load(std::memory_order_relaxed) };
         }
+    };
 
-        void erase_lower_upper(const key_t& low, const key_t& up) {
-            auto end_it = (partition->upper_bound(up) == partition->end()) ? partition->end() : std::next(partition->upper_bound(up), 1);
-            for (auto it = part_it(low); it != end_it; ++it)
-                it->second->erase(it->second->lower_bound(low), it->second->upper_bound(up));
+    template<typename T> using adaptive_rw_safe_ptr = safe_ptr<T, adaptive_rw_lock<>,
+        std::unique_lock<adaptive_rw_lock<>>, shared_lock_guard<adaptive_rw_lock<>> >;
+    // ---------------------------------------------------------------
+
+    // asynchronous locks: waiters (coroutines, callbacks, blocked threads) are queued in async_shared_mutex
+    // and unlock() resumes them - in the unlocking thread or by the executor of the waiter
+
+    struct async_waiter_t {
+        async_waiter_t *next;
+        async_executor_t *executor;     // nullptr - resumed in the unlocking thread
+        bool is_shared;
+        void(*resume_func)(async_waiter_t *);
+
+        async_waiter_t(bool const shared, async_executor_t *const exec, void(*func)(async_waiter_t *)) :
+            next(nullptr), executor(exec), is_shared(shared), resume_func(func) {}
+        void resume() { resume_func(this); }
+    };
+
+    // runs resumed waiters, e.g. in a thread pool: post() must call waiter->resume() later (waiter->next can be used for the queue)
+    struct async_executor_t {
+        virtual void post(async_waiter_t *waiter) = 0;
+        virtual ~async_executor_t() {}
+    };
+
+    // FIFO shared mutex (non-recursive): lock_async() queues a waiter instead of blocking, lock()/lock_shared() block the thread
+    class async_shared_mutex {
+        spinlock_t queue_mtx;           // protects state and queue - very short critical sections
+        int state;                      // -1 - X-locked, 0 - free, 1... - number of readers
+        async_waiter_t *head, *tail;
+
+        bool can_lock(bool const shared) const { return shared ? state >= 0 : state == 0; }
+
+        // under queue_mtx: waiters which get the lock now - X-waiter or all S-waiters until the first X-waiter
+        async_waiter_t * grant() {
+            async_waiter_t *granted = nullptr, **granted_tail = &granted;
+            while (head && can_lock(head->is_shared)) {
+                state = head->is_shared ? state + 1 : -1;
+                *granted_tail = head;
+                granted_tail = &head->next;
+                head = head->next;
+            }
+            *granted_tail = nullptr;
+            if (!head) tail = nullptr;
+            return granted;
         }
 
-        template<typename T, typename... Args> void emplace(T const& key, Args const&&...args) {
-            part(key)->emplace(key, args...);
+        // waiters resumed in this thread can unlock and resume others - a loop instead of recursion keeps the stack flat
+        static void resume_all(async_waiter_t *granted) {
+            thread_local static async_waiter_t *pending = nullptr;
+            thread_local static bool resuming = false;
+            while (granted) {
+                async_waiter_t *const waiter = granted;
+                granted = granted->next;
+                if (waiter->executor) waiter->executor->post(waiter);
+                else { waiter->next = pending; pending = waiter; }
+            }
+            if (resuming) return;
+            resuming = true;
+            while (pending) {
+                async_waiter_t *const waiter = pending;
+                pending = waiter->next;
+                waiter->resume();
+            }
+            resuming = false;
         }
 
-        size_t size() const {
-            size_t size = 0;
-            for (auto it = partition->begin(); it != partition->end(); ++it) size += it->second->size();
-            return size;
+        struct blocking_waiter_t : async_waiter_t {
+            std::atomic<uint32_t> ready;    // 0 - waits, 1 - is being woken, 2 - woken (waker doesn't touch it anymore)
+            explicit blocking_waiter_t(bool const shared) : async_waiter_t(shared, nullptr, &wake), ready(0) {}
+            static void wake(async_waiter_t *waiter) {
+                auto &ready = static_cast<blocking_waiter_t *>(waiter)->ready;
+                ready.store(1, std::memory_order_release);
+                adaptive_details::unpark_one(ready);
+                ready.store(2, std::memory_order_release);
+            }
+            void wait() {
+                for (size_t i = 0; i < 1000 && ready.load(std::memory_order_acquire) == 0; ++i) adaptive_details::cpu_relax();
+                while (ready.load(std::memory_order_acquire) == 0) adaptive_details::park(ready, 0);
+                while (ready.load(std::memory_order_acquire) != 2) adaptive_details::cpu_relax();
+            }
+        };
+
+        void lock_blocking(bool const shared) {
+            blocking_waiter_t waiter(shared);
+            if (!lock_async(&waiter)) waiter.wait();
+        }
+
+    public:
+        async_shared_mutex() : state(0), head(nullptr), tail(nullptr) {}
+        async_shared_mutex(async_shared_mutex const&) = delete;
+        async_shared_mutex& operator=(async_shared_mutex const&) = delete;
+
+        // true - locked at once, false - queued: waiter->resume() will be called when the lock is acquired
+        bool lock_async(async_waiter_t *waiter) {
+            std::lock_guard<spinlock_t> lock(queue_mtx);
+            if (head == nullptr && can_lock(waiter->is_shared)) {
+                state = waiter->is_shared ? state + 1 : -1;
+                return true;
+            }
+            waiter->next = nullptr;
+            if (tail) tail->next = waiter; else head = waiter;
+            tail = waiter;
+            return false;
+        }
+
+        bool try_lock() {
+            std::lock_guard<spinlock_t> lock(queue_mtx);
+            if (head != nullptr || state != 0) return false;
+            state = -1;
+            return true;
+        }
+
+        bool try_lock_shared() {
+            std::lock_guard<spinlock_t> lock(queue_mtx);
+            if (head != nullptr || state < 0) return false;
+            ++state;
+            return true;
+        }
+
+        void lock() { if (!try_lock()) lock_blocking(false); }
+        void lock_shared() { if (!try_lock_shared()) lock_blocking(true); }
+
+        void unlock() {
+            async_waiter_t *granted;
+            {
+                std::lock_guard<spinlock_t> lock(queue_mtx);
+                assert(state == -1);
+                state = 0;
+                granted = grant();
+            }
+            resume_all(granted);
+        }
+
+        void unlock_shared() {
+            async_waiter_t *granted = nullptr;
+            {
+                std::lock_guard<spinlock_t> lock(queue_mtx);
+                assert(state > 0);
+                if (--state == 0) granted = grant();
+            }
+            resume_all(granted);
+        }
+    };
+
+    template<typename T> using async_safe_ptr = safe_ptr<T, async_shared_mutex,
+        std::unique_lock<async_shared_mutex>, shared_lock_guard<async_shared_mutex> >;
+
+    namespace async_details {
+        template<typename mutex_t> struct is_async : std::is_same<typename std::remove_cv<mutex_t>::type, async_shared_mutex> {};
+
+        // blocking fallback for other mutexes: S-lock if the mutex has it, else X-lock
+        template<typename mutex_t> auto lock_shared(mutex_t &mtx, int) -> decltype(mtx.lock_shared()) { mtx.lock_shared(); }
+        template<typename mutex_t> void lock_shared(mutex_t &mtx, long) { mtx.lock(); }
+        template<typename mutex_t> auto unlock_shared(mutex_t &mtx, int) -> decltype(mtx.unlock_shared()) { mtx.unlock_shared(); }
+        template<typename mutex_t> void unlock_shared(mutex_t &mtx, long) { mtx.unlock(); }
+
+        template<bool shared, typename mutex_t> void lock(mutex_t &mtx) { if (shared) lock_shared(mtx, 0); else mtx.lock(); }
+        template<bool shared, typename mutex_t> void unlock(mutex_t &mtx) { if (shared) unlock_shared(mtx, 0); else mtx.unlock(); }
+
+        inline bool lock_async(async_shared_mutex &mtx, async_waiter_t *waiter) { return mtx.lock_async(waiter); }
+        template<typename mutex_t> bool lock_async(mutex_t &mtx, async_waiter_t *waiter) {  // other mutexes - blocking
+            lock<false>(mtx); (void)waiter; return true;
+        }
+    }
+
+    // owns the acquired X- or S-lock: auto x_obj = co_await sp.xlock(); x_obj->money++;
+    template<typename T, typename mutex_t, bool shared>
+    class async_locked_ptr {
+        typedef typename std::conditional<shared, const T, T>::type obj_t;
+        obj_t *ptr;
+        mutex_t *mtx;
+    public:
+        async_locked_ptr(obj_t *obj_ptr, mutex_t *mtx_ptr) : ptr(obj_ptr), mtx(mtx_ptr) {}
+        async_locked_ptr(async_locked_ptr &&other) : ptr(other.ptr), mtx(other.mtx) { other.mtx = nullptr; }
+        async_locked_ptr(async_locked_ptr const&) = delete;
+        ~async_locked_ptr() { unlock(); }
+        void unlock() { if (mtx) async_details::unlock<shared>(*mtx); mtx = nullptr; }
+        obj_t * operator -> () const { return ptr; }
+        obj_t & operator * () const { return *ptr; }
+    };
+
+    // awaitable X- or S-lock: suspends the coroutine until the lock is acquired
+    template<typename T, typename mutex_t, bool shared>
+    class async_lock_t : public async_waiter_t {
+        T *ptr;
+        mutex_t &mtx;
+#ifdef COROUTINE_MTX
+        std::coroutine_handle<> handle;
+        static void resume_handle(async_waiter_t *waiter) { static_cast<async_lock_t *>(waiter)->handle.resume(); }
+#endif
+    public:
+        async_lock_t(T *obj_ptr, mutex_t &mtx_ref, async_executor_t *executor) : async_waiter_t(shared, executor, nullptr), ptr(obj_ptr), mtx(mtx_ref) {}
+
+#ifdef COROUTINE_MTX
+        bool await_ready() {
+            if (async_details::is_async<mutex_t>::value) return false;
+            async_details::lock<shared>(mtx);   // other mutexes - blocking
+            return true;
+        }
+        bool await_suspend(std::coroutine_handle<> coro_handle) {
+            handle = coro_handle;
+            resume_func = &resume_handle;
+            return !async_details::lock_async(mtx, this);    // can be resumed by other thread before return - don't touch *this
+        }
+        async_locked_ptr<T, mutex_t, shared> await_resume() { return async_locked_ptr<T, mutex_t, shared>(ptr, &mtx); }
+#endif
+    };
+
+    // callback(obj) is called under the lock: at once, or later by unlock() of other thread or by executor (callback mustn't throw)
+    template<typename T, typename mutex_t, bool shared, typename callback_t>
+    struct async_callback_waiter_t : async_waiter_t {
+        T *ptr;
+        mutex_t &mtx;
+        callback_t callback;
+        async_callback_waiter_t(T *obj_ptr, mutex_t &mtx_ref, callback_t &&func, async_executor_t *executor) :
+            async_waiter_t(shared, executor, &run), ptr(obj_ptr), mtx(mtx_ref), callback(std::move(func)) {}
+        static void run(async_waiter_t *waiter) {
+            std::unique_ptr<async_callback_waiter_t> self(static_cast<async_callback_waiter_t *>(waiter));
+            async_locked_ptr<T, mutex_t, shared> locked_obj(self->ptr, &self->mtx);
+            self->callback(*locked_obj);
+        }
+    };
+
+    template<bool shared, typename T, typename mutex_t, typename callback_t>
+    void lock_with_callback(T *obj, mutex_t &mtx, callback_t &&callback, async_executor_t *executor) {
+        typedef async_callback_waiter_t<T, mutex_t, shared, typename std::decay<callback_t>::type> waiter_t;
+        if (!async_details::is_async<mutex_t>::value) {
+            async_details::lock<shared>(mtx);
+            async_locked_ptr<T, mutex_t, shared> locked_obj(obj, &mtx);
+            callback(*locked_obj);
+            return;
+        }
+        typename std::decay<callback_t>::type func(std::forward<callback_t>(callback));
+        waiter_t *const waiter = new waiter_t(obj, mtx, std::move(func), executor);
+        if (async_details::lock_async(mtx, waiter)) waiter_t::run(waiter);
+    }
+    // ---------------------------------------------------------------
+
+    // mutex of dynamic lock group: redirects to own base mutex or to the base mutex of another object (group leader),
+    // target can be changed at runtime by link_safe_ptrs::relink() / unlink() - threads waiting on the old target
+    // re-check the target after acquiring it, release it and go to the new one (safe handover).
+    // base_mutex_t should be recursive (several objects of one group are locked by one thread)
+    template<typename base_mutex_t = std::recursive_mutex>
+    class lock_group_mutex {
+        base_mutex_t own_mtx;
+        char avoid_falsesharing_1[64];
+        std::atomic<base_mutex_t *> target;
+        std::atomic<int> waiters;                   // threads which can use old target
+        std::atomic<size_t> lock_count, contended_count;
+        std::atomic<std::thread::id> owner_thread_id;   // X-lock owner: its target mustn't be changed by relink() / unlink()
+        int recursive_xlock_count;                      // changed only by owner
+        std::shared_ptr<lock_group_mutex> target_owner;         // keeps group leader alive
+        std::vector<std::shared_ptr<lock_group_mutex>> retired; // old leaders which can be used by waiters
+        char avoid_falsesharing_2[64];
+
+        // changed only when old and new targets are locked by this thread
+        void retarget(base_mutex_t *new_target, std::shared_ptr<lock_group_mutex> const& new_owner) {
+            target.store(new_target, std::memory_order_seq_cst);
+            std::shared_ptr<lock_group_mutex> old_owner = std::move(target_owner);
+            target_owner = new_owner;
+            if (waiters.load(std::memory_order_seq_cst) == 0) retired.clear();
+            else if (old_owner) retired.push_back(std::move(old_owner));
+        }
+
+        template<typename lock_fn_t, typename unlock_fn_t>
+        base_mutex_t * lock_target(lock_fn_t lock_fn, unlock_fn_t unlock_fn) {
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            base_mutex_t *cur_target;
+            for (;;) {
+                cur_target = target.load(std::memory_order_seq_cst);
+                lock_fn(*cur_target);
+                if (target.load(std::memory_order_acquire) == cur_target) break;
+                unlock_fn(*cur_target);    // target was changed while waiting - go to the new one
+            }
+            waiters.fetch_sub(1, std::memory_order_release);
+            return cur_target;
+        }
+
+        base_mutex_t * try_lock_target() {
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            base_mutex_t *cur_target = target.load(std::memory_order_seq_cst);
+            if (!cur_target->try_lock()) cur_target = nullptr;
+            else if (target.load(std::memory_order_acquire) != cur_target) { cur_target->unlock(); cur_target = nullptr; }
+            waiters.fetch_sub(1, std::memory_order_release);
+            return cur_target;
+        }
+
+        void set_owner() {
+            if (recursive_xlock_count++ == 0) owner_thread_id.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        }
+
+        // relink() / unlink() by the X-lock owner would change the target under its lock: outer unlock() would release
+        // the mutex which isn't locked by this thread and the old target would stay locked
+        void check_not_owner() const {
+            if (owner_thread_id.load(std::memory_order_relaxed) == std::this_thread::get_id())
+                throw std::logic_error("lock_group_mutex: relink() or unlink() of the object locked by this thread");
+        }
+
+    public:
+        lock_group_mutex() : target(&own_mtx), waiters(0), lock_count(0), contended_count(0), owner_thread_id(std::thread::id()),
+            recursive_xlock_count(0) {}
+
+        void lock() {
+            lock_target([this](base_mutex_t &mtx) { if (!mtx.try_lock()) { contended_count.fetch_add(1, std::memory_order_relaxed); mtx.lock(); } },
+                [](base_mutex_t &mtx) { mtx.unlock(); });
+            set_owner();
+            lock_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        void unlock() {     // target can't be changed while locked: relink() / unlink() refuse the owner, other threads wait
+            if (--recursive_xlock_count == 0) owner_thread_id.store(std::thread::id(), std::memory_order_relaxed);
+            target.load(std::memory_order_relaxed)->unlock();
+        }
+
+        bool try_lock() {
+            bool const success = try_lock_target() != nullptr;
+            if (success) set_owner();
+            return success;
+        }
+
+        void lock_shared() {
+            lock_target([](base_mutex_t &mtx) { mtx.lock_shared(); }, [](base_mutex_t &mtx) { mtx.unlock_shared(); });
+            lock_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        void unlock_shared() { target.load(std::memory_order_relaxed)->unlock_shared(); }
+
+        bool is_linked() const { return target.load(std::memory_order_acquire) != &own_mtx; }
+
+        // adds lock statistics since the last call
+        void get_and_reset_stats(size_t &locks, size_t &contended) {
+            locks += lock_count.exchange(0, std::memory_order_relaxed);
+            contended += contended_count.exchange(0, std::memory_order_relaxed);
+        }
+
+        // link x to the current mutex of leader
+        static void relink(lock_group_mutex &x, std::shared_ptr<lock_group_mutex> const& leader_ptr) {
+            lock_group_mutex &leader = *leader_ptr;
+            if (&x == &leader) return;
+            x.check_not_owner();
+            for (;;) {
+                base_mutex_t *const leader_target = leader.lock_target([](base_mutex_t &mtx) { mtx.lock(); }, [](base_mutex_t &mtx) { mtx.unlock(); });
+                if (x.target.load(std::memory_order_acquire) == leader_target) { leader_target->unlock(); return; }  // already in group
+                if (base_mutex_t *const x_target = x.try_lock_target()) {
+                    x.retarget(leader_target, leader.target_owner ? leader.target_owner : leader_ptr);
+                    x_target->unlock();
+                    leader_target->unlock();
+                    return;
+                }
+                leader_target->unlock();
+                std::this_thread::yield();  // avoid deadlock with other relinking threads
+            }
+        }
+
+        // return x to its own mutex
+        static void unlink(lock_group_mutex &x) {
+            x.check_not_owner();
+            for (;;) {
+                base_mutex_t *const x_target = x.lock_target([](base_mutex_t &mtx) { mtx.lock(); }, [](base_mutex_t &mtx) { mtx.unlock(); });
+                if (x_target == &x.own_mtx) { x_target->unlock(); return; }  // isn't linked
+                if (x.own_mtx.try_lock()) {
+                    x.retarget(&x.own_mtx, nullptr);
+                    x_target->unlock();
+                    x.own_mtx.unlock();
+                    return;
+                }
+                x_target->unlock();
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    template<typename T> using lock_group_safe_ptr = safe_ptr<T, lock_group_mutex<>,
+        std::unique_lock<lock_group_mutex<>>, std::unique_lock<lock_group_mutex<>> >;
+
+    template<typename T> using contfree_lock_group_safe_ptr = safe_ptr<T, lock_group_mutex<contention_free_shared_mutex<>>,
+        std::unique_lock<lock_group_mutex<contention_free_shared_mutex<>>>, shared_lock_guard<lock_group_mutex<contention_free_shared_mutex<>>> >;
+    // ---------------------------------------------------------------
+
+    namespace node_pool_details {
+        enum { cache_line_size = 64, slab_size = 64 * 1024, huge_page_size = 2 * 1024 * 1024, remote_batch_size = 64 };
+
+        struct block_t { block_t *next; };
+
+        // blocks of one size owned by one thread: allocated and freed by the owner without atomics, blocks freed by other threads
+        // come back in batches to the lock-free stack remote_free. Heaps are never destroyed: the heap of the finished thread
+        // is given to a new thread, its blocks stay valid in containers
+        struct heap_t {
+            block_t *free_list = nullptr;
+            char *bump = nullptr, *bump_end = nullptr;          // the rest of the last slab
+            char *region = nullptr, *region_end = nullptr;      // the rest of the huge page region, slabs are taken from it
+            std::atomic<block_t *> remote_free;
+            heap_t *next_abandoned = nullptr;
+            heap_t() : remote_free(nullptr) {}
+        };
+
+        // slab_size-aligned slab: the owner in the first cache line, blocks after it - the owner of a block is found by its address
+        struct slab_header_t { heap_t *owner; };
+        inline slab_header_t * slab_of(void *ptr) { return reinterpret_cast<slab_header_t *>(reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t)(slab_size - 1)); }
+
+        inline std::atomic<bool>& huge_pages() { static std::atomic<bool> flag(false); return flag; }
+
+        inline char * aligned_alloc(size_t const alignment, size_t const size) {
+#if defined(_MSC_VER)
+            void *const ptr = _aligned_malloc(size, alignment);
+#else
+            void *ptr = nullptr;
+            if (posix_memalign(&ptr, alignment, size) != 0) ptr = nullptr;
+#endif
+            if (!ptr) throw std::bad_alloc();
+            return static_cast<char *>(ptr);
+        }
+
+        // slabs are never returned to the OS - the pool keeps the peak number of nodes
+        inline char * new_slab(heap_t &heap) {
+            if (huge_pages().load(std::memory_order_relaxed)) {
+                if (heap.region == heap.region_end) {
+                    heap.region = aligned_alloc(huge_page_size, huge_page_size);
+                    heap.region_end = heap.region + huge_page_size;
+#ifdef MADV_HUGEPAGE
+                    madvise(heap.region, huge_page_size, MADV_HUGEPAGE);    // transparent huge pages: 1 TLB entry for 32 slabs
+#endif
+                }
+                char *const slab = heap.region;
+                heap.region += slab_size;
+                return slab;
+            }
+            return aligned_alloc(slab_size, slab_size);
+        }
+
+        template<size_t block_size>
+        class pool_t {
+            // trivially destructible - valid after the destruction of guard_t (deallocation by destructors of static containers)
+            struct thread_cache_t {
+                heap_t *heap;
+                bool finished;
+                heap_t *batch_owner;                // blocks of one other heap, freed by this thread
+                block_t *batch_head, *batch_tail;
+                size_t batch_count;
+
+                void flush() {
+                    if (batch_count == 0) return;
+                    push_remote(*batch_owner, batch_head, batch_tail);
+                    batch_owner = nullptr; batch_head = batch_tail = nullptr; batch_count = 0;
+                }
+            };
+            struct guard_t {
+                ~guard_t() {
+                    thread_cache_t &c = cache();
+                    c.flush();
+                    abandon(c.heap);
+                    c.heap = nullptr;
+                    c.finished = true;
+                }
+            };
+
+            static thread_cache_t& cache() { thread_local static thread_cache_t c = thread_cache_t(); return c; }
+            static std::mutex& abandoned_mtx() { static std::mutex mtx; return mtx; }
+            static heap_t *& abandoned() { static heap_t *head = nullptr; return head; }
+
+            static heap_t * take_heap() {
+                {
+                    std::lock_guard<std::mutex> lock(abandoned_mtx());
+                    heap_t *const heap = abandoned();
+                    if (heap) { abandoned() = heap->next_abandoned; return heap; }
+                }
+                return new heap_t();
+            }
+            static void abandon(heap_t *heap) {
+                std::lock_guard<std::mutex> lock(abandoned_mtx());
+                heap->next_abandoned = abandoned();
+                abandoned() = heap;
+            }
+            static heap_t& thread_heap() {
+                thread_cache_t &c = cache();
+                if (!c.heap) {
+                    c.heap = take_heap();
+                    if (!c.finished) { thread_local static guard_t guard; (void)guard; }
+                }
+                return *c.heap;
+            }
+
+            static void push_remote(heap_t &owner, block_t *head, block_t *tail) {
+                block_t *old_head = owner.remote_free.load(std::memory_order_relaxed);
+                do tail->next = old_head;
+                while (!owner.remote_free.compare_exchange_weak(old_head, head, std::memory_order_release, std::memory_order_relaxed));
+            }
+
+        public:
+            static void * allocate() {
+                heap_t &heap = thread_heap();
+                block_t *block = heap.free_list;
+                if (!block) block = heap.remote_free.exchange(nullptr, std::memory_order_acquire);   // all batches at once
+                if (block) {
+                    heap.free_list = block->next;
+                    return block;
+                }
+                if (heap.bump + block_size > heap.bump_end) {
+                    char *const slab = new_slab(heap);
+                    reinterpret_cast<slab_header_t *>(slab)->owner = &heap;
+                    heap.bump = slab + cache_line_size;
+                    heap.bump_end = slab + slab_size;
+                }
+                void *const ptr = heap.bump;
+                heap.bump += block_size;
+                return ptr;
+            }
+
+            static void deallocate(void *ptr) {
+                thread_cache_t &c = cache();
+                heap_t *const owner = slab_of(ptr)->owner;
+                block_t *const block = static_cast<block_t *>(ptr);
+                if (owner == c.heap) {
+                    block->next = c.heap->free_list;
+                    c.heap->free_list = block;
+                    return;
+                }
+                if (c.finished) { push_remote(*owner, block, block); return; }   // after the guard - without batch
+                if (!c.heap) thread_heap();     // the guard flushes the batch at thread exit
+                if (owner != c.batch_owner) c.flush();
+                block->next = c.batch_head;
+                c.batch_head = block;
+                if (!c.batch_tail) c.batch_tail = block;
+                c.batch_owner = owner;
+                if (++c.batch_count == remote_batch_size) c.flush();
+            }
+        };
+    }
+
+    // allocator for nodes of std::map, std::unordered_map, std::set ... - container_t of safe_ptr<> and safe_map_partitioned_t<>:
+    // std::map< key_t, val_t, std::less<key_t>, node_pool_allocator<std::pair<const key_t, val_t>> >
+    // Single nodes (up to 1 KB) are taken from the free list of the current thread without locks and atomics, nodes freed by
+    // other threads are returned to their owner in batches. Slabs of 64 KB are aligned, blocks are 16-byte aligned.
+    // Arrays (buckets of std::unordered_map) are allocated by operator new. node_pool_allocator<>::use_huge_pages(true) - new
+    // slabs are taken from 2 MB regions with transparent huge pages (Linux).
+    template<typename T>
+    class node_pool_allocator
+    {
+        enum { block_size = (sizeof(T) + 15) / 16 * 16 };
+        enum { pooled = (sizeof(T) <= 1024 && alignof(T) <= 16) };
+    public:
+        typedef T value_type;
+        template<typename U> struct rebind { typedef node_pool_allocator<U> other; };
+
+        node_pool_allocator() noexcept {}
+        template<typename U> node_pool_allocator(node_pool_allocator<U> const&) noexcept {}
+
+        T * allocate(size_t const n) {
+            if (n == 1 && pooled) return static_cast<T *>(node_pool_details::pool_t<block_size>::allocate());
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        void deallocate(T *ptr, size_t const n) noexcept {
+            if (n == 1 && pooled) node_pool_details::pool_t<block_size>::deallocate(ptr);
+            else ::operator delete(ptr);
+        }
+
+        static void use_huge_pages(bool const flag) { node_pool_details::huge_pages().store(flag); }
+
+        template<typename U> bool operator == (node_pool_allocator<U> const&) const noexcept { return true; }
+        template<typename U> bool operator != (node_pool_allocator<U> const&) const noexcept { return false; }
+    };
+    // ---------------------------------------------------------------
+
+    // B+tree map with wide nodes: sorted arrays of keys in nodes, elements only in leaves, leaves are linked in the order
+    // of keys. std::map-like API (find, emplace, erase, lower_bound, upper_bound, bidirectional iterators) - can be used as
+    // container_t of safe_map_partitioned_t<> or in contfree_safe_ptr<>. Search in a node: SIMD for int keys, count of
+    // smaller keys for other arithmetic keys, binary search for other keys.
+    // Unlike std::map: any insert or erase invalidates iterators, value_type of an element is stored in a leaf with a copy
+    // of its key, underfull leaves are merged with a neighbour, inner nodes are removed only when empty.
+    template<typename key_t, typename val_t, typename compare_t = std::less<key_t>, size_t node_size = 32>
+    class btree_map
+    {
+        static_assert(node_size >= 4 && node_size % 4 == 0, "node_size should be a multiple of 4");
+    public:
+        typedef key_t key_type;
+        typedef val_t mapped_type;
+        typedef std::pair<const key_t, val_t> value_type;
+        typedef compare_t key_compare;
+        typedef size_t size_type;
+        typedef std::ptrdiff_t difference_type;
+
+    private:
+        typedef std::pair<key_t, val_t> slot_t;     // value_type with non-const key - to move elements between nodes
+
+        // keys of arithmetic types are searched by count of smaller keys in the whole node - free keys are padded by max()
+        typedef std::integral_constant<bool, std::is_arithmetic<key_t>::value && std::is_same<compare_t, std::less<key_t>>::value> count_search_t;
+
+        struct node_t {
+            bool const is_leaf;
+            size_t count;               // keys in the node
+            key_t keys[node_size];
+            explicit node_t(bool const leaf) : is_leaf(leaf), count(0) { std::fill(keys, keys + node_size, pad_key(count_search_t())); }
+        };
+
+        struct leaf_t : node_t {
+            leaf_t *prev, *next;
+            typename std::aligned_storage<sizeof(slot_t), alignof(slot_t)>::type slots[node_size];
+            leaf_t() : node_t(true), prev(nullptr), next(nullptr) {}
+            ~leaf_t() { for (size_t i = 0; i < this->count; ++i) slot(i)->~slot_t(); }
+            slot_t * slot(size_t const i) { return reinterpret_cast<slot_t *>(&slots[i]); }
+        };
+
+        struct inner_t : node_t {
+            node_t *children[node_size + 1];    // keys of children[i] are in [keys[i-1], keys[i])
+            inner_t() : node_t(false) {}
+        };
+
+        struct path_t { inner_t *node; size_t pos; };
+        enum { max_depth = 64 };
+
+        node_t *root;
+        leaf_t *first_leaf, *last_leaf;
+        size_t elements_count;
+        compare_t comp;
+
+        static key_t pad_key(std::true_type) { return std::numeric_limits<key_t>::max(); }
+        static key_t pad_key(std::false_type) { return key_t(); }
+
+        // lower_bound (upper_bound if upper) in the sorted keys of the node
+        template<bool upper> size_t search(node_t const *node, key_t const& k) const { return search<upper>(node, k, count_search_t()); }
+
+        template<bool upper> size_t search(node_t const *node, key_t const& k, std::false_type) const {
+            key_t const *const end = node->keys + node->count;
+            return ((upper) ? std::upper_bound(node->keys, end, k, comp) : std::lower_bound(node->keys, end, k, comp)) - node->keys;
+        }
+
+        template<bool upper> size_t search(node_t const *node, key_t const& k, std::true_type) const {
+            return std::min(count_less<upper>(node->keys, k), node->count);
+        }
+
+        // count of keys < k (<= k if upper) - without branches, vectorized by compiler
+        template<bool upper, typename some_key_t> static size_t count_less(some_key_t const *keys, some_key_t const& k) {
+            size_t n = 0;
+            for (size_t i = 0; i < node_size; ++i) n += (upper) ? !(k < keys[i]) : (keys[i] < k);
+            return n;
+        }
+#ifdef SIMD_SSE2
+        template<bool upper> static size_t count_less(int32_t const *keys, int32_t const& k) {
+            __m128i const k4 = _mm_set1_epi32(k);
+            size_t n = 0;
+            for (size_t i = 0; i < node_size; i += 4) {
+                __m128i const keys4 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(keys + i));
+                __m128i const mask = (upper) ? _mm_cmpgt_epi32(keys4, k4) : _mm_cmplt_epi32(keys4, k4);
+                n += bits_count[_mm_movemask_ps(_mm_castsi128_ps(mask))];
+            }
+            return (upper) ? node_size - n : n;
+        }
+        static constexpr unsigned char bits_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+#endif
+
+        bool equal(key_t const& a, key_t const& b) const { return !comp(a, b) && !comp(b, a); }
+
+        leaf_t * descend(key_t const& k, path_t *path, size_t &depth) const {
+            node_t *node = root;
+            for (depth = 0; !node->is_leaf; ++depth) {
+                inner_t *const inner = static_cast<inner_t *>(node);
+                size_t const pos = search<true>(inner, k);
+                if (path) path[depth] = path_t{ inner, pos };
+                node = inner->children[pos];
+            }
+            return static_cast<leaf_t *>(node);
+        }
+        leaf_t * descend(key_t const& k) const { size_t depth; return descend(k, nullptr, depth); }
+
+        static void move_slot(leaf_t *dst, size_t const dst_pos, leaf_t *src, size_t const src_pos) {
+            new (dst->slot(dst_pos)) slot_t(std::move(*src->slot(src_pos)));
+            src->slot(src_pos)->~slot_t();
+            dst->keys[dst_pos] = std::move(src->keys[src_pos]);
+        }
+
+        // elements from 'half' go to the new right leaf, allocated by the caller
+        leaf_t * split_leaf(leaf_t *leaf, size_t const half, leaf_t *const right) {
+            for (size_t i = half; i < node_size; ++i) {
+                move_slot(right, i - half, leaf, i);
+                leaf->keys[i] = pad_key(count_search_t());
+            }
+            right->count = node_size - half;
+            leaf->count = half;
+            right->prev = leaf;
+            right->next = leaf->next;
+            if (leaf->next) leaf->next->prev = right; else last_leaf = right;
+            leaf->next = right;
+            return right;
+        }
+
+        // inserts separator and the right child after path[depth-1].pos, splits full inner nodes up to the root.
+        // New inner nodes are taken from spare - allocated by the caller, doesn't throw
+        void insert_separator(path_t *path, size_t depth, key_t separator, node_t *right, std::unique_ptr<inner_t> *spare) {
+            for (;;) {
+                if (depth == 0) {
+                    inner_t *const new_root = (spare++)->release();
+                    new_root->keys[0] = std::move(separator);
+                    new_root->children[0] = root;
+                    new_root->children[1] = right;
+                    new_root->count = 1;
+                    root = new_root;
+                    return;
+                }
+                inner_t *const inner = path[--depth].node;
+                size_t const pos = path[depth].pos;
+                if (inner->count < node_size) {
+                    for (size_t i = inner->count; i > pos; --i) {
+                        inner->keys[i] = std::move(inner->keys[i - 1]);
+                        inner->children[i + 1] = inner->children[i];
+                    }
+                    inner->keys[pos] = std::move(separator);
+                    inner->children[pos + 1] = right;
+                    ++inner->count;
+                    return;
+                }
+                // full: node_size + 1 keys - the middle one goes up
+                inner_t *const new_inner = (spare++)->release();
+                key_t keys[node_size + 1];
+                node_t *children[node_size + 2];
+                for (size_t i = 0, j = 0; i <= node_size; ++i) keys[i] = (i == pos) ? std::move(separator) : std::move(inner->keys[j++]);
+                for (size_t i = 0, j = 0; i <= node_size + 1; ++i) children[i] = (i == pos + 1) ? right : inner->children[j++];
+                size_t const mid = (node_size + 1) / 2;
+                std::fill(inner->keys, inner->keys + node_size, pad_key(count_search_t()));
+                for (size_t i = 0; i < mid; ++i) inner->keys[i] = std::move(keys[i]);
+                for (size_t i = 0; i <= mid; ++i) inner->children[i] = children[i];
+                inner->count = mid;
+                for (size_t i = mid + 1; i <= node_size; ++i) new_inner->keys[i - mid - 1] = std::move(keys[i]);
+                for (size_t i = mid + 1; i <= node_size + 1; ++i) new_inner->children[i - mid - 1] = children[i];
+                new_inner->count = node_size - mid;
+                separator = std::move(keys[mid]);
+                right = new_inner;
+            }
+        }
+
+        // removes children[pos] of path[depth-1].node, the empty inner node is removed from its parent too
+        void remove_child(path_t *path, size_t depth, size_t const pos) {
+            inner_t *const inner = path[depth - 1].node;
+            if (inner->count == 0) {    // the only child
+                if (depth == 1) { root = new leaf_t(); first_leaf = last_leaf = static_cast<leaf_t *>(root); }
+                else remove_child(path, depth - 1, path[depth - 2].pos);
+                delete inner;
+                return;
+            }
+            size_t const key_pos = (pos == 0) ? 0 : pos - 1;
+            for (size_t i = key_pos; i + 1 < inner->count; ++i) inner->keys[i] = std::move(inner->keys[i + 1]);
+            for (size_t i = pos; i < inner->count; ++i) inner->children[i] = inner->children[i + 1];
+            inner->keys[--inner->count] = pad_key(count_search_t());
+        }
+
+        // elements [from, to) of the leaf are destroyed, the next ones are moved down
+        void erase_slots(leaf_t *leaf, size_t const from, size_t const to) {
+            size_t const n = to - from;
+            for (size_t i = from; i < to; ++i) leaf->slot(i)->~slot_t();
+            for (size_t i = to; i < leaf->count; ++i) move_slot(leaf, i - n, leaf, i);
+            for (size_t i = leaf->count - n; i < leaf->count; ++i) leaf->keys[i] = pad_key(count_search_t());
+            leaf->count -= n;
+            elements_count -= n;
+        }
+
+        void unlink_leaf(leaf_t *leaf) {
+            if (leaf->prev) leaf->prev->next = leaf->next; else first_leaf = leaf->next;
+            if (leaf->next) leaf->next->prev = leaf->prev; else last_leaf = leaf->prev;
+        }
+
+        // empty leaf is removed, leaf with less than 1/4 of node_size is merged with a neighbour of the same parent if fits
+        void rebalance_leaf(leaf_t *leaf, path_t *path, size_t const depth) {
+            if (depth == 0 || leaf->count >= node_size / 4) return;
+            inner_t *const parent = path[depth - 1].node;
+            size_t const pos = path[depth - 1].pos;
+            if (leaf->count == 0) {
+                unlink_leaf(leaf);
+                remove_child(path, depth, pos);
+                delete leaf;
+            }
+            else {
+                size_t const left_pos = (pos > 0) ? pos - 1 : pos;
+                if (left_pos + 1 > parent->count) return;
+                leaf_t *const left = static_cast<leaf_t *>(parent->children[left_pos]);
+                leaf_t *const right = static_cast<leaf_t *>(parent->children[left_pos + 1]);
+                if (left->count + right->count > node_size * 3 / 4) return;
+                for (size_t i = 0; i < right->count; ++i) {
+                    move_slot(left, left->count + i, right, i);
+                    right->keys[i] = pad_key(count_search_t());
+                }
+                left->count += right->count;
+                right->count = 0;
+                unlink_leaf(right);
+                remove_child(path, depth, left_pos + 1);
+                delete right;
+            }
+            while (!root->is_leaf && root->count == 0) {    // root with one child
+                inner_t *const old_root = static_cast<inner_t *>(root);
+                root = old_root->children[0];
+                delete old_root;
+            }
+        }
+
+        void destroy(node_t *node) {
+            if (node->is_leaf) { delete static_cast<leaf_t *>(node); return; }
+            inner_t *const inner = static_cast<inner_t *>(node);
+            for (size_t i = 0; i <= inner->count; ++i) destroy(inner->children[i]);
+            delete inner;
+        }
+
+        void init() {
+            root = first_leaf = last_leaf = new leaf_t();
+            elements_count = 0;
+        }
+
+    public:
+        template<bool is_const>
+        class iterator_t {
+            friend class btree_map;
+            template<bool> friend class iterator_t;
+            leaf_t *leaf;
+            size_t pos;
+            iterator_t(leaf_t *l, size_t p) : leaf(l), pos(p) {}
+        public:
+            typedef std::bidirectional_iterator_tag iterator_category;
+            typedef typename btree_map::value_type value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef typename std::conditional<is_const, value_type const *, value_type *>::type pointer;
+            typedef typename std::conditional<is_const, value_type const&, value_type&>::type reference;
+
+            iterator_t() : leaf(nullptr), pos(0) {}
+            template<bool other_const, typename = typename std::enable_if<is_const && !other_const>::type>
+            iterator_t(iterator_t<other_const> const& other) : leaf(other.leaf), pos(other.pos) {}
+
+            // slot_t and value_type differ only in const of the key
+            reference operator * () const { return *reinterpret_cast<pointer>(leaf->slot(pos)); }
+            pointer operator -> () const { return reinterpret_cast<pointer>(leaf->slot(pos)); }
+            iterator_t& operator ++ () {
+                if (++pos == leaf->count && leaf->next) { leaf = leaf->next; pos = 0; }
+                return *this;
+            }
+            iterator_t& operator -- () {
+                if (pos == 0) { leaf = leaf->prev; pos = leaf->count; }
+                --pos;
+                return *this;
+            }
+            iterator_t operator ++ (int) { iterator_t tmp(*this); ++*this; return tmp; }
+            iterator_t operator -- (int) { iterator_t tmp(*this); --*this; return tmp; }
+            template<bool other_const> bool operator == (iterator_t<other_const> const& other) const { return leaf == other.leaf && pos == other.pos; }
+            template<bool other_const> bool operator != (iterator_t<other_const> const& other) const { return !(*this == other); }
+        };
+        typedef iterator_t<false> iterator;
+        typedef iterator_t<true> const_iterator;
+
+        btree_map() { init(); }
+        btree_map(btree_map const& other) : comp(other.comp) {
+            init();
+            for (auto const& i : other) emplace(i.first, i.second);
+        }
+        btree_map(btree_map &&other) : comp(other.comp) { init(); swap(other); }
+        btree_map(std::initializer_list<value_type> il) { init(); insert(il.begin(), il.end()); }
+        btree_map& operator = (btree_map other) { swap(other); return *this; }
+        ~btree_map() { destroy(root); }
+
+        void swap(btree_map &other) {
+            std::swap(root, other.root);
+            std::swap(first_leaf, other.first_leaf);
+            std::swap(last_leaf, other.last_leaf);
+            std::swap(elements_count, other.elements_count);
+            std::swap(comp, other.comp);
+        }
+
+        iterator begin() { return iterator(first_leaf, 0); }
+        iterator end() { return iterator(last_leaf, last_leaf->count); }
+        const_iterator begin() const { return const_iterator(first_leaf, 0); }
+        const_iterator end() const { return const_iterator(last_leaf, last_leaf->count); }
+        const_iterator cbegin() const { return begin(); }
+        const_iterator cend() const { return end(); }
+
+        size_t size() const { return elements_count; }
+        bool empty() const { return elements_count == 0; }
+        key_compare key_comp() const { return comp; }
+        void clear() { destroy(root); init(); }
+
+        iterator lower_bound(key_t const& k) {
+            leaf_t *const leaf = descend(k);
+            size_t const pos = search<false>(leaf, k);
+            return (pos == leaf->count && leaf->next) ? iterator(leaf->next, 0) : iterator(leaf, pos);
+        }
+        iterator upper_bound(key_t const& k) {
+            leaf_t *const leaf = descend(k);
+            size_t const pos = search<true>(leaf, k);
+            return (pos == leaf->count && leaf->next) ? iterator(leaf->next, 0) : iterator(leaf, pos);
+        }
+        iterator find(key_t const& k) {
+            leaf_t *const leaf = descend(k);
+            size_t const pos = search<false>(leaf, k);
+            return (pos < leaf->count && !comp(k, leaf->keys[pos])) ? iterator(leaf, pos) : end();
+        }
+        const_iterator lower_bound(key_t const& k) const { return const_cast<btree_map *>(this)->lower_bound(k); }
+        const_iterator upper_bound(key_t const& k) const { return const_cast<btree_map *>(this)->upper_bound(k); }
+        const_iterator find(key_t const& k) const { return const_cast<btree_map *>(this)->find(k); }
+        std::pair<iterator, iterator> equal_range(key_t const& k) { return std::make_pair(lower_bound(k), upper_bound(k)); }
+        std::pair<const_iterator, const_iterator> equal_range(key_t const& k) const { return std::make_pair(lower_bound(k), upper_bound(k)); }
+        size_t count(key_t const& k) const { return (find(k) != end()) ? 1 : 0; }
+
+        // val_t is constructed from args only if the key isn't found, and the nodes of the split are allocated - before the tree
+        // is changed: if they throw, the tree stays as it was. Moves of key_t and val_t shouldn't throw (elements are moved between slots)
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(key_t const& k, Args&&... args) {
+            path_t path[max_depth];
+            size_t depth;
+            leaf_t *leaf = descend(k, path, depth);
+            size_t pos = search<false>(leaf, k);
+            if (pos < leaf->count && !comp(k, leaf->keys[pos])) return std::make_pair(iterator(leaf, pos), false);
+            slot_t new_slot(std::piecewise_construct, std::forward_as_tuple(k), std::forward_as_tuple(std::forward<Args>(args)...));
+            if (leaf->count == node_size) {
+                // full inner nodes above the leaf are split too, and the root - by the new root
+                size_t splits = 0;
+                while (splits < depth && path[depth - 1 - splits].node->count == node_size) ++splits;
+                std::unique_ptr<leaf_t> new_leaf(new leaf_t());
+                std::unique_ptr<inner_t> spare[max_depth + 1];
+                for (size_t i = 0; i < splits + (splits == depth); ++i) spare[i].reset(new inner_t());
+                // append to the end of the tree (sorted load) - to the new empty leaf, else the upper half goes to the new leaf
+                bool const append = (leaf == last_leaf && pos == node_size);
+                leaf_t *const right = split_leaf(leaf, (append) ? node_size : node_size / 2, new_leaf.release());
+                insert_separator(path, depth, (append) ? k : right->keys[0], right, spare);
+                if (append || pos > leaf->count) { pos -= leaf->count; leaf = right; }
+            }
+            for (size_t i = leaf->count; i > pos; --i) move_slot(leaf, i, leaf, i - 1);
+            new (leaf->slot(pos)) slot_t(std::move(new_slot));
+            leaf->keys[pos] = k;
+            ++leaf->count;
+            ++elements_count;
+            return std::make_pair(iterator(leaf, pos), true);
+        }
+
+        template<typename K, typename V>
+        std::pair<iterator, bool> emplace(K &&k, V &&v) { return try_emplace(key_t(std::forward<K>(k)), std::forward<V>(v)); }
+
+        // hint end() and the key greater than all - appended to the last leaf without search, else the hint isn't used
+        template<typename K, typename V>
+        iterator emplace_hint(const_iterator hint, K &&k, V &&v) {
+            key_t key(std::forward<K>(k));
+            leaf_t *const leaf = last_leaf;
+            if (hint == end() && leaf->count > 0 && leaf->count < node_size && comp(leaf->keys[leaf->count - 1], key)) {
+                size_t const pos = leaf->count;
+                new (leaf->slot(pos)) slot_t(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<V>(v)));
+                leaf->keys[pos] = std::move(key);
+                ++leaf->count;
+                ++elements_count;
+                return iterator(leaf, pos);
+            }
+            return try_emplace(key, std::forward<V>(v)).first;
+        }
+        template<typename P>
+        std::pair<iterator, bool> emplace(P &&p) { return try_emplace(p.first, std::forward<P>(p).second); }
+        std::pair<iterator, bool> insert(value_type const& val) { return try_emplace(val.first, val.second); }
+        template<typename input_it_t>
+        void insert(input_it_t first, input_it_t last) { for (; first != last; ++first) emplace(*first); }
+
+        template<typename V>
+        std::pair<iterator, bool> insert_or_assign(key_t const& k, V &&v) {
+            auto result = try_emplace(k, std::forward<V>(v));
+            if (!result.second) result.first->second = std::forward<V>(v);
+            return result;
+        }
+
+        val_t& operator [] (key_t const& k) { return try_emplace(k).first->second; }
+        val_t& at(key_t const& k) { auto it = find(k); if (it == end()) throw std::out_of_range("btree_map::at"); return it->second; }
+        val_t const& at(key_t const& k) const { auto it = find(k); if (it == end()) throw std::out_of_range("btree_map::at"); return it->second; }
+
+        size_t erase(key_t const& k) {
+            path_t path[max_depth];
+            size_t depth;
+            leaf_t *const leaf = descend(k, path, depth);
+            size_t const pos = search<false>(leaf, k);
+            if (pos == leaf->count || comp(k, leaf->keys[pos])) return 0;
+            erase_slots(leaf, pos, pos + 1);
+            rebalance_leaf(leaf, path, depth);
+            return 1;
+        }
+
+        // returns iterator to the element after the erased one
+        iterator erase(const_iterator it) {
+            key_t const k = it->first;
+            erase(k);
+            return lower_bound(k);
+        }
+        iterator erase(iterator it) { return erase(const_iterator(it)); }
+
+        iterator erase(const_iterator first, const_iterator last) {
+            if (first == last) return iterator(first.leaf, first.pos);
+            bool const to_end = (last == end());
+            if (to_end && first == begin()) { clear(); return end(); }
+            key_t const last_key = (to_end) ? key_t() : last->first;
+            // leaf by leaf: the range of the leaf is erased at once, then the leaf is rebalanced
+            key_t k = first->first;
+            for (bool more = true; more; ) {
+                path_t path[max_depth];
+                size_t depth;
+                leaf_t *const leaf = descend(k, path, depth);
+                size_t const from = search<false>(leaf, k);
+                size_t const to = (to_end) ? leaf->count : search<false>(leaf, last_key);
+                more = to == leaf->count && leaf->next && (to_end || comp(leaf->next->keys[0], last_key));
+                if (more) k = leaf->next->keys[0];     // before the leaf is merged with the next one
+                erase_slots(leaf, from, to);
+                rebalance_leaf(leaf, path, depth);
+            }
+            return (to_end) ? end() : lower_bound(last_key);
+        }
+    };
+#ifdef SIMD_SSE2
+    template<typename key_t, typename val_t, typename compare_t, size_t node_size>
+    constexpr unsigned char btree_map<key_t, val_t, compare_t, node_size>::bits_count[16];
+#endif
+    // ---------------------------------------------------------------
+
+    namespace parallel_details {
+        // small thread pool for parallel scans: tasks 0 - (count-1) of the job are taken by the atomic counter by workers and
+        // by the calling thread, which runs them too - a job from a task (nested) or a busy pool can't deadlock.
+        class thread_pool_t {
+            struct job_t {
+                std::function<void(size_t)> task;
+                size_t const count;
+                std::atomic<size_t> next, done;
+                size_t threads_left;    // workers which can join the job, under mtx
+                std::exception_ptr exception;
+                std::mutex exception_mtx;
+                job_t(std::function<void(size_t)> &&f, size_t const n, size_t const threads) : task(std::move(f)), count(n), next(0), done(0),
+                    threads_left(threads) {}
+                void run_tasks() {
+                    for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+                        try { task(i); }
+                        catch (...) { std::lock_guard<std::mutex> lock(exception_mtx); if (!exception) exception = std::current_exception(); }
+                        done.fetch_add(1, std::memory_order_acq_rel);
+                    }
+                }
+            };
+            std::mutex mtx;
+            std::condition_variable job_cv, done_cv;
+            std::vector<std::shared_ptr<job_t>> jobs;   // jobs with tasks not taken yet
+            std::vector<std::thread> workers;
+            bool stop;
+
+            void remove(std::shared_ptr<job_t> const& job) {    // under mtx
+                auto it = std::find(jobs.begin(), jobs.end(), job);
+                if (it != jobs.end()) jobs.erase(it);
+            }
+
+            void worker() {
+                std::unique_lock<std::mutex> lock(mtx);
+                for (;;) {
+                    job_cv.wait(lock, [&]() { return stop || !jobs.empty(); });
+                    if (stop) return;
+                    std::shared_ptr<job_t> job = jobs.front();
+                    if (--job->threads_left == 0) remove(job);
+                    lock.unlock();
+                    job->run_tasks();
+                    lock.lock();
+                    remove(job);        // all tasks are taken
+                    done_cv.notify_all();
+                }
+            }
+
+        public:
+            explicit thread_pool_t(size_t const workers_count) : stop(false) {
+                for (size_t i = 0; i < workers_count; ++i) workers.emplace_back([this]() { worker(); });
+            }
+            ~thread_pool_t() {
+                { std::lock_guard<std::mutex> lock(mtx); stop = true; }
+                job_cv.notify_all();
+                for (auto &i : workers) i.join();
+            }
+
+            // task(i) for i = 0 - (count-1), returns when all are done, rethrows the first exception.
+            // max_threads - threads for the job including the calling one, 0 - all
+            void run(size_t const count, std::function<void(size_t)> task, size_t const max_threads = 0) {
+                size_t const workers_count = (max_threads == 0) ? workers.size() : std::min(max_threads - 1, workers.size());
+                auto job = std::make_shared<job_t>(std::move(task), count, workers_count);
+                if (count > 1 && workers_count > 0) {
+                    { std::lock_guard<std::mutex> lock(mtx); jobs.push_back(job); }
+                    job_cv.notify_all();
+                }
+                job->run_tasks();
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    remove(job);
+                    done_cv.wait(lock, [&]() { return job->done.load(std::memory_order_acquire) == job->count; });
+                }
+                if (job->exception) std::rethrow_exception(job->exception);
+            }
+
+            // one worker per CPU core except the calling thread
+            static thread_pool_t& instance() {
+                static thread_pool_t pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+                return pool;
+            }
+        };
+    }
+
+    namespace bulk_details {
+        // iterators to pairs (key, value), sorted by key here if not sorted yet - stable: the first of equal keys is inserted
+        template<typename compare_t, typename it_t>
+        void sort_items(std::vector<it_t> &items) {
+            compare_t const comp = compare_t();
+            auto const less = [&](it_t const& a, it_t const& b) { return comp((*a).first, (*b).first); };
+            if (!std::is_sorted(items.begin(), items.end(), less)) std::stable_sort(items.begin(), items.end(), less);
+        }
+
+        // sorted elements are inserted to the ordered container with hint end() - without search if greater than existing ones
+        template<typename container_t, typename it_t>
+        size_t insert_sorted(container_t &container, std::vector<it_t> const& items) {
+            size_t const old_size = container.size();
+            for (auto &i : items) {
+                auto &&element = *i;
+                container.emplace_hint(container.end(), std::forward<decltype(element)>(element).first,
+                    std::forward<decltype(element)>(element).second);
+            }
+            return container.size() - old_size;
+        }
+    }
+
+    namespace emplace_details {
+        // the member function of C++17 maps and btree_map<>, else search + emplace with hint (ordered) or emplace (unordered)
+        template<typename container_t, typename = void> struct has_try_emplace : std::false_type {};
+        template<typename container_t> struct has_try_emplace<container_t,
+            decltype((void)std::declval<container_t&>().try_emplace(std::declval<typename container_t::key_type>()))> : std::true_type {};
+        template<typename container_t, typename = void> struct has_insert_or_assign : std::false_type {};
+        template<typename container_t> struct has_insert_or_assign<container_t, decltype((void)std::declval<container_t&>().insert_or_assign(
+            std::declval<typename container_t::key_type>(), std::declval<typename container_t::mapped_type>()))> : std::true_type {};
+        template<typename container_t, typename = void> struct is_ordered : std::false_type {};
+        template<typename container_t> struct is_ordered<container_t,
+            typename std::conditional<true, void, typename container_t::key_compare>::type> : std::true_type {};
+        template<typename container_t, typename = void> struct is_unordered : std::false_type {};
+        template<typename container_t> struct is_unordered<container_t,
+            typename std::conditional<true, void, typename container_t::hasher>::type> : std::true_type {};
+
+        enum { member_op, ordered_op, unordered_op };
+        template<typename container_t, bool has_member> using op_of = std::integral_constant<int,
+            (has_member) ? member_op : (is_ordered<container_t>::value) ? ordered_op : unordered_op>;
+
+        template<typename container_t, typename K, typename... Args>
+        bool try_emplace(std::integral_constant<int, member_op>, container_t &container, K &&key, Args &&...args) {
+            return container.try_emplace(std::forward<K>(key), std::forward<Args>(args)...).second;
+        }
+        template<typename container_t, typename K, typename... Args>
+        bool try_emplace(std::integral_constant<int, ordered_op>, container_t &container, K &&key, Args &&...args) {
+            auto const it = container.lower_bound(key);
+            if (it != container.end() && !container.key_comp()(key, it->first)) return false;
+            container.emplace_hint(it, std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                std::forward_as_tuple(std::forward<Args>(args)...));
+            return true;
+        }
+        template<typename container_t, typename K, typename... Args>
+        bool try_emplace(std::integral_constant<int, unordered_op>, container_t &container, K &&key, Args &&...args) {
+            if (container.find(key) != container.end()) return false;
+            container.emplace(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+            return true;
+        }
+
+        // the value is constructed only if the key doesn't exist. Returns true if inserted
+        template<typename container_t, typename K, typename... Args>
+        bool try_emplace(container_t &container, K &&key, Args &&...args) {
+            return try_emplace(op_of<container_t, has_try_emplace<container_t>::value>(), container, std::forward<K>(key), std::forward<Args>(args)...);
+        }
+
+        template<typename container_t, typename K, typename V>
+        bool insert_or_assign(std::integral_constant<int, member_op>, container_t &container, K &&key, V &&val) {
+            return container.insert_or_assign(std::forward<K>(key), std::forward<V>(val)).second;
+        }
+        template<typename container_t, typename K, typename V>
+        bool insert_or_assign(std::integral_constant<int, ordered_op>, container_t &container, K &&key, V &&val) {
+            auto const it = container.lower_bound(key);
+            if (it != container.end() && !container.key_comp()(key, it->first)) { it->second = std::forward<V>(val); return false; }
+            container.emplace_hint(it, std::forward<K>(key), std::forward<V>(val));
+            return true;
+        }
+        template<typename container_t, typename K, typename V>
+        bool insert_or_assign(std::integral_constant<int, unordered_op>, container_t &container, K &&key, V &&val) {
+            auto const it = container.find(key);
+            if (it != container.end()) { it->second = std::forward<V>(val); return false; }
+            container.emplace(std::forward<K>(key), std::forward<V>(val));
+            return true;
+        }
+
+        // the value is assigned if the key exists, else inserted. Returns true if inserted
+        template<typename container_t, typename K, typename V>
+        bool insert_or_assign(container_t &container, K &&key, V &&val) {
+            return insert_or_assign(op_of<container_t, has_insert_or_assign<container_t>::value>(), container, std::forward<K>(key), std::forward<V>(val));
+        }
+    }
+
+    namespace node_details {
+        // node handles of C++17 maps: extract() and insert(node_type &&)
+        template<typename container_t, typename = void> struct has_node_handle : std::false_type {};
+        template<typename container_t> struct has_node_handle<container_t,
+            decltype((void)std::declval<container_t&>().extract(std::declval<typename container_t::const_iterator>()))> : std::true_type {};
+
+        // the node is built in a default-constructed temporary map: only ordered maps (no bucket array to allocate)
+        // whose allocators always compare equal (the node can be spliced into any map of this type)
+        template<typename container_t, bool = has_node_handle<container_t>::value> struct node_preparable : std::false_type {};
+        template<typename container_t> struct node_preparable<container_t, true> : std::integral_constant<bool,
+            emplace_details::is_ordered<container_t>::value &&
+            std::allocator_traits<typename container_t::allocator_type>::is_always_equal::value> {};
+
+        // element prepared before the X-lock: the node is allocated and constructed outside and spliced in under the lock.
+        // Else (C++14, btree_map, unordered maps, stateful allocators) - the key and the value are constructed outside,
+        // only the node is allocated under the lock
+        template<typename container_t, bool = node_preparable<container_t>::value> class prepared_t;
+
+        template<typename container_t> class prepared_t<container_t, true> {
+            typename container_t::node_type node;
+        public:
+            template<typename K, typename... Args> prepared_t(K &&key, Args &&...args) {
+                container_t tmp;
+                node = tmp.extract(tmp.emplace(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                    std::forward_as_tuple(std::forward<Args>(args)...)).first);
+            }
+            typename container_t::key_type const& key() const { return node.key(); }
+            // under the X-lock: false - the key already exists, the node stays here and is destroyed after the unlock
+            bool insert(container_t &container) {
+                auto result = container.insert(std::move(node));
+                if (!result.inserted) node = std::move(result.node);
+                return result.inserted;
+            }
+        };
+
+        template<typename container_t> class prepared_t<container_t, false> {
+            typename container_t::key_type k;
+            typename container_t::mapped_type val;
+            static_assert(emplace_details::is_ordered<container_t>::value || emplace_details::is_unordered<container_t>::value,
+                "prepared_t<> requires an ordered (key_compare, lower_bound) or an unordered (hasher, find) map");
+        public:
+            template<typename K, typename... Args> prepared_t(K &&k, Args &&...args) : k(std::forward<K>(k)), val(std::forward<Args>(args)...) {}
+            typename container_t::key_type const& key() const { return k; }
+            bool insert(container_t &container) {
+                return emplace_details::try_emplace(container, std::move(k), std::move(val));
+            }
+        };
+
+        // erased elements are extracted under the X-lock and destroyed after the unlock by drain() or by destructor.
+        // Without node handles - values with destructors are moved out, only the node is freed under the lock;
+        // trivially destructible values are erased at once: moving them out is more work under the lock than the erase
+        enum { extract_nodes, move_values, plain_erase };
+        template<typename container_t> using destruction_of = std::integral_constant<int, (has_node_handle<container_t>::value) ? extract_nodes :
+            (!std::is_trivially_destructible<typename container_t::mapped_type>::value) ? move_values : plain_erase>;
+
+        template<typename container_t, int = destruction_of<container_t>::value> class deferred_destruction_t;
+
+        template<typename container_t> class deferred_destruction_t<container_t, extract_nodes> {
+            std::vector<typename container_t::node_type> nodes;
+        public:
+            template<typename it_t> void erase(container_t &container, it_t first, it_t last) {
+                nodes.reserve(nodes.size() + std::distance(first, last));
+                while (first != last) nodes.push_back(container.extract(first++));
+            }
+            void drain() { nodes.clear(); }
+        };
+
+        template<typename container_t> class deferred_destruction_t<container_t, move_values> {
+            std::vector<typename container_t::mapped_type> values;
+        public:
+            template<typename it_t> void erase(container_t &container, it_t first, it_t last) {
+                values.reserve(values.size() + std::distance(first, last));
+                for (auto it = first; it != last; ++it) values.push_back(std::move(it->second));
+                container.erase(first, last);
+            }
+            void drain() { values.clear(); }
+        };
+
+        template<typename container_t> class deferred_destruction_t<container_t, plain_erase> {
+        public:
+            template<typename it_t> void erase(container_t &container, it_t first, it_t last) { container.erase(first, last); }
+            void drain() {}
+        };
+    }
+
+    // try_emplace() and insert_or_assign() for safe_ptr<> of std::map, std::unordered_map or btree_map<> (C++14 too):
+    // arguments are forwarded, the value is constructed in place under the X-lock only if it is inserted
+    template<typename safe_map_t, typename K, typename... Args>
+    bool try_emplace(safe_map_t &safe_map, K &&key, Args &&...args) {
+        return emplace_details::try_emplace(*xlock_safe_ptr(safe_map).operator->(), std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    template<typename safe_map_t, typename K, typename V>
+    bool insert_or_assign(safe_map_t &safe_map, K &&key, V &&val) {
+        return emplace_details::insert_or_assign(*xlock_safe_ptr(safe_map).operator->(), std::forward<K>(key), std::forward<V>(val));
+    }
+
+    // the node is allocated and constructed before the X-lock of safe_ptr<> map, spliced in under it.
+    // Returns false if the key already exists - the prepared node is destroyed after the unlock
+    template<typename safe_map_t, typename K, typename... Args>
+    bool emplace_node(safe_map_t &safe_map, K &&key, Args &&...args) {
+        node_details::prepared_t<typename safe_map_t::obj_t> prepared(std::forward<K>(key), std::forward<Args>(args)...);
+        return prepared.insert(*xlock_safe_ptr(safe_map).operator->());
+    }
+
+    // the node is extracted under the X-lock of safe_ptr<> map, the value is destroyed after the unlock
+    template<typename safe_map_t, typename K>
+    size_t erase_deferred(safe_map_t &safe_map, K const& key) {
+        node_details::deferred_destruction_t<typename safe_map_t::obj_t> deferred;
+        auto x_map = xlock_safe_ptr(safe_map);
+        auto const range = x_map->equal_range(key);
+        size_t const erased = std::distance(range.first, range.second);
+        deferred.erase(*x_map.operator->(), range.first, range.second);
+        return erased;
+    }
+
+    namespace snapshot_details {
+        // file format: header_t, then for each partition: boundary key, uint64_t rows count, rows (key, value) -
+        // fixed-width keys and values in native byte order, stored contiguously
+        struct header_t {
+            char magic[8];
+            uint32_t key_size, val_size;
+            uint64_t partitions_count;
+        };
+        static char const magic[8] = { 'S', 'F', 'S', 'N', 'A', 'P', '0', '1' };
+
+        // read-only file mapped to memory by mmap(), or read to the buffer where there is no mmap()
+        class mapped_file_t {
+            char const* data_ptr = nullptr;
+            size_t data_size = 0;
+#ifndef SNAPSHOT_MMAP
+            std::vector<char> buf;
+#endif
+        public:
+            explicit mapped_file_t(std::string const& file_name) {
+#ifdef SNAPSHOT_MMAP
+                int const fd = ::open(file_name.c_str(), O_RDONLY);
+                if (fd < 0) throw std::runtime_error("can't open snapshot file " + file_name);
+                struct stat st;
+                if (::fstat(fd, &st) != 0) { ::close(fd); throw std::runtime_error("can't read snapshot file " + file_name); }
+                data_size = (size_t)st.st_size;
+                void *const ptr = (data_size > 0) ? ::mmap(nullptr, data_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+                ::close(fd);
+                if (ptr == MAP_FAILED) throw std::runtime_error("can't map snapshot file " + file_name);
+                if (ptr) ::madvise(ptr, data_size, MADV_WILLNEED);
+                data_ptr = static_cast<char const*>(ptr);
+#else
+                std::unique_ptr<std::FILE, int(*)(std::FILE *)> file(std::fopen(file_name.c_str(), "rb"), &std::fclose);
+                if (!file) throw std::runtime_error("can't open snapshot file " + file_name);
+                std::fseek(file.get(), 0, SEEK_END);
+                buf.resize((size_t)std::ftell(file.get()));
+                std::fseek(file.get(), 0, SEEK_SET);
+                if (std::fread(buf.data(), 1, buf.size(), file.get()) != buf.size()) throw std::runtime_error("can't read snapshot file " + file_name);
+                data_ptr = buf.data();
+                data_size = buf.size();
+#endif
+            }
+            ~mapped_file_t() {
+#ifdef SNAPSHOT_MMAP
+                if (data_ptr) ::munmap(const_cast<char *>(data_ptr), data_size);
+#endif
+            }
+            mapped_file_t(mapped_file_t const&) = delete;
+            mapped_file_t& operator = (mapped_file_t const&) = delete;
+            char const* data() const { return data_ptr; }
+            size_t size() const { return data_size; }
+        };
+    }
+
+    // bulk load of pairs (key, value) to safe_ptr<> or contfree_safe_ptr<> of ordered map: sorted before the lock,
+    // inserted under one X-lock with hint. Existing keys aren't replaced. Returns number of inserted elements.
+    template<typename safe_map_t, typename it_t>
+    size_t bulk_load(safe_map_t &safe_map, it_t first, it_t last) {
+        std::vector<it_t> items;
+        for (; first != last; ++first) items.push_back(first);
+        bulk_details::sort_items<typename safe_map_t::obj_t::key_compare>(items);
+        auto x_map = xlock_safe_ptr(safe_map);
+        return bulk_details::insert_sorted(*x_map.operator->(), items);
+    }
+    // ---------------------------------------------------------------
+
+    // counting_bloom_filter<> - lock-free negative filter of keys: may_contain() == false - the key is definitely absent,
+    // so lookups of missing keys return without the lock. Blocked: all counters of a key are in one cache line - one cache miss
+    // per check. 8-bit counters saturate: a counter at 255 is never decremented, so erase can't produce a false negative.
+    // Protocol: add() before the key becomes visible in the container, remove() after it was erased (or under the X-lock)
+    namespace filter_details {
+        // std::hash<> of integers is the identity - its bits are mixed (finalizer of MurmurHash3)
+        inline uint64_t mix(uint64_t h) {
+            h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+            return h ^ (h >> 33);
+        }
+
+        // containers of keys without std::hash<> compile, but can't enable the filter
+        template<typename T, typename = void> struct is_hashable : std::false_type {};
+        template<typename T> struct is_hashable<T, decltype((void)std::hash<T>()(std::declval<T const&>()))> : std::true_type {};
+        template<typename T> uint64_t hash_of(T const& key, std::true_type) { return std::hash<T>()(key); }
+        template<typename T> uint64_t hash_of(T const&, std::false_type) { return 0; }
+        template<typename T> uint64_t hash_of(T const& key) { return hash_of(key, is_hashable<T>()); }
+    }
+
+    template<typename key_t, typename hash_t = std::hash<key_t>>
+    class counting_bloom_filter {
+        enum { cache_line_size = 64, hashes_count = 4, counters_per_key = 16 };
+        struct alignas(cache_line_size) block_t { std::atomic<uint8_t> counters[cache_line_size]; };
+
+        std::unique_ptr<char[]> raw;
+        block_t *blocks;
+        size_t blocks_mask;
+
+        // block by the high bits, counters in the block by 4 x 6 low bits
+        template<typename F> void for_each_counter(uint64_t const hash, F f) const {
+            uint64_t const h = filter_details::mix(hash);
+            block_t &block = blocks[(h >> 32) & blocks_mask];
+            for (unsigned i = 0; i < hashes_count; ++i) f(block.counters[(h >> (i * 6)) & (cache_line_size - 1)]);
+        }
+
+    public:
+        // 16 counters per expected key: ~0.5% false positives at the expected number of keys
+        explicit counting_bloom_filter(size_t const expected_keys) {
+            size_t blocks_count = 1;
+            while (blocks_count * cache_line_size < std::max<size_t>(expected_keys, 1) * counters_per_key) blocks_count *= 2;
+            blocks_mask = blocks_count - 1;
+            raw.reset(new char[sizeof(block_t) * blocks_count + cache_line_size]);
+            blocks = reinterpret_cast<block_t *>(
+                (reinterpret_cast<uintptr_t>(raw.get()) + cache_line_size - 1) & ~(uintptr_t)(cache_line_size - 1));
+            for (size_t i = 0; i < blocks_count; ++i) new (&blocks[i]) block_t();
+            clear();
+        }
+        counting_bloom_filter(counting_bloom_filter const&) = delete;
+        counting_bloom_filter& operator=(counting_bloom_filter const&) = delete;
+
+        void add_hash(uint64_t const hash) {
+            for_each_counter(hash, [](std::atomic<uint8_t> &counter) {
+                uint8_t c = counter.load(std::memory_order_relaxed);
+                while (c != UINT8_MAX && !counter.compare_exchange_weak(c, c + 1, std::memory_order_relaxed));
+            });
+        }
+        void remove_hash(uint64_t const hash) {
+            for_each_counter(hash, [](std::atomic<uint8_t> &counter) {
+                uint8_t c = counter.load(std::memory_order_relaxed);
+                while (c != UINT8_MAX && c != 0 && !counter.compare_exchange_weak(c, c - 1, std::memory_order_relaxed));
+            });
+        }
+        bool may_contain_hash(uint64_t const hash) const {
+            bool result = true;
+            for_each_counter(hash, [&](std::atomic<uint8_t> const& counter) { result &= counter.load(std::memory_order_relaxed) != 0; });
+            return result;
+        }
+
+        void add(key_t const& key) { add_hash(hash_t()(key)); }
+        void remove(key_t const& key) { remove_hash(hash_t()(key)); }
+        bool may_contain(key_t const& key) const { return may_contain_hash(hash_t()(key)); }
+
+        // isn't thread-safe: without concurrent operations
+        void clear() {
+            for (size_t i = 0; i <= blocks_mask; ++i)
+                for (auto &counter : blocks[i].counters) counter.store(0, std::memory_order_relaxed);
+        }
+        size_t memory_size() const { return sizeof(block_t) * (blocks_mask + 1); }
+    };
+
+
+    // safe_ptr<> or contfree_safe_ptr<> of a map with counting_bloom_filter<>: find(), count() and erase() of absent keys
+    // return without the lock. Insert and erase only by methods of this class - they keep the filter
+    template<typename key_t, typename val_t, template<class> class safe_ptr_t = contfree_safe_ptr,
+        typename container_t = std::map<key_t, val_t>, typename hash_t = std::hash<key_t> >
+    class safe_map_filtered_t
+    {
+        safe_ptr_t<container_t> safe_map;
+        counting_bloom_filter<key_t, hash_t> filter;
+
+    public:
+        explicit safe_map_filtered_t(size_t const expected_elements) : filter(expected_elements) {}
+
+        bool may_contain(key_t const& key) const { return filter.may_contain(key); }
+
+        bool find(key_t const& key, val_t &val) const {
+            if (!filter.may_contain(key)) return false;
+            auto s_safe_map = slock_safe_ptr(safe_map);
+            auto const it = s_safe_map->find(key);
+            if (it == s_safe_map->end()) return false;
+            val = it->second;
+            return true;
+        }
+        size_t count(key_t const& key) const {
+            if (!filter.may_contain(key)) return 0;
+            return slock_safe_ptr(safe_map)->count(key);
+        }
+
+        // the key is added to the filter before the insertion, and removed if it wasn't inserted. Returns true if inserted
+        template<typename K, typename... Args> bool try_emplace(K &&key, Args &&...args) {
+            key_t k(std::forward<K>(key));
+            uint64_t const hash = hash_t()(k);
+            filter.add_hash(hash);
+            bool const inserted = emplace_details::try_emplace(*xlock_safe_ptr(safe_map).operator->(), std::move(k), std::forward<Args>(args)...);
+            if (!inserted) filter.remove_hash(hash);
+            return inserted;
+        }
+        template<typename K, typename V> bool insert_or_assign(K &&key, V &&val) {
+            key_t k(std::forward<K>(key));
+            uint64_t const hash = hash_t()(k);
+            filter.add_hash(hash);
+            bool const inserted = emplace_details::insert_or_assign(*xlock_safe_ptr(safe_map).operator->(), std::move(k), std::forward<V>(val));
+            if (!inserted) filter.remove_hash(hash);
+            return inserted;
+        }
+
+        size_t erase(key_t const& key) {
+            if (!filter.may_contain(key)) return 0;
+            size_t const erased = xlock_safe_ptr(safe_map)->erase(key);
+            for (size_t i = 0; i < erased; ++i) filter.remove(key);
+            return erased;
+        }
+
+        size_t size() const { return slock_safe_ptr(safe_map)->size(); }
+
+        // under the X-lock: nobody can see the elements while their keys are removed
+        void clear() {
+            auto x_safe_map = xlock_safe_ptr(safe_map);
+            for (auto const& element : *x_safe_map.operator->()) filter.remove(element.first);
+            x_safe_map->clear();
+        }
+
+        // reads without the filter: under the S-lock
+        slocked_safe_ptr<safe_ptr_t<container_t>> read_only() const { return slock_safe_ptr(safe_map); }
+    };
+    // ---------------------------------------------------------------
+
+    namespace epoch_details {
+        enum { reader_cells_count = 64 };
+
+        // operations of the threads of this cell which use shared objects, by parity of the epoch of the pin; each cell in its own cache line
+        struct reader_cell_t {
+            std::atomic<int> readers[2];
+            char avoid_falsesharing[64 - 2 * sizeof(std::atomic<int>)];
+            reader_cell_t() { readers[0] = 0; readers[1] = 0; }
+        };
+
+        // threads are distributed between the cells round-robin
+        inline size_t reader_cell() {
+            static std::atomic<size_t> next_cell(0);
+            thread_local static size_t const cell = next_cell.fetch_add(1, std::memory_order_relaxed) % reader_cells_count;
+            return cell;
+        }
+
+        // epoch-based reclamation: an object which is replaced (retired) in the epoch e is freed in the epoch e + 2.
+        // The epoch e is advanced when the pins of the epoch e - 1 are released - the counters of its parity are zero (new pins go
+        // to the other parity, so they drain). Pins of the epoch e + 1 and later see the objects published before the advance to e + 1
+        class domain_t {
+            std::atomic<uint64_t> epoch;
+            char avoid_falsesharing[64 - sizeof(std::atomic<uint64_t>)];
+            mutable reader_cell_t reader_cells[reader_cells_count];
+
+            bool pins_released(uint64_t const parity) const {
+                for (auto const& cell : reader_cells)
+                    if (cell.readers[parity].load(std::memory_order_seq_cst) != 0) return false;
+                return true;
+            }
+
+        public:
+            domain_t() : epoch(0) {}
+
+            // the objects loaded after the pin aren't freed until unpin. The pin is counted in the counter of the epoch parity,
+            // the epoch is checked again after the increment - the pin belongs to the epoch which was current at the increment
+            class pin_t {
+                std::atomic<int> *counter;
+            public:
+                explicit pin_t(domain_t const& d) {
+                    reader_cell_t &cell = d.reader_cells[reader_cell()];
+                    for (;;) {
+                        uint64_t const e = d.epoch.load(std::memory_order_seq_cst);
+                        counter = &cell.readers[e & 1];
+                        counter->fetch_add(1, std::memory_order_seq_cst);
+                        if (d.epoch.load(std::memory_order_seq_cst) == e) break;
+                        counter->fetch_sub(1, std::memory_order_relaxed);
+                    }
+                }
+                pin_t(pin_t &&other) : counter(other.counter) { other.counter = nullptr; }
+                pin_t(pin_t const&) = delete;
+                ~pin_t() { if (counter) counter->fetch_sub(1, std::memory_order_release); }
+            };
+            pin_t pin() const { return pin_t(*this); }
+
+            // epoch of the object which is retired now: after the store which replaced it
+            uint64_t current() const { return epoch.load(std::memory_order_seq_cst); }
+
+            // by one thread at a time, doesn't wait: the epoch is advanced up to 2 times, objects retired in epochs <= result - 2
+            // can be freed
+            uint64_t advance() {
+                for (int advances = 0; advances < 2 && pins_released((epoch.load(std::memory_order_relaxed) + 1) & 1); ++advances)
+                    epoch.fetch_add(1, std::memory_order_seq_cst);
+                return epoch.load(std::memory_order_relaxed);
+            }
+        };
+
+        template<typename T>
+        struct retired_t { std::unique_ptr<T> ptr; uint64_t epoch; };     // epoch of the replacement
+
+        // frees the retired objects which no pin can see
+        template<typename T>
+        void reclaim(domain_t &domain, std::vector<retired_t<T>> &retired) {
+            uint64_t const epoch = domain.advance();
+            retired.erase(std::remove_if(retired.begin(), retired.end(), [&](retired_t<T> const& r) { return r.epoch + 2 <= epoch; }),
+                retired.end());
+        }
+    }
+    // ---------------------------------------------------------------
+
+    // safe partitioned map
+    // partition with boundary B contains keys (previous boundary, B], the last partition - all keys greater than previous boundary.
+    // Online repartitioning: rebalance() splits hot or oversized partitions and merges cold neighbours, by sampled per-partition
+    // counters of operations and lock waits. The directory of partitions is immutable and replaced atomically, point operations
+    // check after the lock that the partition still owns the key (else retry), range reads retry if the directory was replaced.
+    // Operations pin the directory in their reader cell (epoch-based reclamation), the replaced directory is freed by a later
+    // rebalance() when all its readers are finished.
+    template<typename key_t, typename val_t, template<class> class safe_ptr_t = default_safe_ptr,
+        typename container_t = std::map<key_t, val_t>, typename part_t = std::map<key_t, safe_ptr_t<container_t>> >
+    class safe_map_partitioned_t
+    {
+        using safe_container_t = safe_ptr_t<container_t>;
+        typedef typename part_t::iterator part_iterator;
+        typedef typename part_t::const_iterator const_part_iterator;
+        typedef counting_bloom_filter<key_t> filter_t;
+
+        struct part_stats_t {
+            std::atomic<uint64_t> ops, contended, wait_ticks;     // sampled
+            part_stats_t() : ops(0), contended(0), wait_ticks(0) {}
+        };
+
+        struct directory_t {
+            part_t part;
+            std::map<key_t, std::shared_ptr<part_stats_t>> stats;
+
+            // flat index for point operations, built once in publish(): cache-aligned sorted array of boundaries with
+            // branchless binary search, or one division for integral boundaries with a constant step
+            enum { cache_line_size = 64 };
+            std::unique_ptr<char[]> index_buf;
+            key_t *keys = nullptr;
+            size_t count = 0;
+            std::vector<safe_container_t *> containers;
+            std::vector<part_stats_t *> part_stats;
+            bool uniform = false;
+            uint64_t step = 0;
+
+            directory_t() {}
+            directory_t(directory_t const&) = delete;
+            ~directory_t() { for (size_t i = 0; i < count; ++i) keys[i].~key_t(); }
+
+            // after_key: the partition of the keys just greater than k (the next one if k is a boundary)
+            template<typename map_t> static auto find(map_t &m, key_t const& k, bool const after_key = false) -> decltype(m.begin()) {
+                auto it = (after_key) ? m.upper_bound(k) : m.lower_bound(k); if (it == m.end()) --it; return it;
+            }
+            safe_container_t& part_of(key_t const& k, bool const after_key = false) const { return *containers[index_of(k, after_key)]; }
+            part_stats_t& stats_of(key_t const& k, bool const after_key = false) const { return *part_stats[index_of(k, after_key)]; }
+            void add(key_t const& boundary, safe_container_t const& container) {
+                part.emplace(boundary, container);
+                stats.emplace(boundary, std::make_shared<part_stats_t>());
+            }
+
+            void build_index() {
+                index_buf.reset(new char[sizeof(key_t) * part.size() + cache_line_size]);
+                keys = reinterpret_cast<key_t *>(
+                    (reinterpret_cast<uintptr_t>(index_buf.get()) + cache_line_size - 1) & ~(uintptr_t)(cache_line_size - 1));
+                for (auto &i : part) {
+                    new (&keys[count++]) key_t(i.first);
+                    containers.push_back(&i.second);
+                    part_stats.push_back(stats.at(i.first).get());
+                }
+                uniform = check_uniform(std::is_integral<key_t>());
+            }
+
+            size_t index_of(key_t const& k, bool const after_key) const {
+                if (after_key) return search<true>(k);
+                return (uniform) ? uniform_index(k, std::is_integral<key_t>()) : search<false>(k);
+            }
+
+            // lower_bound (upper_bound if after_key) without branches in the loop - conditional moves, the last if not found
+            template<bool after_key> size_t search(key_t const& k) const {
+                key_t const *base = keys;
+                for (size_t n = count; n > 1; n -= n / 2)
+                    base = ((after_key) ? !(k < base[n / 2]) : (base[n / 2] < k)) ? base + n / 2 : base;
+                size_t const i = (base - keys) + ((after_key) ? !(k < *base) : (*base < k));
+                return (i < count) ? i : count - 1;
+            }
+
+            // boundaries b0 + i*step: the partition (b0 + (i-1)*step, b0 + i*step] is i = ceil((k - b0) / step)
+            bool check_uniform(std::true_type) {
+                if (count < 2 || !(keys[0] < keys[1])) return false;
+                step = (uint64_t)keys[1] - (uint64_t)keys[0];
+                for (size_t i = 2; i < count; ++i)
+                    if (!(keys[i - 1] < keys[i]) || (uint64_t)keys[i] - (uint64_t)keys[i - 1] != step) return false;
+                return true;
+            }
+            bool check_uniform(std::false_type) { return false; }
+            size_t uniform_index(key_t const& k, std::true_type) const {
+                if (!(keys[0] < k)) return 0;
+                uint64_t const i = ((uint64_t)k - (uint64_t)keys[0] - 1) / step + 1;
+                return (i < count) ? (size_t)i : count - 1;
+            }
+            size_t uniform_index(key_t const& k, std::false_type) const { return search<false>(k); }
+        };
+
+    public:
+        struct repartition_policy_t {
+            size_t max_partition_size = 0;      // split partition with more elements, 0 - unlimited
+            size_t min_partition_size = 1000;   // don't split hot partition with fewer elements
+            double hot_share = 2.0;             // split partition with sampled operations > hot_share * average
+            double min_contended_share = 0.0;   // ... and with share of contended locks (wait > contended_wait_ticks) above it
+            uint64_t contended_wait_ticks = 2000;
+            double cold_share = 0.25;           // merge neighbours with sampled operations < cold_share * average both
+            uint64_t min_sampled_ops = 256;     // don't judge hot/cold by fewer samples
+            size_t min_partitions = 1, max_partitions = 4096;
+        };
+
+    private:
+        enum { sample_rate = 16 };
+
+        typedef epoch_details::domain_t::pin_t pin_t;
+        typedef epoch_details::retired_t<directory_t> retired_t;
+
+        struct state_t {
+            std::atomic<directory_t *> directory;
+            std::unique_ptr<directory_t> current_dir;              // owner of *directory
+            std::vector<retired_t> retired;                         // replaced directories, freed by reclaim()
+            std::mutex rebalance_mtx;                               // one repartitioning or bulk write at a time
+            std::atomic<uint64_t> sampled_ops;
+            std::atomic<uint64_t> auto_rebalance_period;           // in sampled operations, 0 - disabled
+            std::atomic<uint64_t> contended_wait_ticks;            // of the policy - read by add_sample() without rebalance_mtx
+            repartition_policy_t policy;                            // under rebalance_mtx
+            std::unique_ptr<filter_t> filter;                       // negative filter of keys, set by enable_filter()
+            char avoid_falsesharing[64];
+            epoch_details::domain_t epochs;                         // pins of the directory, advanced by reclaim() under rebalance_mtx
+            state_t() : directory(nullptr), sampled_ops(0), auto_rebalance_period(0), contended_wait_ticks(repartition_policy_t().contended_wait_ticks) {}
+        };
+        std::shared_ptr<state_t> state;
+
+        static int& held_parts() { thread_local static int counter = 0; return counter; }    // partitions locked by this thread
+        static bool sample_now() { thread_local static unsigned counter = 0; return ++counter % sample_rate == 0; }
+
+        // the directory loaded after the pin isn't freed until unpin
+        pin_t pin() const { return state->epochs.pin(); }
+
+        directory_t * current() const { return state->directory.load(std::memory_order_seq_cst); }
+
+        // under rebalance_mtx or in constructor. The replaced directory is retired with the current epoch, it's freed by
+        // reclaim() - the caller can use it until then
+        void publish(std::unique_ptr<directory_t> &&new_dir) {
+            new_dir->build_index();
+            state->directory.store(new_dir.get(), std::memory_order_seq_cst);
+            if (state->current_dir) state->retired.push_back(retired_t{ std::move(state->current_dir), state->epochs.current() });
+            state->current_dir = std::move(new_dir);
+        }
+
+        // under rebalance_mtx, doesn't wait
+        void reclaim() { epoch_details::reclaim(state->epochs, state->retired); }
+
+        bool owns_key(directory_t *const dir, safe_container_t const& container, key_t const& k, bool const after_key) const {
+            directory_t *const cur_dir = current();
+            return cur_dir == dir || cur_dir->part_of(k, after_key).get_obj_ptr() == container.get_obj_ptr();
+        }
+
+        // the filter is one for the whole map, not per partition: split and merge move keys between partitions,
+        // but don't change the filter
+        filter_t * filter() const { return state->filter.get(); }
+
+        // the key is added to the filter before the insertion - lookups by the filter never miss it, removed again if not inserted
+        struct filter_insert_t {
+            filter_t *const filter;
+            uint64_t const hash;
+            filter_insert_t(filter_t *const f, key_t const& k) : filter(f), hash((f) ? filter_details::hash_of(k) : 0) {
+                if (filter) filter->add_hash(hash);
+            }
+            void done(bool const inserted) const { if (filter && !inserted) filter->remove_hash(hash); }
+        };
+        // after the erase, or before it under the X-lock of the partition: nobody sees the element while its key is removed
+        void filter_remove(key_t const& k, size_t const count = 1) const {
+            filter_t *const f = filter();
+            if (f) for (size_t i = 0; i < count; ++i) f->remove_hash(filter_details::hash_of(k));
+        }
+        template<typename it_t> void filter_remove(it_t first, it_t const last) const {
+            filter_t *const f = filter();
+            if (f) for (; first != last; ++first) f->remove_hash(filter_details::hash_of(first->first));
+        }
+
+    public:
+        // partition which owns key: S- or X-locked, checked after the lock (partition could be split or merged meanwhile)
+        template<typename lock_t>   // slocked_safe_ptr<safe_container_t> or xlocked_safe_ptr<safe_container_t>
+        class locked_part_t {
+            pin_t pin;      // the lock refers to the container in the directory
+            typename std::aligned_storage<sizeof(lock_t), alignof(lock_t)>::type storage;
+            bool owns;
+            lock_t& get() { return *reinterpret_cast<lock_t *>(&storage); }
+        public:
+            locked_part_t(safe_map_partitioned_t const& map, key_t const& k, bool const after_key = false) : pin(map.pin()), owns(true) {
+                bool const sample = sample_now();
+                uint64_t const start = sample ? adaptive_details::ticks() : 0;
+                directory_t *dir;
+                for (;;) {
+                    dir = map.current();
+                    safe_container_t const& container = dir->part_of(k, after_key);
+                    new (&storage) lock_t(container);
+                    if (map.owns_key(dir, container, k, after_key)) break;
+                    get().~lock_t();
+                }
+                ++held_parts();
+                if (sample) map.add_sample(*dir, k, after_key, adaptive_details::ticks() - start);
+            }
+            locked_part_t(locked_part_t &&other) : pin(std::move(other.pin)), owns(other.owns) {
+                if (!owns) return;
+                new (&storage) lock_t(std::move(other.get()));
+                other.get().~lock_t();
+                other.owns = false;
+            }
+            locked_part_t(locked_part_t const&) = delete;
+            ~locked_part_t() { if (owns) { get().~lock_t(); --held_parts(); } }
+            auto operator -> () -> decltype(std::declval<lock_t&>().operator->()) { return get().operator->(); }
+        };
+        typedef locked_part_t<slocked_safe_ptr<safe_container_t>> slocked_part_t;
+        typedef locked_part_t<xlocked_safe_ptr<safe_container_t>> xlocked_part_t;
+
+        typedef std::vector<std::pair<key_t, val_t>> result_vector_t;
+
+        safe_map_partitioned_t() : state(std::make_shared<state_t>()) {
+            std::unique_ptr<directory_t> dir(new directory_t());
+            dir->add(key_t(), container_t());
+            publish(std::move(dir));
+        }
+
+        safe_map_partitioned_t(const key_t start, const key_t end, const key_t step) : state(std::make_shared<state_t>()) {
+            std::unique_ptr<directory_t> dir(new directory_t());
+            for (key_t i = start; i <= end; i += step) dir->add(i, container_t());
+            publish(std::move(dir));
+        }
+
+        safe_map_partitioned_t(std::initializer_list<key_t> const& il) : state(std::make_shared<state_t>()) {
+            std::unique_ptr<directory_t> dir(new directory_t());
+            for (auto &i : il) dir->add(i, container_t());
+            publish(std::move(dir));
+        }
+
+        // not checked: the partition can be split or merged by rebalance() after return.
+        // The reference is valid until the directory is replaced by repartitioning or load_snapshot()
+        part_iterator part_it(key_t const& k) { return directory_t::find(current()->part, k); }
+        const_part_iterator part_it(key_t const& k) const { return directory_t::find(static_cast<part_t const&>(current()->part), k); }
+        safe_container_t& part(key_t const& k) { return current()->part_of(k); }
+        const safe_container_t& part(key_t const& k) const { return current()->part_of(k); }
+
+        slocked_part_t read_only_part(key_t const& k) const { return slocked_part_t(*this, k); }
+        xlocked_part_t write_part(key_t const& k) { return xlocked_part_t(*this, k); }
+
+        void get_range_equal(const key_t& key, result_vector_t &result_vec) const {
+            result_vec.clear();
+            auto slock_container = read_only_part(key);
+            for (auto it = slock_container->lower_bound(key); it != slock_container->upper_bound(key); ++it)
+                result_vec.emplace_back(*it);
+        }
+
+        void get_range_lower_upper(const key_t& low, const key_t& up, result_vector_t &result_vec) const {
+            result_vec.clear();
+            for_each_lower_upper(low, up, [&](key_t const& key, val_t const& val) { result_vec.emplace_back(key, val); return true; });
+        }
+
+        // streaming range scan [low, up] in the order of keys without copying: bool visitor(key_t const&, val_t const&) is called
+        // under one S-lock per partition, returns false to stop; limit - max number of visited elements (0 - unlimited).
+        // Each partition is consistent, the whole range isn't a snapshot. Returns number of visited elements.
+        // The visitor shouldn't lock partitions of this map (the lock of the partition is held).
+        template<typename visitor_t>
+        size_t for_each_lower_upper(const key_t& low, const key_t& up, visitor_t &&visitor, size_t const limit = 0) const {
+            return scan(low, false, up, visitor, limit);
+        }
+
+        // the same scan to the output iterator, *out_it++ = std::pair<key_t, val_t>(key, val); returns the iterator after the last
+        template<typename output_it_t>
+        output_it_t copy_lower_upper(const key_t& low, const key_t& up, output_it_t out_it, size_t const limit = 0) const {
+            for_each_lower_upper(low, up, [&](key_t const& key, val_t const& val) {
+                *out_it++ = std::pair<key_t, val_t>(key, val); return true; }, limit);
+            return out_it;
+        }
+
+        // parallel scan [low, up]: partitions of the range are distributed to the threads of parallel_details::thread_pool_t
+        // (the calling thread works too), each under its own S-lock. visitor(key_t const&, val_t const&) is called concurrently
+        // for different partitions, sequentially within a partition.
+        template<typename visitor_t>
+        void parallel_for_each(const key_t& low, const key_t& up, visitor_t &&visitor) const {
+            auto const ranges = split_range(low, up);
+            parallel_details::thread_pool_t::instance().run(ranges.size(), [&](size_t const i) {
+                scan(ranges[i].first, i != 0, ranges[i].second, [&](key_t const& key, val_t const& val) { visitor(key, val); return true; }, 0);
+            });
+        }
+
+        // parallel aggregation over [low, up]: result_t map_fn(key_t const&, val_t const&), result_t reduce_fn(result_t, result_t).
+        // reduce_fn should be associative - partial results of partitions are combined in the order of keys.
+        // Returns result_t() for the empty range.
+        template<typename map_fn_t, typename reduce_fn_t, typename result_t = typename std::decay<decltype(
+            std::declval<map_fn_t&>()(std::declval<key_t const&>(), std::declval<val_t const&>()))>::type>
+        result_t parallel_reduce(const key_t& low, const key_t& up, map_fn_t &&map_fn, reduce_fn_t &&reduce_fn) const {
+            auto const ranges = split_range(low, up);
+            std::vector<result_t> partial(ranges.size());
+            std::unique_ptr<bool[]> has_partial(new bool[ranges.size() + 1]());    // not std::vector<bool> - written concurrently
+            parallel_details::thread_pool_t::instance().run(ranges.size(), [&](size_t const i) {
+                scan(ranges[i].first, i != 0, ranges[i].second, [&](key_t const& key, val_t const& val) {
+                    if (has_partial[i]) partial[i] = reduce_fn(std::move(partial[i]), map_fn(key, val));
+                    else { partial[i] = map_fn(key, val); has_partial[i] = true; }
+                    return true;
+                }, 0);
+            });
+            result_t result = result_t();
+            bool has_result = false;
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                if (!has_partial[i]) continue;
+                result = (has_result) ? reduce_fn(std::move(result), std::move(partial[i])) : std::move(partial[i]);
+                has_result = true;
+            }
+            return result;
+        }
+
+        void erase_lower_upper(const key_t& low, const key_t& up) {
+            std::lock_guard<std::mutex> lock(state->rebalance_mtx);
+            auto &partition = current()->part;
+            auto end_it = (partition.upper_bound(up) == partition.end()) ? partition.end() : std::next(partition.upper_bound(up), 1);
+            for (auto it = directory_t::find(partition, low); it != end_it; ++it) {
+                auto x_container = xlock_safe_ptr(it->second);
+                auto const first = x_container->lower_bound(low), last = x_container->upper_bound(up);
+                filter_remove(first, last);
+                x_container->erase(first, last);
+            }
+        }
+
+        // incremental erase of [low, up] for large ranges: at most chunk_size elements under one X-lock of the partition,
+        // the lock is released between chunks - readers wait for one chunk, not for the whole range.
+        // bool progress(size_t erased) is called after each chunk without locks, returns false to stop.
+        // Elements inserted to the erased part of the range meanwhile stay. Returns number of erased elements.
+        template<typename progress_t>
+        size_t erase_lower_upper(const key_t& low, const key_t& up, size_t const chunk_size, progress_t &&progress) {
+            size_t erased = 0;
+            if (up < low) return erased;
+            key_t from = low;
+            node_details::deferred_destruction_t<container_t> deferred;     // the chunk is destroyed after the unlock
+            for (bool after_from = false;;) {
+                {
+                    xlocked_part_t xlock_container(*this, from, after_from);
+                    auto it = (after_from) ? xlock_container->upper_bound(from) : xlock_container->lower_bound(from);
+                    auto const first = it, end = xlock_container->upper_bound(up);
+                    size_t count = 0;
+                    for (; it != end && count < std::max<size_t>(chunk_size, 1); ++it) ++count;
+                    if (it == end) {    // the range of the locked partition can't be changed: next chunk from the next partition
+                        auto const& const_part = current()->part;
+                        auto const part_it = directory_t::find(const_part, from, after_from);
+                        if (std::next(part_it) == const_part.cend() || !(part_it->first < up)) {
+                            filter_remove(first, it);
+                            deferred.erase(*xlock_container.operator->(), first, it);
+                            return erased + count;
+                        }
+                        from = part_it->first;
+                    }
+                    else from = std::prev(it)->first;   // count > 0 - the next chunk after the last erased key
+                    after_from = true;
+                    filter_remove(first, it);
+                    deferred.erase(*xlock_container.operator->(), first, it);
+                    erased += count;
+                }
+                deferred.drain();
+                if (!progress(erased)) return erased;
+                std::this_thread::yield();      // waiting readers and writers get the partition
+            }
+        }
+
+        size_t erase_lower_upper(const key_t& low, const key_t& up, size_t const chunk_size) {
+            return erase_lower_upper(low, up, chunk_size, [](size_t) { return true; });
+        }
+
+        // arguments are forwarded: the key is constructed before the X-lock of its partition, the value - in place under it
+        template<typename K, typename... Args> void emplace(K &&key, Args &&...args) {
+            key_t k(std::forward<K>(key));
+            filter_insert_t const filter_insert(filter(), k);
+            bool inserted = true;
+            {
+                auto xlock_container = write_part(k);
+                size_t const old_size = xlock_container->size();
+                xlock_container->emplace(std::move(k), std::forward<Args>(args)...);
+                if (filter_insert.filter) inserted = xlock_container->size() != old_size;
+            }
+            filter_insert.done(inserted);
+            auto_rebalance();
+        }
+
+        // the value is constructed only if the key doesn't exist. Returns true if inserted
+        template<typename K, typename... Args> bool try_emplace(K &&key, Args &&...args) {
+            key_t k(std::forward<K>(key));
+            filter_insert_t const filter_insert(filter(), k);
+            bool const inserted = emplace_details::try_emplace(*write_part(k).operator->(), std::move(k), std::forward<Args>(args)...);
+            filter_insert.done(inserted);
+            auto_rebalance();
+            return inserted;
+        }
+
+        // the value is assigned if the key exists, else inserted. Returns true if inserted
+        template<typename K, typename V> bool insert_or_assign(K &&key, V &&val) {
+            key_t k(std::forward<K>(key));
+            filter_insert_t const filter_insert(filter(), k);
+            bool const inserted = emplace_details::insert_or_assign(*write_part(k).operator->(), std::move(k), std::forward<V>(val));
+            filter_insert.done(inserted);
+            auto_rebalance();
+            return inserted;
+        }
+
+        // the node is allocated and constructed before the X-lock of the partition, spliced in under it (node handle of C++17 map).
+        // Returns false if the key already exists - the prepared node is destroyed after the unlock
+        template<typename K, typename... Args> bool emplace_node(K &&key, Args &&...args) {
+            node_details::prepared_t<container_t> prepared(std::forward<K>(key), std::forward<Args>(args)...);
+            filter_insert_t const filter_insert(filter(), prepared.key());
+            bool const inserted = prepared.insert(*write_part(prepared.key()).operator->());
+            filter_insert.done(inserted);
+            auto_rebalance();
+            return inserted;
+        }
+
+        // the node is extracted under the X-lock of the partition, the value is destroyed and the node is freed after the unlock
+        size_t erase_deferred(key_t const& key) {
+            node_details::deferred_destruction_t<container_t> deferred;
+            size_t erased;
+            {
+                auto xlock_container = write_part(key);
+                auto const range = xlock_container->equal_range(key);
+                erased = std::distance(range.first, range.second);
+                deferred.erase(*xlock_container.operator->(), range.first, range.second);
+            }
+            filter_remove(key, erased);
+            auto_rebalance();
+            return erased;
+        }
+
+        // batch of keys (50 - 500): grouped by partitions and sorted, one S-lock per partition instead of one per key.
+        // *out_it++ = std::pair<key_t, val_t>(key, val) for found keys (repeated keys - repeatedly) sorted by key, not in the order
+        // of the input; returns the iterator after the last
+        template<typename key_it_t, typename output_it_t>
+        output_it_t multi_get(key_it_t first, key_it_t last, output_it_t out_it) const {
+            for_each_batch<slocked_safe_ptr<safe_container_t>>(first, last, [&](key_t const& key, container_t const& container) {
+                auto const it = container.find(key);
+                if (it != container.end()) *out_it++ = std::pair<key_t, val_t>(it->first, it->second);
+            });
+            return out_it;
+        }
+
+        // the same batch with one X-lock per partition: fn(key_t const&, container_t &) for each key, e.g. find, emplace or erase
+        // of this key in the container of its partition. fn() shouldn't lock partitions of this map.
+        // With the filter fn() should change only elements of its key: they are counted before and after fn() under the X-lock
+        template<typename key_it_t, typename fn_t>
+        void multi_apply(key_it_t first, key_it_t last, fn_t &&fn) {
+            filter_t *const f = filter();
+            if (!f) for_each_batch<xlocked_safe_ptr<safe_container_t>>(first, last, fn);
+            else for_each_batch<xlocked_safe_ptr<safe_container_t>>(first, last, [&](key_t const& key, container_t &container) {
+                size_t const old_count = container.count(key);
+                fn(key, container);
+                size_t const new_count = container.count(key);
+                for (size_t i = old_count; i < new_count; ++i) f->add_hash(filter_details::hash_of(key));
+                if (new_count < old_count) filter_remove(key, old_count - new_count);
+            });
+            auto_rebalance();
+        }
+
+        // bulk load of pairs (key, value), sorted or not: grouped by partitions, the partitions are filled in parallel by
+        // parallel_details::thread_pool_t - one X-lock per partition, sorted insertion with hint. Existing keys aren't replaced.
+        // threads_count - max threads (0 - all CPU cores). Returns number of inserted elements.
+        template<typename it_t>
+        size_t bulk_load(it_t first, it_t last, size_t const threads_count = 0) {
+            std::lock_guard<std::mutex> lock(state->rebalance_mtx);    // partitions can't be split or merged meanwhile
+            directory_t *const dir = current();
+            std::vector<std::vector<it_t>> groups(dir->count);
+            for (; first != last; ++first) groups[dir->index_of((*first).first, false)].push_back(first);
+            std::atomic<size_t> inserted(0);
+            parallel_details::thread_pool_t::instance().run(groups.size(), [&](size_t const i) {
+                if (groups[i].empty()) return;
+                bulk_details::sort_items<typename container_t::key_compare>(groups[i]);
+                auto x_container = xlock_safe_ptr(*dir->containers[i]);
+                if (filter_t *const f = filter())   // under the X-lock: the new keys aren't visible yet
+                    for (auto &it : groups[i]) if (x_container->count((*it).first) == 0) f->add_hash(filter_details::hash_of((*it).first));
+                inserted += bulk_details::insert_sorted(*x_container.operator->(), groups[i]);
+            }, threads_count);
+            return inserted;
+        }
+
+        // snapshot to the file: partitions one after another, each copied under its S-lock and written after unlock -
+        // each partition is consistent, the whole map isn't (as for_each_lower_upper()). key_t and val_t - trivially copyable.
+        // Throws std::runtime_error on I/O error. Returns number of rows.
+        size_t save_snapshot(std::string const& file_name) const {
+            static_assert(std::is_trivially_copyable<key_t>::value && std::is_trivially_copyable<val_t>::value,
+                "snapshot requires trivially copyable key_t and val_t");
+            size_t const row_size = sizeof(key_t) + sizeof(val_t);
+            std::unique_ptr<std::FILE, int(*)(std::FILE *)> file(std::fopen(file_name.c_str(), "wb"), &std::fclose);
+            if (!file) throw std::runtime_error("can't create snapshot file " + file_name);
+            auto const write = [&](void const* ptr, size_t const size) {
+                if (size != 0 && std::fwrite(ptr, 1, size, file.get()) != size) throw std::runtime_error("can't write snapshot file " + file_name);
+            };
+
+            std::lock_guard<std::mutex> lock(state->rebalance_mtx);    // partitions can't be split or merged meanwhile
+            directory_t const& dir = *current();
+            snapshot_details::header_t header;
+            std::memcpy(header.magic, snapshot_details::magic, sizeof(header.magic));
+            header.key_size = sizeof(key_t);
+            header.val_size = sizeof(val_t);
+            header.partitions_count = dir.count;
+            write(&header, sizeof(header));
+
+            size_t rows_count = 0;
+            std::vector<char> buf;
+            for (size_t i = 0; i < dir.count; ++i) {
+                {
+                    auto s_container = slock_safe_ptr(*dir.containers[i]);
+                    uint64_t const count = s_container->size();
+                    buf.resize(sizeof(key_t) + sizeof(count) + count * row_size);
+                    char *ptr = buf.data();
+                    std::memcpy(ptr, &dir.keys[i], sizeof(key_t)); ptr += sizeof(key_t);
+                    std::memcpy(ptr, &count, sizeof(count)); ptr += sizeof(count);
+                    for (auto it = s_container->cbegin(); it != s_container->cend(); ++it) {
+                        std::memcpy(ptr, &it->first, sizeof(key_t)); ptr += sizeof(key_t);
+                        std::memcpy(ptr, &it->second, sizeof(val_t)); ptr += sizeof(val_t);
+                    }
+                    rows_count += count;
+                }
+                write(buf.data(), buf.size());
+            }
+            if (std::fflush(file.get()) != 0) throw std::runtime_error("can't write snapshot file " + file_name);
+            return rows_count;
+        }
+
+        // replaces the content and the partitions of the map by the snapshot: the file is mapped to memory, partitions are
+        // built in parallel by parallel_details::thread_pool_t (sorted rows - insertion with hint end()) and published at once,
+        // the replaced partitions are emptied under their X-locks. threads_count - max threads (0 - all CPU cores).
+        // Throws std::runtime_error if the file is wrong: boundaries not ascending, rows not ascending or out of the range
+        // of their partition, extra bytes after the last partition - the map isn't changed then. Returns number of rows.
+        size_t load_snapshot(std::string const& file_name, size_t const threads_count = 0) {
+            static_assert(std::is_trivially_copyable<key_t>::value && std::is_trivially_copyable<val_t>::value,
+                "snapshot requires trivially copyable key_t and val_t");
+            size_t const row_size = sizeof(key_t) + sizeof(val_t);
+            snapshot_details::mapped_file_t const file(file_name);
+            auto const wrong_file = [&]() { return std::runtime_error("wrong snapshot file " + file_name); };
+            char const* ptr = file.data();
+            char const* const end = file.data() + file.size();
+
+            snapshot_details::header_t header;
+            if (file.size() < sizeof(header)) throw wrong_file();
+            std::memcpy(&header, ptr, sizeof(header)); ptr += sizeof(header);
+            if (std::memcmp(header.magic, snapshot_details::magic, sizeof(header.magic)) != 0 || header.key_size != sizeof(key_t) ||
+                header.val_size != sizeof(val_t) || header.partitions_count == 0) throw wrong_file();
+
+            struct part_file_t { key_t boundary; uint64_t count; char const* rows; };
+            std::vector<part_file_t> parts_file;
+            size_t rows_count = 0;
+            for (uint64_t i = 0; i < header.partitions_count; ++i) {
+                part_file_t part_file;
+                if ((size_t)(end - ptr) < sizeof(key_t) + sizeof(part_file.count)) throw wrong_file();
+                std::memcpy(&part_file.boundary, ptr, sizeof(key_t)); ptr += sizeof(key_t);
+                std::memcpy(&part_file.count, ptr, sizeof(part_file.count)); ptr += sizeof(part_file.count);
+                if ((uint64_t)(end - ptr) / row_size < part_file.count) throw wrong_file();
+                part_file.rows = ptr;
+                ptr += part_file.count * row_size;
+                rows_count += part_file.count;
+                if (!parts_file.empty() && !(parts_file.back().boundary < part_file.boundary)) throw wrong_file();
+                parts_file.push_back(part_file);
+            }
+            if (ptr != end) throw wrong_file();
+
+            // partition i owns keys (boundary i-1, boundary i], the last one - all keys greater than the previous boundary
+            std::vector<safe_container_t> containers(parts_file.size());    // not shared yet - filled without locks
+            std::atomic<bool> wrong_rows(false);
+            typename container_t::key_compare const comp = typename container_t::key_compare();
+            parallel_details::thread_pool_t::instance().run(parts_file.size(), [&](size_t const i) {
+                container_t &container = *containers[i].get_obj_ptr();
+                bool const last_part = (i + 1 == parts_file.size());
+                char const* row = parts_file[i].rows;
+                for (uint64_t k = 0; k < parts_file[i].count; ++k, row += row_size) {
+                    key_t key;
+                    val_t val;
+                    std::memcpy(&key, row, sizeof(key_t));
+                    std::memcpy(&val, row + sizeof(key_t), sizeof(val_t));
+                    if ((i > 0 && !(parts_file[i - 1].boundary < key)) || (!last_part && parts_file[i].boundary < key) ||
+                        (!container.empty() && !comp(std::prev(container.end())->first, key))) { wrong_rows = true; return; }
+                    container.emplace_hint(container.end(), key, val);
+                }
+            }, threads_count);
+            if (wrong_rows) throw wrong_file();
+            if (filter_t *const f = filter()) {
+                parallel_details::thread_pool_t::instance().run(containers.size(), [&](size_t const i) {
+                    for (auto const& element : *containers[i].get_obj_ptr()) f->add_hash(filter_details::hash_of(element.first));
+                }, threads_count);
+            }
+
+            std::unique_ptr<directory_t> dir(new directory_t());
+            for (size_t i = 0; i < parts_file.size(); ++i) dir->add(parts_file[i].boundary, containers[i]);
+            std::lock_guard<std::mutex> lock(state->rebalance_mtx);
+            directory_t *const old_dir = current();
+            publish(std::move(dir));
+            // late callers which locked a replaced partition see the new directory after the lock and go there. Keys of
+            // the replaced partitions are removed from the filter after the new ones are published, elements are destroyed after unlock
+            parallel_details::thread_pool_t::instance().run(old_dir->count, [&](size_t const i) {
+                container_t old_container;
+                {
+                    auto x_container = xlock_safe_ptr(*old_dir->containers[i]);
+                    filter_remove(x_container->cbegin(), x_container->cend());
+                    old_container.swap(*x_container.operator->());
+                }
+            }, threads_count);
+            reclaim();
+            return rows_count;
+        }
+
+        size_t size() const {
+            pin_t const pinned = pin();
+            for (directory_t *dir = current();; dir = current()) {
+                size_t size = 0;
+                for (auto it = dir->part.begin(); it != dir->part.end(); ++it) size += it->second->size();
+                if (current() == dir) return size;
+            }
+        }
+        size_t erase(key_t const& key) throw() {
+            if (!may_contain(key)) return 0;
+            size_t const erased = write_part(key)->erase(key);
+            filter_remove(key, erased);
+            auto_rebalance();
+            return erased;
+        }
+        void clear() {
+            std::lock_guard<std::mutex> lock(state->rebalance_mtx);
+            auto &partition = current()->part;
+            for (auto it = partition.begin(); it != partition.end(); ++it) {
+                auto x_container = xlock_safe_ptr(it->second);
+                filter_remove(x_container->cbegin(), x_container->cend());
+                x_container->clear();
+            }
+        }
+
+        // counting_bloom_filter<> of all keys: find(), count() and erase() of absent keys return without locks and without
+        // the search in the partition. Isn't thread-safe: call it before concurrent operations. With the filter, elements
+        // are inserted and erased only by methods of the map, not through write_part()
+        void enable_filter(size_t const expected_elements) {
+            static_assert(filter_details::is_hashable<key_t>::value, "the filter requires std::hash<key_t>");
+            std::unique_ptr<filter_t> f(new filter_t(expected_elements));
+            pin_t const pinned = pin();
+            auto &partition = current()->part;
+            for (auto it = partition.begin(); it != partition.end(); ++it) {
+                auto s_container = slock_safe_ptr(it->second);
+                for (auto const& element : *s_container.operator->()) f->add_hash(filter_details::hash_of(element.first));
+            }
+            state->filter = std::move(f);
+        }
+        bool filter_enabled() const { return filter() != nullptr; }
+
+        // false - the key is definitely absent (true without the filter)
+        bool may_contain(key_t const& key) const {
+            filter_t *const f = filter();
+            return !f || f->may_contain_hash(filter_details::hash_of(key));
+        }
+
+        // the value is copied under the S-lock of the partition
+        bool find(key_t const& key, val_t &val) const {
+            if (!may_contain(key)) return false;
+            auto slock_container = read_only_part(key);
+            auto const it = slock_container->find(key);
+            if (it == slock_container->end()) return false;
+            val = it->second;
+            return true;
+        }
+        size_t count(key_t const& key) const {
+            if (!may_contain(key)) return 0;
+            return read_only_part(key)->count(key);
+        }
+
+        size_t partitions_count() const { pin_t const pinned = pin(); return current()->part.size(); }
+
+        void set_repartition_policy(repartition_policy_t const& policy) {
+            std::lock_guard<std::mutex> lock(state->rebalance_mtx);
+            state->policy = policy;
+            state->contended_wait_ticks.store(policy.contended_wait_ticks, std::memory_order_relaxed);
+        }
+
+        // emplace() and erase() call rebalance() after each sampled_ops_period sampled operations (1 of 16 is sampled), 0 - disabled
+        // An exception of the automatic rebalance() isn't thrown by the operation: the rebalance is skipped until the next period
+        void set_auto_rebalance(uint64_t const sampled_ops_period) { state->auto_rebalance_period.store(sampled_ops_period); }
+
+        // returns number of splits and merges. Don't call it while this thread holds a partition locked.
+        // Replaced directories are freed by the next rebalance() after the operations which use them are finished.
+        size_t rebalance() {
+            std::lock_guard<std::mutex> lock(state->rebalance_mtx);
+            return rebalance_locked();
+        }
+
+    private:
+        // keys sorted by (partition, key); each group under one lock, the mutex of the next group is prefetched meanwhile.
+        // Grouping is by the directory before the locks - if the partition was split since, the rest of the group is locked again
+        template<typename lock_t, typename key_it_t, typename fn_t>
+        void for_each_batch(key_it_t first, key_it_t last, fn_t &&fn) const {
+            pin_t const pinned = pin();
+            directory_t *const dir = current();
+            std::vector<std::pair<size_t, key_t>> batch;
+            for (; first != last; ++first) batch.emplace_back(dir->index_of(*first, false), *first);
+            typename container_t::key_compare comp;
+            std::sort(batch.begin(), batch.end(), [&](std::pair<size_t, key_t> const& a, std::pair<size_t, key_t> const& b) {
+                return a.first < b.first || (a.first == b.first && comp(a.second, b.second)); });
+
+            for (size_t i = 0; i < batch.size();) {
+                size_t next_group = i;
+                while (next_group < batch.size() && batch[next_group].first == batch[i].first) ++next_group;
+                if (next_group < batch.size()) {
+                    adaptive_details::prefetch(dir->containers[batch[next_group].first]->get_mtx_ptr());
+                    adaptive_details::prefetch(dir->containers[batch[next_group].first]->get_obj_ptr());
+                }
+                locked_part_t<lock_t> locked(*this, batch[i].second);
+                auto &container = *locked.operator->();
+                bool const same_dir = (current() == dir);   // the locked partition owns the whole group
+                for (; i < next_group; ++i) {
+                    key_t const& key = batch[i].second;
+                    if (!same_dir && current()->part_of(key).get_obj_ptr() != &container) break;
+                    fn(key, container);
+                }
+            }
+        }
+
+        // scan of keys from 'from' (or after it) to 'up' - one partition after another by their boundaries
+        template<typename visitor_t>
+        size_t scan(key_t from, bool after_from, const key_t& up, visitor_t &&visitor, size_t const limit) const {
+            size_t count = 0;
+            if (up < from) return count;
+            for (;; after_from = true) {    // the first partition - keys >= low (or > low), next ones - keys > previous boundary
+                slocked_part_t slock_container(*this, from, after_from);
+                auto it = (after_from) ? slock_container->upper_bound(from) : slock_container->lower_bound(from);
+                for (auto const end = slock_container->upper_bound(up); it != end; ++it) {
+                    if (limit != 0 && count == limit) return count;
+                    ++count;
+                    if (!visitor(it->first, it->second)) return count;
+                }
+                // the range of the locked partition can't be changed: split and merge need its X-lock
+                auto const& const_part = current()->part;
+                auto const part_it = directory_t::find(const_part, from, after_from);
+                if (std::next(part_it) == const_part.cend() || !(part_it->first < up)) return count;
+                from = part_it->first;
+            }
+        }
+
+        // [low, B0], (B0, B1], ..., (Bn, up] - by the partitions overlapping [low, up] now, later splits and merges inside don't matter
+        std::vector<std::pair<key_t, key_t>> split_range(const key_t& low, const key_t& up) const {
+            std::vector<std::pair<key_t, key_t>> ranges;
+            if (up < low) return ranges;
+            pin_t const pinned = pin();
+            auto const& const_part = current()->part;
+            key_t from = low;
+            for (auto it = directory_t::find(const_part, low);; ++it) {
+                bool const last = std::next(it) == const_part.cend() || !(it->first < up);
+                ranges.emplace_back(from, (last) ? up : it->first);
+                if (last) return ranges;
+                from = it->first;
+            }
+        }
+
+        void add_sample(directory_t &dir, key_t const& k, bool const after_key, uint64_t const wait_ticks) const {
+            part_stats_t &stats = dir.stats_of(k, after_key);
+            stats.ops.fetch_add(1, std::memory_order_relaxed);
+            stats.wait_ticks.fetch_add(wait_ticks, std::memory_order_relaxed);
+            if (wait_ticks > state->contended_wait_ticks.load(std::memory_order_relaxed)) stats.contended.fetch_add(1, std::memory_order_relaxed);
+            state->sampled_ops.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void auto_rebalance() {
+            uint64_t const period = state->auto_rebalance_period.load(std::memory_order_relaxed);
+            if (period == 0 || held_parts() != 0 || state->sampled_ops.load(std::memory_order_relaxed) < period) return;
+            std::unique_lock<std::mutex> lock(state->rebalance_mtx, std::try_to_lock);
+            if (!lock.owns_lock() || state->sampled_ops.load(std::memory_order_relaxed) < period) return;
+            // the operation is already done (erase() is throw()): a failed repartitioning only skips this round
+            try { rebalance_locked(); }
+            catch (...) {}
+        }
+
+        struct part_info_t { key_t boundary; safe_container_t container; uint64_t ops, contended; size_t size; };
+
+        size_t rebalance_locked() {
+            repartition_policy_t const& policy = state->policy;
+            state->sampled_ops.store(0, std::memory_order_relaxed);
+
+            std::vector<part_info_t> parts;
+            uint64_t total_ops = 0;
+            directory_t *const dir = current();
+            for (auto &i : dir->part) {
+                part_stats_t &stats = *dir->stats.at(i.first);
+                parts.push_back(part_info_t{ i.first, i.second, stats.ops.exchange(0), stats.contended.exchange(0), i.second->size() });
+                total_ops += parts.back().ops;
+            }
+            bool const enough_samples = total_ops >= policy.min_sampled_ops;
+            double const average_ops = (double)total_ops / parts.size();
+            size_t changes = 0, count = parts.size();
+
+            for (auto &i : parts) {
+                bool const hot = enough_samples && i.size >= policy.min_partition_size && i.ops > policy.hot_share * average_ops &&
+                    i.contended >= policy.min_contended_share * i.ops;
+                bool const oversized = policy.max_partition_size > 0 && i.size > policy.max_partition_size;
+                if ((hot || oversized) && count < policy.max_partitions && split(i.container)) { ++changes; ++count; }
+            }
+
+            if (enough_samples) {
+                for (size_t i = 0; i + 1 < parts.size() && count > policy.min_partitions; ++i) {
+                    auto &cold = parts[i], &next = parts[i + 1];
+                    bool const both_cold = cold.ops < policy.cold_share * average_ops && next.ops < policy.cold_share * average_ops;
+                    bool const fits = policy.max_partition_size == 0 || cold.size + next.size <= policy.max_partition_size / 2;
+                    if (both_cold && fits && merge(cold.container, next.container)) { ++changes; --count; ++i; }
+                }
+            }
+            reclaim();
+            return changes;
+        }
+
+        const_part_iterator find_container(directory_t const& dir, safe_container_t const& container) const {
+            for (auto it = dir.part.cbegin(); it != dir.part.cend(); ++it)
+                if (it->second.get_obj_ptr() == container.get_obj_ptr()) return it;
+            return dir.part.cend();
+        }
+
+        std::unique_ptr<directory_t> copy_directory(directory_t const& dir) {
+            std::unique_ptr<directory_t> new_dir(new directory_t());
+            new_dir->part = dir.part;       // copies of safe_ptr - the same partitions
+            new_dir->stats = dir.stats;
+            return new_dir;
+        }
+
+        // lower half of the partition goes to the new partition
+        bool split(safe_container_t &container) {
+            directory_t const& dir = *current();
+            auto const part_it = find_container(dir, container);
+            if (part_it == dir.part.cend()) return false;
+            bool const last_part = (std::next(part_it) == dir.part.cend());
+
+            auto x_container = xlock_safe_ptr(container);
+            container_t &src = *x_container.operator->();
+            if (src.size() < 2) return false;
+            auto const upper_begin = std::next(src.begin(), src.size() / 2);
+            key_t const new_boundary = std::prev(upper_begin)->first;
+            // the last partition owns all greater keys - its boundary is moved after the new one if needed
+            key_t const old_boundary = (last_part && !(new_boundary < part_it->first)) ? upper_begin->first : part_it->first;
+
+            safe_container_t lower;
+            {
+                auto x_lower = xlock_safe_ptr(lower);
+                x_lower->insert(std::make_move_iterator(src.begin()), std::make_move_iterator(upper_begin));
+            }
+            src.erase(src.begin(), upper_begin);
+
+            std::unique_ptr<directory_t> new_dir = copy_directory(dir);
+            new_dir->part.erase(part_it->first);
+            new_dir->stats.erase(part_it->first);
+            new_dir->add(old_boundary, container);
+            new_dir->add(new_boundary, lower);
+            publish(std::move(new_dir));    // before unlock: who locks the partition after us - sees the new directory
+            return true;
+        }
+
+        // the partition goes to the next one: the next one owns its range
+        bool merge(safe_container_t &container, safe_container_t &next_container) {
+            directory_t const& dir = *current();
+            auto const part_it = find_container(dir, container);
+            if (part_it == dir.part.cend() || std::next(part_it) == dir.part.cend() ||
+                std::next(part_it)->second.get_obj_ptr() != next_container.get_obj_ptr()) return false;
+
+            auto x_container = xlock_safe_ptr(container);
+            if (!next_container.get_mtx_ptr()->try_lock()) return false;     // other thread can hold it and wait for the first
+            std::lock_guard<typename safe_container_t::mtx_t> next_lock(*next_container.get_mtx_ptr(), std::adopt_lock);
+            container_t &src = *x_container.operator->();
+            next_container.get_obj_ptr()->insert(std::make_move_iterator(src.begin()), std::make_move_iterator(src.end()));
+            src.clear();
+
+            std::unique_ptr<directory_t> new_dir = copy_directory(dir);
+            new_dir->part.erase(part_it->first);
+            new_dir->stats.erase(part_it->first);
+            publish(std::move(new_dir));
+            return true;
+        }
+    };
+    // ---------------------------------------------------------------
+
+    // safe unordered partitioned map (hash stripes) - for point operations only, without ranges of keys:
+    // power-of-two number of stripes, the stripe is selected by the high bits of the mixed hash without any directory,
+    // the lower bits are left for buckets of the container. Locks of stripes are in one block - each in its own cache line.
+    template<typename key_t, typename val_t, template<class> class safe_ptr_t = default_safe_ptr,
+        typename hash_t = std::hash<key_t>, typename container_t = std::unordered_map<key_t, val_t, hash_t> >
+    class safe_unordered_map_partitioned_t
+    {
+        using safe_container_t = safe_ptr_t<container_t>;
+        using mutex_t = typename safe_container_t::mtx_t;
+        enum { cache_line_size = 64 };
+        struct alignas(cache_line_size) padded_mutex_t { mutex_t mtx; };
+
+        std::vector<safe_container_t> stripes;
+        unsigned stripe_bits;
+        hash_t hasher;
+
+        static unsigned bits_for(size_t const count) { unsigned bits = 0; while (((size_t)1 << bits) < count) ++bits; return bits; }
+
+        // replaces the mutexes of the stripes (as link_safe_ptrs does) by cache-line aligned mutexes of one block
+        void align_mutexes() {
+            size_t const count = stripes.size();
+            char *const raw = new char[sizeof(padded_mutex_t) * count + cache_line_size];
+            padded_mutex_t *const block = reinterpret_cast<padded_mutex_t *>(
+                (reinterpret_cast<uintptr_t>(raw) + cache_line_size - 1) & ~(uintptr_t)(cache_line_size - 1));
+            for (size_t i = 0; i < count; ++i) new (&block[i]) padded_mutex_t();
+            std::shared_ptr<padded_mutex_t> owner(block, [raw, count](padded_mutex_t *p) {
+                for (size_t i = 0; i < count; ++i) p[i].~padded_mutex_t();
+                delete[] raw;
+            });
+            for (size_t i = 0; i < count; ++i) stripes[i].mtx_ptr = std::shared_ptr<mutex_t>(owner, &block[i].mtx);
+        }
+
+    public:
+        typedef std::vector<std::pair<key_t, val_t>> result_vector_t;
+
+        // stripes_count is rounded up to a power of two
+        explicit safe_unordered_map_partitioned_t(size_t const stripes_count = 64) : stripe_bits(bits_for(std::max<size_t>(stripes_count, 1))) {
+            for (size_t i = 0; i < ((size_t)1 << stripe_bits); ++i) stripes.emplace_back(container_t());
+            align_mutexes();
+        }
+
+        size_t stripe_index(key_t const& k) const {
+            uint64_t const h = (uint64_t)hasher(k) * 0x9E3779B97F4A7C15ULL;    // Fibonacci hashing: std::hash<int> is identity
+            return (stripe_bits == 0) ? 0 : (size_t)(h >> (64 - stripe_bits));
+        }
+
+        safe_container_t& part(key_t const& k) { return stripes[stripe_index(k)]; }
+        const safe_container_t& part(key_t const& k) const { return stripes[stripe_index(k)]; }
+
+        slocked_safe_ptr<safe_container_t> read_only_part(key_t const& k) const { return slock_safe_ptr(part(k)); }
+        xlocked_safe_ptr<safe_container_t> write_part(key_t const& k) { return xlock_safe_ptr(part(k)); }
+
+        void get_range_equal(const key_t& key, result_vector_t &result_vec) const {
+            result_vec.clear();
+            auto slock_container = read_only_part(key);
+            auto range = slock_container->equal_range(key);
+            for (auto it = range.first; it != range.second; ++it) result_vec.emplace_back(*it);
+        }
+
+        // arguments are forwarded: the key is constructed before the X-lock of its stripe, the value - in place under it
+        template<typename K, typename... Args> void emplace(K &&key, Args &&...args) {
+            key_t k(std::forward<K>(key));
+            write_part(k)->emplace(std::move(k), std::forward<Args>(args)...);
+        }
+
+        // the value is constructed only if the key doesn't exist. Returns true if inserted
+        template<typename K, typename... Args> bool try_emplace(K &&key, Args &&...args) {
+            key_t k(std::forward<K>(key));
+            return emplace_details::try_emplace(*write_part(k).operator->(), std::move(k), std::forward<Args>(args)...);
+        }
+
+        // the value is assigned if the key exists, else inserted. Returns true if inserted
+        template<typename K, typename V> bool insert_or_assign(K &&key, V &&val) {
+            key_t k(std::forward<K>(key));
+            return emplace_details::insert_or_assign(*write_part(k).operator->(), std::move(k), std::forward<V>(val));
+        }
+
+        // bulk load of pairs (key, value): grouped by stripes, the stripes are filled in parallel - one X-lock per stripe,
+        // buckets are reserved once. Existing keys aren't replaced. Returns number of inserted elements.
+        template<typename it_t>
+        size_t bulk_load(it_t first, it_t last, size_t const threads_count = 0) {
+            std::vector<std::vector<it_t>> groups(stripes.size());
+            for (; first != last; ++first) groups[stripe_index((*first).first)].push_back(first);
+            std::atomic<size_t> inserted(0);
+            parallel_details::thread_pool_t::instance().run(groups.size(), [&](size_t const i) {
+                if (groups[i].empty()) return;
+                auto x_container = xlock_safe_ptr(stripes[i]);
+                container_t &container = *x_container.operator->();
+                size_t const old_size = container.size();
+                container.reserve(old_size + groups[i].size());
+                for (auto &it : groups[i]) {
+                    auto &&element = *it;
+                    container.emplace(std::forward<decltype(element)>(element).first, std::forward<decltype(element)>(element).second);
+                }
+                inserted += container.size() - old_size;
+            }, threads_count);
+            return inserted;
+        }
+
+        size_t erase(key_t const& key) throw() { return write_part(key)->erase(key); }
+
+        size_t size() const {
+            size_t size = 0;
+            for (auto &i : stripes) size += i->size();
+            return size;
+        }
+        void clear() { for (auto &i : stripes) i->clear(); }
+
+        size_t partitions_count() const { return stripes.size(); }
+    };
+    // ---------------------------------------------------------------
+
+    namespace columnar_details {
+        // result of one pass over a range of rows: sum, min, max and count of the values which passed the filter
+        template<typename value_t>
+        struct aggregate_t {
+            typedef typename std::conditional<std::is_floating_point<value_t>::value, double,
+                typename std::conditional<std::is_signed<value_t>::value, int64_t, uint64_t>::type>::type sum_t;
+            sum_t sum;
+            value_t min, max;
+            size_t count;
+            aggregate_t() : sum(0), min(std::numeric_limits<value_t>::max()), max(std::numeric_limits<value_t>::lowest()), count(0) {}
+            void merge(aggregate_t const& other) {
+                sum += other.sum;
+                min = std::min(min, other.min);
+                max = std::max(max, other.max);
+                count += other.count;
+            }
+            double average() const { return (count) ? (double)sum / count : 0; }
+        };
+
+        // values[i] are aggregated if low <= filter[i] <= high - branch-free, so compilers can vectorize it
+        template<typename value_t>
+        void aggregate(value_t const *values, value_t const *filter, value_t const low, value_t const high, size_t const n,
+            aggregate_t<value_t> &result)
+        {
+            typename aggregate_t<value_t>::sum_t sum = 0;
+            value_t min = result.min, max = result.max;
+            size_t count = 0;
+            for (size_t i = 0; i < n; ++i) {
+                bool const pass = !(filter[i] < low) & !(high < filter[i]);
+                value_t const v = values[i];
+                sum += (pass) ? v : value_t(0);
+                min = (pass && v < min) ? v : min;
+                max = (pass && max < v) ? v : max;
+                count += pass;
+            }
+            result.sum += sum; result.min = min; result.max = max; result.count += count;
+        }
+
+#ifdef SIMD_SSE2
+        // 4 int32 values per step: mask of the filter, sum in 2 int64 lanes, min/max by compare and blend (SSE2 has no pminsd)
+        inline void aggregate(int32_t const *values, int32_t const *filter, int32_t const low, int32_t const high, size_t const n,
+            aggregate_t<int32_t> &result)
+        {
+            __m128i const low4 = _mm_set1_epi32(low), high4 = _mm_set1_epi32(high), ones4 = _mm_set1_epi32(-1);
+            __m128i const max_value4 = _mm_set1_epi32(std::numeric_limits<int32_t>::max());
+            __m128i const min_value4 = _mm_set1_epi32(std::numeric_limits<int32_t>::min());
+            __m128i sum2 = _mm_setzero_si128(), count4 = _mm_setzero_si128(), min4 = _mm_set1_epi32(result.min), max4 = _mm_set1_epi32(result.max);
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                __m128i const f4 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(filter + i));
+                __m128i const v4 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(values + i));
+                __m128i const mask = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi32(f4, low4), _mm_cmpgt_epi32(f4, high4)), ones4);
+                count4 = _mm_sub_epi32(count4, mask);
+                __m128i const masked = _mm_and_si128(v4, mask);
+                __m128i const sign = _mm_srai_epi32(masked, 31);
+                sum2 = _mm_add_epi64(sum2, _mm_add_epi64(_mm_unpacklo_epi32(masked, sign), _mm_unpackhi_epi32(masked, sign)));
+                __m128i const for_min = _mm_or_si128(masked, _mm_andnot_si128(mask, max_value4));
+                __m128i const for_max = _mm_or_si128(masked, _mm_andnot_si128(mask, min_value4));
+                __m128i const lt = _mm_cmplt_epi32(for_min, min4), gt = _mm_cmpgt_epi32(for_max, max4);
+                min4 = _mm_or_si128(_mm_and_si128(lt, for_min), _mm_andnot_si128(lt, min4));
+                max4 = _mm_or_si128(_mm_and_si128(gt, for_max), _mm_andnot_si128(gt, max4));
+            }
+            alignas(16) int64_t sums[2];
+            alignas(16) int32_t counts[4], mins[4], maxs[4];
+            _mm_store_si128(reinterpret_cast<__m128i *>(sums), sum2);
+            _mm_store_si128(reinterpret_cast<__m128i *>(counts), count4);
+            _mm_store_si128(reinterpret_cast<__m128i *>(mins), min4);
+            _mm_store_si128(reinterpret_cast<__m128i *>(maxs), max4);
+            result.sum += sums[0] + sums[1];
+            result.count += (size_t)counts[0] + counts[1] + counts[2] + counts[3];
+            result.min = std::min(std::min(mins[0], mins[1]), std::min(mins[2], mins[3]));
+            result.max = std::max(std::max(maxs[0], maxs[1]), std::max(maxs[2], maxs[3]));
+            aggregate<int32_t>(values + i, filter + i, low, high, n - i, result);
+        }
+#endif
+    }
+
+    // columnar table: rows with dense ids 0 - (size()-1), each of columns_count columns is a contiguous array (structure of arrays),
+    // so scans of one column read only its values, without map nodes and locks per row.
+    // Rows and scans are under the S-lock of one mutex, which is X-locked only to grow the columns.
+    // Rows are grouped in slots of slot_rows rows with a version (seqlock): a writer makes it odd, writes values and makes it even,
+    // readers of a row or of a slot in scans retry if the version was odd or changed - so writers of different slots and readers
+    // don't wait for each other, and a scan sees each slot consistent.
+    template<typename value_t, size_t columns_count, typename mutex_t = contention_free_shared_mutex<>, size_t slot_rows = 256>
+    class columnar_table
+    {
+        static_assert(std::is_arithmetic<value_t>::value, "columnar_table<> supports only arithmetic values");
+        static_assert(slot_rows % 4 == 0, "slot_rows should be a multiple of 4");
+
+        mutable mutex_t mtx;
+        std::array<std::vector<value_t>, columns_count> columns;
+        std::unique_ptr<std::atomic<uint32_t>[]> versions;    // of slots
+        size_t capacity_rows;
+        std::atomic<size_t> rows_count;
+
+        // X-lock of the slot of the row: version becomes odd
+        uint32_t lock_slot(size_t const slot) {
+            std::atomic<uint32_t> &version = versions[slot];
+            for (;;) {
+                uint32_t v = version.load(std::memory_order_relaxed);
+                if (!(v & 1) && version.compare_exchange_weak(v, v + 1, std::memory_order_acquire)) {
+                    std::atomic_thread_fence(std::memory_order_release);    // the odd version is visible before the stores of values
+                    return v + 1;
+                }
+                adaptive_details::cpu_relax();
+            }
+        }
+        void unlock_slot(size_t const slot, uint32_t const locked_version) { versions[slot].store(locked_version + 1, std::memory_order_release); }
+
+        template<typename F> void write_row(size_t const row, F &&f) {
+            shared_lock_guard<mutex_t> lock(mtx);
+            if (row >= std::min(size(), capacity_rows)) throw std::out_of_range("columnar_table: row id is out of range");
+            size_t const slot = row / slot_rows;
+            uint32_t const v = lock_slot(slot);
+            f();
+            unlock_slot(slot, v);
+        }
+
+        // f() reads the values, it is repeated until the version of the slot is the same before and after it
+        template<typename F> void read_slot(size_t const slot, F &&f) const {
+            std::atomic<uint32_t> &version = versions[slot];
+            for (;;) {
+                uint32_t const v = version.load(std::memory_order_acquire);
+                if (v & 1) { adaptive_details::cpu_relax(); continue; }
+                f();
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (version.load(std::memory_order_relaxed) == v) return;
+            }
+        }
+
+        void grow(size_t const rows) {
+            size_t new_capacity = std::max(capacity_rows * 2, (size_t)slot_rows);
+            while (new_capacity < rows) new_capacity *= 2;
+            new_capacity = (new_capacity + slot_rows - 1) / slot_rows * slot_rows;
+            for (auto &column : columns) column.resize(new_capacity, value_t(0));
+            std::unique_ptr<std::atomic<uint32_t>[]> new_versions(new std::atomic<uint32_t>[new_capacity / slot_rows]);
+            for (size_t i = 0; i < new_capacity / slot_rows; ++i)
+                new_versions[i].store((i < capacity_rows / slot_rows) ? versions[i].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+            versions = std::move(new_versions);
+            capacity_rows = new_capacity;
+        }
+
+    public:
+        typedef columnar_details::aggregate_t<value_t> aggregate_t;
+        typedef std::array<value_t, columns_count> row_t;
+
+        columnar_table(size_t const rows = 0) : capacity_rows(0), rows_count(0) { resize(rows); }
+
+        size_t size() const { return rows_count.load(std::memory_order_acquire); }
+
+        // new rows are zero, the table never shrinks
+        void resize(size_t const rows) {
+            reserve(rows);
+            size_t n = rows_count.load();
+            while (n < rows && !rows_count.compare_exchange_weak(n, rows));
+        }
+
+        void reserve(size_t const rows) {
+            {
+                shared_lock_guard<mutex_t> lock(mtx);
+                if (rows <= capacity_rows) return;
+            }
+            std::lock_guard<mutex_t> lock(mtx);
+            if (rows > capacity_rows) grow(rows);
+        }
+
+        // returns the id of the new row. Scans concurrent with push_back() see the row either zero or with all values
+        size_t push_back(row_t const& row) {
+            size_t const id = rows_count.fetch_add(1);
+            reserve(id + 1);
+            set_row(id, row);
+            return id;
+        }
+
+        void set(size_t const row, size_t const column, value_t const value) {
+            write_row(row, [&]() { columns[column][row] = value; });
+        }
+        void add(size_t const row, size_t const column, value_t const delta) {
+            write_row(row, [&]() { columns[column][row] += delta; });
+        }
+        void set_row(size_t const row, row_t const& values) {
+            write_row(row, [&]() { for (size_t c = 0; c < columns_count; ++c) columns[c][row] = values[c]; });
+        }
+        // read-modify-write of all values of the row: f(row_t &)
+        template<typename F> void update_row(size_t const row, F &&f) {
+            write_row(row, [&]() {
+                row_t values;
+                for (size_t c = 0; c < columns_count; ++c) values[c] = columns[c][row];
+                f(values);
+                for (size_t c = 0; c < columns_count; ++c) columns[c][row] = values[c];
+            });
+        }
+
+        value_t get(size_t const row, size_t const column) const { return get_row(row)[column]; }
+        row_t get_row(size_t const row) const {
+            shared_lock_guard<mutex_t> lock(mtx);
+            if (row >= std::min(size(), capacity_rows)) throw std::out_of_range("columnar_table: row id is out of range");
+            row_t values;
+            read_slot(row / slot_rows, [&]() { for (size_t c = 0; c < columns_count; ++c) values[c] = columns[c][row]; });
+            return values;
+        }
+
+        // sum, min, max and count of values of the column in rows [first_row, last_row) - under one S-lock, slot by slot
+        aggregate_t aggregate(size_t const column, size_t const first_row, size_t const last_row) const {
+            return aggregate(column, first_row, last_row, column, std::numeric_limits<value_t>::lowest(), std::numeric_limits<value_t>::max());
+        }
+
+        // the same only for rows where low <= filter_column <= high
+        aggregate_t aggregate(size_t const column, size_t const first_row, size_t const last_row,
+            size_t const filter_column, value_t const low, value_t const high) const
+        {
+            aggregate_t result;
+            shared_lock_guard<mutex_t> lock(mtx);
+            size_t const end = std::min(last_row, std::min(size(), capacity_rows));
+            value_t const *values = columns[column].data(), *filter = columns[filter_column].data();
+            for (size_t first = first_row; first < end;) {
+                size_t const slot = first / slot_rows;
+                size_t const last = std::min(end, (slot + 1) * slot_rows);
+                aggregate_t slot_result;
+                read_slot(slot, [&]() {
+                    slot_result = aggregate_t();
+                    columnar_details::aggregate(values + first, filter + first, low, high, last - first, slot_result);
+                });
+                result.merge(slot_result);
+                first = last;
+            }
+            return result;
+        }
+    };
+    // ---------------------------------------------------------------
+
+    namespace flat_map_details {
+        enum : uint8_t { empty_tag = 0, deleted_tag = 1 };     // tag of a full slot: 0x80 | 7 bits of the hash
+        static const size_t group_size = 16;
+
+        // bit i is set if tags[i] == tag - all 16 tags of the group are compared by one SSE2 instruction
+        inline unsigned match(uint8_t const *tags, uint8_t const tag) {
+#ifdef SIMD_SSE2
+            __m128i const tags16 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(tags));
+            return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(tags16, _mm_set1_epi8((char)tag)));
+#else
+            unsigned mask = 0;
+            for (size_t i = 0; i < group_size; ++i) mask |= (unsigned)(tags[i] == tag) << i;
+            return mask;
+#endif
+        }
+        inline unsigned lowest_bit(unsigned const mask) {
+#if defined(_MSC_VER)
+            unsigned long index; _BitScanForward(&index, mask); return (unsigned)index;
+#else
+            return (unsigned)__builtin_ctz(mask);
+#endif
+        }
+
+        using filter_details::mix;
+
+        // group of slots: version is a seqlock - odd while a writer changes the group, readers retry if it was odd or changed.
+        // moved - the group was copied to the new table by the resize
+        template<typename key_t, typename val_t>
+        struct group_t {
+            std::atomic<uint32_t> version;
+            std::atomic<bool> moved;
+            uint8_t tags[group_size];
+            key_t keys[group_size];
+            val_t vals[group_size];
+            group_t() : version(0), moved(false) { std::memset(tags, empty_tag, sizeof(tags)); }
+
+            uint32_t lock() {
+                for (;;) {
+                    uint32_t v = version.load(std::memory_order_relaxed);
+                    if (!(v & 1) && version.compare_exchange_weak(v, v + 1, std::memory_order_acquire)) {
+                        std::atomic_thread_fence(std::memory_order_release);    // the odd version is visible before the stores of slots
+                        return v + 1;
+                    }
+                    adaptive_details::cpu_relax();
+                }
+            }
+            void unlock(uint32_t const locked_version) { version.store(locked_version + 1, std::memory_order_release); }
+        };
+
+        template<typename key_t, typename val_t>
+        struct table_t {
+            size_t const groups_count, mask;
+            std::unique_ptr<group_t<key_t, val_t>[]> groups;
+            std::atomic<size_t> used;                   // full and deleted slots
+            std::atomic<size_t> migrate_next, migrated; // groups moved to the new table, when this table is the old one
+            explicit table_t(size_t const n) : groups_count(n), mask(n - 1), groups(new group_t<key_t, val_t>[n]), used(0),
+                migrate_next(0), migrated(0) {}
+            size_t capacity() const { return groups_count * group_size; }
+        };
+    }
+
+    // concurrent hash map with open addressing: keys and values are stored inline in groups of 16 slots with tag bytes
+    // (7 bits of the hash), a lookup compares all tags of a group by SSE2 and then keys only of the matched slots.
+    // Reads are optimistic: the version of the group is checked before and after the read.
+    // Writers lock one of 256 stripes by the hash of the key (for all operations with the key), and the version of the changed group.
+    // Resize is incremental: the new table is published at once, and each write moves the groups of its key and 2 other groups
+    // from the old table; lookups search the old table, and then the new one.
+    // Lookups and writes pin the tables in their reader cell (epoch-based reclamation): the replaced table is freed by a later resize
+    // or clear() when nobody can read it.
+    // Keys and values should be trivially copyable - they are copied by readers while writers can change them.
+    template<typename key_t, typename val_t, typename hash_t = std::hash<key_t>, typename equal_t = std::equal_to<key_t>>
+    class concurrent_flat_map
+    {
+        static_assert(std::is_trivially_copyable<key_t>::value && std::is_trivially_copyable<val_t>::value,
+            "concurrent_flat_map<> requires trivially copyable keys and values");
+
+        typedef flat_map_details::group_t<key_t, val_t> group_t;
+        typedef flat_map_details::table_t<key_t, val_t> table_t;
+        static const size_t group_size = flat_map_details::group_size;
+        static const size_t stripes_count = 256;
+        enum { cache_line_size = 64 };
+        typedef epoch_details::domain_t::pin_t pin_t;
+        typedef epoch_details::retired_t<table_t> retired_t;
+
+        struct alignas(cache_line_size) stripe_t {
+            spinlock_t mtx;
+            std::atomic<ptrdiff_t> count;   // elements inserted minus erased by this stripe
+            stripe_t() : count(0) {}
+        };
+
+        std::atomic<table_t *> table, old_table;
+        std::mutex resize_mtx;
+        std::unique_ptr<table_t> table_owner, old_table_owner;     // owners of *table and *old_table, under resize_mtx
+        std::vector<retired_t> retired;                             // replaced tables, freed by reclaim() under resize_mtx
+        epoch_details::domain_t epochs;
+        std::unique_ptr<char[]> stripes_raw;                        // stripes in one cache-line aligned block
+        stripe_t *stripes;
+        hash_t hasher;
+        equal_t equal;
+
+        enum result_t { absent, found, moved };
+
+        uint64_t hash_of(key_t const& key) const { return flat_map_details::mix((uint64_t)hasher(key)); }
+        static uint8_t tag_of(uint64_t const h) { return (uint8_t)(0x80 | (h >> 57)); }
+        stripe_t & stripe_of(uint64_t const h) const { return stripes[(h >> 8) % stripes_count]; }
+
+        // optimistic search of the key in the chain of groups from its home group, up to the group with an empty slot.
+        // In the old table moved groups are skipped (their keys are in the new one), in the current table a moved group means
+        // that it became the old one
+        result_t search(table_t const& t, key_t const& key, uint64_t const h, bool const skip_moved, val_t *val,
+            size_t *group_index = nullptr, unsigned *slot_index = nullptr) const
+        {
+            uint8_t const tag = tag_of(h);
+            for (size_t i = 0, g = h & t.mask; i < t.groups_count; ++i, g = (g + 1) & t.mask) {
+                group_t const& group = t.groups[g];
+                bool is_found, is_moved, has_empty;
+                unsigned found_slot = 0;
+                for (;;) {
+                    uint32_t const v = group.version.load(std::memory_order_acquire);
+                    if (v & 1) { adaptive_details::cpu_relax(); continue; }
+                    is_found = false;
+                    for (unsigned mask = flat_map_details::match(group.tags, tag); mask; mask &= mask - 1) {
+                        unsigned const slot = flat_map_details::lowest_bit(mask);
+                        if (equal(group.keys[slot], key)) {
+                            if (val) std::memcpy((void *)val, (void const *)&group.vals[slot], sizeof(val_t));
+                            found_slot = slot;
+                            is_found = true;
+                            break;
+                        }
+                    }
+                    has_empty = flat_map_details::match(group.tags, flat_map_details::empty_tag) != 0;
+                    is_moved = group.moved.load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (group.version.load(std::memory_order_relaxed) == v) break;
+                }
+                if (is_moved) { if (!skip_moved) return moved; }
+                else if (is_found) {
+                    if (group_index) { *group_index = g; *slot_index = found_slot; }
+                    return found;
+                }
+                if (has_empty) return absent;
+            }
+            return absent;
+        }
+
+        // under the stripe of the key: f(group, slot) is called under the lock of the group with the key.
+        // The slot of the key can't change after the search - only writers of its stripe and the resize (moved) change it
+        template<typename F>
+        result_t modify(table_t &t, key_t const& key, uint64_t const h, F &&f) {
+            size_t g;
+            unsigned slot;
+            result_t const result = search(t, key, h, false, nullptr, &g, &slot);
+            if (result != found) return result;
+            group_t &group = t.groups[g];
+            uint32_t const v = group.lock();
+            bool const is_moved = group.moved.load(std::memory_order_relaxed);
+            if (!is_moved) f(group, slot);
+            group.unlock(v);
+            return (is_moved) ? moved : found;
+        }
+
+        // the key is placed to the first empty or deleted slot of its chain. Returns false if the group became moved
+        bool place(table_t &t, key_t const& key, val_t const& val, uint64_t const h) {
+            for (size_t i = 0, g = h & t.mask; i < t.groups_count; ++i, g = (g + 1) & t.mask) {
+                group_t &group = t.groups[g];
+                unsigned const free_mask = flat_map_details::match(group.tags, flat_map_details::empty_tag) |
+                    flat_map_details::match(group.tags, flat_map_details::deleted_tag);
+                if (!free_mask) continue;
+                uint32_t const v = group.lock();
+                if (group.moved.load(std::memory_order_relaxed)) { group.unlock(v); return false; }
+                unsigned const deleted_mask = flat_map_details::match(group.tags, flat_map_details::deleted_tag);
+                unsigned const empty_mask = flat_map_details::match(group.tags, flat_map_details::empty_tag);
+                if (!(deleted_mask | empty_mask)) { group.unlock(v); continue; }    // taken meanwhile
+                unsigned const slot = flat_map_details::lowest_bit((deleted_mask) ? deleted_mask : empty_mask);
+                group.keys[slot] = key;
+                group.vals[slot] = val;
+                group.tags[slot] = tag_of(h);
+                group.unlock(v);
+                if (!deleted_mask) t.used.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        // all slots of the group are copied to the new table, the group is marked as moved
+        void migrate_group(table_t &from, size_t const g, table_t &to) {
+            group_t &group = from.groups[g];
+            if (group.moved.load(std::memory_order_acquire)) return;
+            uint32_t const v = group.lock();
+            if (!group.moved.load(std::memory_order_relaxed)) {
+                for (unsigned mask = ~(flat_map_details::match(group.tags, flat_map_details::empty_tag) |
+                    flat_map_details::match(group.tags, flat_map_details::deleted_tag)) & 0xFFFF; mask; mask &= mask - 1)
+                {
+                    unsigned const slot = flat_map_details::lowest_bit(mask);
+                    place(to, group.keys[slot], group.vals[slot], hash_of(group.keys[slot]));
+                }
+                group.moved.store(true, std::memory_order_relaxed);
+                group.unlock(v);
+                if (from.migrated.fetch_add(1, std::memory_order_acq_rel) + 1 == from.groups_count) finish_migration(&from);
+            }
+            else group.unlock(v);
+        }
+
+        void finish_migration(table_t *from) {
+            std::lock_guard<std::mutex> lock(resize_mtx);
+            if (old_table.load(std::memory_order_relaxed) != from) return;
+            old_table.store(nullptr, std::memory_order_seq_cst);
+            retire(old_table_owner);
+            reclaim();
+        }
+
+        // under resize_mtx, after the table is replaced: it's freed by reclaim() when the pins which could load it are released
+        void retire(std::unique_ptr<table_t> &owner) {
+            if (owner) retired.push_back(retired_t{ std::move(owner), epochs.current() });
+        }
+        void reclaim() { epoch_details::reclaim(epochs, retired); }
+
+        // before a write of the key: the chain of the key and 2 other groups are moved from the old table
+        void help_migration(table_t *t, table_t *from, uint64_t const h) {
+            if (!from || from == t) return;
+            for (size_t i = 0, g = h & from->mask; i < from->groups_count; ++i, g = (g + 1) & from->mask) {
+                migrate_group(*from, g, *t);
+                if (flat_map_details::match(from->groups[g].tags, flat_map_details::empty_tag)) break;    // the key isn't after it
+            }
+            for (size_t i = 0; i < 2; ++i) {
+                size_t const g = from->migrate_next.fetch_add(1, std::memory_order_relaxed);
+                if (g >= from->groups_count) break;
+                migrate_group(*from, g, *t);
+            }
+        }
+
+        // the new table is 2x if more than 7/16 of slots are full, else the same size (deleted slots are dropped)
+        void start_resize(table_t *t) {
+            std::unique_lock<std::mutex> lock(resize_mtx);
+            if (table.load(std::memory_order_relaxed) != t) return;
+            if (table_t *from = old_table.load(std::memory_order_relaxed)) {   // the previous resize isn't finished yet
+                lock.unlock();
+                for (size_t g = 0; g < from->groups_count; ++g) migrate_group(*from, g, *t);
+                lock.lock();
+                if (table.load(std::memory_order_relaxed) != t) return;
+            }
+            size_t const groups = (size() * 16 > t->capacity() * 7) ? t->groups_count * 2 : t->groups_count;
+            std::unique_ptr<table_t> new_table(new table_t(groups));
+            old_table.store(t, std::memory_order_seq_cst);      // before the new table: readers load table, then old_table
+            table.store(new_table.get(), std::memory_order_seq_cst);
+            retire(old_table_owner);        // all groups of the previous old table are moved
+            old_table_owner = std::move(table_owner);
+            table_owner = std::move(new_table);
+            reclaim();
+        }
+
+        bool need_resize(table_t const& t) const { return t.used.load(std::memory_order_relaxed) * 8 > t.capacity() * 7; }
+
+        // write of the key with the hash h under its stripe: f(table) returns moved if the table became old - then it is repeated
+        // with the new one. The tables are pinned up to the end of the resize
+        template<typename F>
+        result_t write(uint64_t const h, F &&f) {
+            pin_t const pinned = epochs.pin();
+            result_t result;
+            table_t *t;
+            {
+                std::lock_guard<spinlock_t> lock(stripe_of(h).mtx);
+                do {
+                    t = table.load(std::memory_order_seq_cst);
+                    help_migration(t, old_table.load(std::memory_order_seq_cst), h);
+                    result = f(*t);
+                } while (result == moved);
+            }
+            if (need_resize(*t)) start_resize(t);
+            return result;
+        }
+
+    public:
+        concurrent_flat_map(size_t const capacity = 0) : stripes_raw(new char[sizeof(stripe_t) * stripes_count + cache_line_size]) {
+            stripes = reinterpret_cast<stripe_t *>(
+                (reinterpret_cast<uintptr_t>(stripes_raw.get()) + cache_line_size - 1) & ~(uintptr_t)(cache_line_size - 1));
+            for (size_t i = 0; i < stripes_count; ++i) new (&stripes[i]) stripe_t();
+            size_t groups = 8;
+            while (groups * group_size * 7 < capacity * 8) groups *= 2;
+            table_owner.reset(new table_t(groups));
+            table.store(table_owner.get());
+            old_table.store(nullptr);
+        }
+        ~concurrent_flat_map() { for (size_t i = 0; i < stripes_count; ++i) stripes[i].~stripe_t(); }
+        concurrent_flat_map(concurrent_flat_map const&) = delete;
+        concurrent_flat_map & operator=(concurrent_flat_map const&) = delete;
+
+        // returns true if inserted, false if the key exists
+        template<typename... Args>
+        bool emplace(key_t const& key, Args &&...args) {
+            val_t const val(std::forward<Args>(args)...);   // out of locks
+            uint64_t const h = hash_of(key);
+            result_t const result = write(h, [&](table_t &t) -> result_t {
+                result_t const r = search(t, key, h, false, nullptr);
+                if (r != absent) return r;
+                return (place(t, key, val, h)) ? absent : moved;
+            });
+            if (result == absent) stripe_of(h).count.fetch_add(1, std::memory_order_relaxed);
+            return result == absent;
+        }
+
+        // returns true if inserted, false if assigned
+        bool insert_or_assign(key_t const& key, val_t const& val) {
+            uint64_t const h = hash_of(key);
+            result_t const result = write(h, [&](table_t &t) -> result_t {
+                result_t const r = modify(t, key, h, [&](group_t &group, unsigned slot) { group.vals[slot] = val; });
+                if (r != absent) return r;
+                return (place(t, key, val, h)) ? absent : moved;
+            });
+            if (result == absent) stripe_of(h).count.fetch_add(1, std::memory_order_relaxed);
+            return result == absent;
+        }
+
+        // f(val_t &) is called under the lock of the group, returns false if there is no key
+        template<typename F>
+        bool update(key_t const& key, F &&f) {
+            uint64_t const h = hash_of(key);
+            return write(h, [&](table_t &t) {
+                return modify(t, key, h, [&](group_t &group, unsigned slot) { f(group.vals[slot]); });
+            }) == found;
+        }
+
+        size_t erase(key_t const& key) {
+            uint64_t const h = hash_of(key);
+            result_t const result = write(h, [&](table_t &t) {
+                return modify(t, key, h, [](group_t &group, unsigned slot) { group.tags[slot] = flat_map_details::deleted_tag; });
+            });
+            if (result != found) return 0;
+            stripe_of(h).count.fetch_sub(1, std::memory_order_relaxed);
+            return 1;
+        }
+
+        // copies the value, returns false if there is no key. Writes only the pin to the reader cell of the thread
+        bool find(key_t const& key, val_t &val) const {
+            uint64_t const h = hash_of(key);
+            pin_t const pinned = epochs.pin();
+            for (;;) {
+                table_t const *t = table.load(std::memory_order_seq_cst);
+                table_t const *from = old_table.load(std::memory_order_seq_cst);
+                if (from && from != t && search(*from, key, h, true, &val) == found) return true;
+                result_t const result = search(*t, key, h, false, &val);
+                if (result != moved) return result == found;
+            }
+        }
+
+        bool contains(key_t const& key) const { val_t val; return find(key, val); }
+
+        size_t size() const {
+            ptrdiff_t n = 0;
+            for (size_t i = 0; i < stripes_count; ++i) n += stripes[i].count.load(std::memory_order_relaxed);
+            return (n > 0) ? (size_t)n : 0;
+        }
+
+        // under all stripes: the replaced tables are freed when lookups can't read them
+        void clear() {
+            std::unique_ptr<table_t> new_table(new table_t(8));
+            for (size_t i = 0; i < stripes_count; ++i) stripes[i].mtx.lock();
+            {
+                std::lock_guard<std::mutex> lock(resize_mtx);
+                old_table.store(nullptr, std::memory_order_seq_cst);
+                table.store(new_table.get(), std::memory_order_seq_cst);
+                retire(old_table_owner);
+                retire(table_owner);
+                table_owner = std::move(new_table);
+                for (size_t i = 0; i < stripes_count; ++i) stripes[i].count.store(0, std::memory_order_relaxed);
+                reclaim();
+            }
+            for (size_t i = 0; i < stripes_count; ++i) stripes[i].mtx.unlock();
+        }
+    };
+    // ---------------------------------------------------------------
+
+    namespace olc_details {
+        // version lock of a node: bit 1 - X-locked by a writer, each unlock increments the version.
+        // Readers don't write it: they read the version before the read of the node and validate it after
+        struct version_lock_t {
+            std::atomic<uint64_t> version;
+            version_lock_t() : version(0) {}
+            bool read_lock(uint64_t &v) const {     // false if X-locked - the reader restarts
+                v = version.load(std::memory_order_acquire);
+                if (!(v & 2)) return true;
+                adaptive_details::cpu_relax();
+                return false;
+            }
+            bool validate(uint64_t const v) const {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return version.load(std::memory_order_relaxed) == v;
+            }
+            bool upgrade(uint64_t const v) {        // false if the node was changed after read_lock()
+                uint64_t expected = v;
+                return version.compare_exchange_strong(expected, v + 2, std::memory_order_acquire);
+            }
+            void unlock() { version.fetch_add(2, std::memory_order_release); }
+        };
+    }
+
+    // concurrent B+tree with optimistic lock coupling: each node has a version lock, readers (find, scan) don't lock nodes and
+    // don't write shared memory - they validate versions of the node and its parent and restart if one was changed.
+    // Writers lock only the leaf they change, and a full node with its parent - it is split on the way down (eagerly),
+    // so a split never goes up. Nodes are never removed or merged (an empty leaf stays in the tree), so readers can
+    // follow any pointer they read - nodes are freed only by clear() and the destructor.
+    // Keys and values should be trivially copyable - readers copy them while writers can change them.
+    template<typename key_t, typename val_t, typename compare_t = std::less<key_t>, size_t node_size = 32>
+    class olc_btree
+    {
+        static_assert(std::is_trivially_copyable<key_t>::value && std::is_trivially_copyable<val_t>::value,
+            "olc_btree<> requires trivially copyable keys and values");
+        static_assert(node_size >= 4, "node_size should be at least 4");
+
+        // keys of arithmetic types are searched by count of smaller keys in the whole node - free keys are padded by max()
+        typedef std::integral_constant<bool, std::is_arithmetic<key_t>::value && std::is_same<compare_t, std::less<key_t>>::value> count_search_t;
+        static key_t pad_key(std::true_type) { return std::numeric_limits<key_t>::max(); }
+        static key_t pad_key(std::false_type) { return key_t(); }
+        static void pad(key_t *first, key_t *last) { std::fill(first, last, pad_key(count_search_t())); }
+
+        struct node_t {
+            olc_details::version_lock_t lock;
+            bool const is_leaf;
+            std::atomic<uint32_t> count;    // keys in the node
+            key_t keys[node_size];
+            explicit node_t(bool const leaf) : is_leaf(leaf), count(0) { pad(keys, keys + node_size); }
+            size_t size() const { return std::min((size_t)count.load(std::memory_order_relaxed), node_size); }   // also for torn reads
+        };
+
+        struct leaf_t : node_t {
+            val_t vals[node_size];
+            leaf_t *next;
+            leaf_t() : node_t(true), next(nullptr) {}
+        };
+
+        struct inner_t : node_t {
+            node_t *children[node_size + 1];    // keys of children[i] are in [keys[i-1], keys[i])
+            inner_t() : node_t(false) { std::fill(children, children + node_size + 1, nullptr); }
+        };
+
+        std::atomic<node_t *> root;
+        leaf_t *first_leaf;                     // the leftmost leaf is never moved
+        compare_t comp;
+
+        size_t lower_bound(node_t const *node, key_t const& k) const { return search<false>(node, k, count_search_t()); }
+        size_t upper_bound(node_t const *node, key_t const& k) const { return search<true>(node, k, count_search_t()); }
+
+        template<bool upper> size_t search(node_t const *node, key_t const& k, std::false_type) const {
+            key_t const *const end = node->keys + node->size();
+            return ((upper) ? std::upper_bound(node->keys, end, k, comp) : std::lower_bound(node->keys, end, k, comp)) - node->keys;
+        }
+
+        // count of keys < k (<= k if upper) - without branches, vectorized by compiler
+        template<bool upper> size_t search(node_t const *node, key_t const& k, std::true_type) const {
+            size_t n = 0;
+            for (size_t i = 0; i < node_size; ++i) n += (upper) ? !(k < node->keys[i]) : (node->keys[i] < k);
+            return std::min(n, node->size());
+        }
+        bool equal(key_t const& a, key_t const& b) const { return !comp(a, b) && !comp(b, a); }
+
+        // the parent is validated before the child is dereferenced - the pointer read from a changed node can be anything,
+        // and again after the child is read-locked - so the child still has the range of keys from the parent
+        bool descend(inner_t const *inner, uint64_t const inner_version, key_t const& k, node_t *&child, uint64_t &child_version) const {
+            child = inner->children[std::min(upper_bound(inner, k), node_size)];
+            if (!inner->lock.validate(inner_version)) return false;
+            return child->lock.read_lock(child_version) && inner->lock.validate(inner_version);
+        }
+
+        // the leaf of the key with its version, without locks
+        leaf_t * find_leaf(key_t const& k, uint64_t &version) const {
+            for (;;) {
+                node_t *node = root.load(std::memory_order_acquire);
+                if (!node->lock.read_lock(version)) continue;
+                bool restart = false;
+                while (!node->is_leaf) {
+                    node_t *child;
+                    uint64_t child_version;
+                    if (!descend(static_cast<inner_t *>(node), version, k, child, child_version)) { restart = true; break; }
+                    node = child;
+                    version = child_version;
+                }
+                if (!restart) return static_cast<leaf_t *>(node);
+            }
+        }
+
+        // upper half of the node is moved to the new right node, returns it and the separator key for the parent
+        static leaf_t * split(leaf_t *leaf, key_t &separator) {
+            leaf_t *right = new leaf_t();
+            size_t const half = leaf->size() / 2, moved = leaf->size() - half;
+            std::copy(leaf->keys + half, leaf->keys + half + moved, right->keys);
+            std::copy(leaf->vals + half, leaf->vals + half + moved, right->vals);
+            right->count.store((uint32_t)moved, std::memory_order_release);
+            right->next = leaf->next;
+            leaf->next = right;
+            leaf->count.store((uint32_t)half, std::memory_order_release);
+            pad(leaf->keys + half, leaf->keys + half + moved);
+            separator = right->keys[0];
+            return right;
+        }
+        static inner_t * split(inner_t *inner, key_t &separator) {
+            inner_t *right = new inner_t();
+            size_t const half = inner->size() / 2, moved = inner->size() - half - 1;    // keys[half] goes up
+            std::copy(inner->keys + half + 1, inner->keys + inner->size(), right->keys);
+            std::copy(inner->children + half + 1, inner->children + inner->size() + 1, right->children);
+            right->count.store((uint32_t)moved, std::memory_order_release);
+            separator = inner->keys[half];
+            inner->count.store((uint32_t)half, std::memory_order_release);
+            pad(inner->keys + half, inner->keys + half + moved + 1);
+            return right;
+        }
+
+        // under X-lock of the parent, which isn't full
+        void insert_child(inner_t *parent, key_t const& separator, node_t *right) {
+            size_t const n = parent->size(), pos = upper_bound(parent, separator);
+            std::copy_backward(parent->keys + pos, parent->keys + n, parent->keys + n + 1);
+            std::copy_backward(parent->children + pos + 1, parent->children + n + 1, parent->children + n + 2);
+            parent->keys[pos] = separator;
+            parent->children[pos + 1] = right;
+            parent->count.store((uint32_t)(n + 1), std::memory_order_release);
+        }
+
+        // the full node is split under X-locks of it and its parent (or of the root). Returns false if a lock failed
+        template<typename some_node_t>
+        bool split_full(some_node_t *node, uint64_t const version, inner_t *parent, uint64_t const parent_version) {
+            if (parent && !parent->lock.upgrade(parent_version)) return false;
+            if (!node->lock.upgrade(version)) { if (parent) parent->lock.unlock(); return false; }
+            if (!parent && root.load(std::memory_order_relaxed) != node) { node->lock.unlock(); return false; }   // the root was split
+            key_t separator;
+            node_t *right = split(node, separator);
+            std::atomic_thread_fence(std::memory_order_release);    // the new node is initialized before readers can reach it
+            if (parent) insert_child(parent, separator, right);
+            else {
+                inner_t *new_root = new inner_t();
+                new_root->keys[0] = separator;
+                new_root->children[0] = node;
+                new_root->children[1] = right;
+                new_root->count.store(1, std::memory_order_release);
+                root.store(new_root, std::memory_order_release);
+            }
+            node->lock.unlock();
+            if (parent) parent->lock.unlock();
+            return true;
+        }
+
+        // returns true if inserted, else assigns the value if assign
+        bool insert(key_t const& k, val_t const& val, bool const assign) {
+            for (;;) {
+                node_t *node = root.load(std::memory_order_acquire);
+                uint64_t version, parent_version = 0;
+                if (!node->lock.read_lock(version)) continue;
+                inner_t *parent = nullptr;
+                bool restart = false;
+                while (!node->is_leaf && !restart) {
+                    inner_t *inner = static_cast<inner_t *>(node);
+                    if (inner->size() == node_size) { split_full(inner, version, parent, parent_version); restart = true; break; }
+                    node_t *child;
+                    uint64_t child_version;
+                    if (!descend(inner, version, k, child, child_version)) { restart = true; break; }
+                    parent = inner; parent_version = version;
+                    node = child; version = child_version;
+                }
+                if (restart) continue;
+                leaf_t *leaf = static_cast<leaf_t *>(node);
+                if (leaf->size() == node_size) { split_full(leaf, version, parent, parent_version); continue; }
+                if (!leaf->lock.upgrade(version)) continue;
+                size_t const n = leaf->size(), pos = lower_bound(leaf, k);
+                bool const exists = pos < n && equal(leaf->keys[pos], k);
+                if (exists) { if (assign) leaf->vals[pos] = val; }
+                else {
+                    std::copy_backward(leaf->keys + pos, leaf->keys + n, leaf->keys + n + 1);
+                    std::copy_backward(leaf->vals + pos, leaf->vals + n, leaf->vals + n + 1);
+                    leaf->keys[pos] = k;
+                    leaf->vals[pos] = val;
+                    leaf->count.store((uint32_t)(n + 1), std::memory_order_release);
+                }
+                leaf->lock.unlock();
+                return !exists;
+            }
+        }
+
+        // f(leaf, pos) under X-lock of the leaf of the key, if the key exists
+        template<typename F>
+        bool modify(key_t const& k, F &&f) {
+            for (;;) {
+                uint64_t version;
+                leaf_t *leaf = find_leaf(k, version);
+                if (!leaf->lock.upgrade(version)) continue;
+                size_t const pos = lower_bound(leaf, k);
+                bool const exists = pos < leaf->size() && equal(leaf->keys[pos], k);
+                if (exists) f(leaf, pos);
+                leaf->lock.unlock();
+                return exists;
+            }
+        }
+
+        void destroy(node_t *node) {
+            if (node->is_leaf) { delete static_cast<leaf_t *>(node); return; }
+            inner_t *inner = static_cast<inner_t *>(node);
+            for (size_t i = 0; i <= inner->size(); ++i) destroy(inner->children[i]);
+            delete inner;
+        }
+
+    public:
+        typedef key_t key_type;
+        typedef val_t mapped_type;
+        typedef compare_t key_compare;
+
+        olc_btree(compare_t const& c = compare_t()) : first_leaf(new leaf_t()), comp(c) { root.store(first_leaf); }
+        ~olc_btree() { destroy(root.load()); }
+        olc_btree(olc_btree const&) = delete;
+        olc_btree & operator=(olc_btree const&) = delete;
+
+        // returns true if inserted, false if the key exists
+        template<typename... Args>
+        bool emplace(key_t const& k, Args &&...args) { return insert(k, val_t(std::forward<Args>(args)...), false); }
+
+        // returns true if inserted, false if assigned
+        bool insert_or_assign(key_t const& k, val_t const& val) { return insert(k, val, true); }
+
+        // f(val_t &) is called under X-lock of the leaf, returns false if there is no key
+        template<typename F>
+        bool update(key_t const& k, F &&f) { return modify(k, [&](leaf_t *leaf, size_t pos) { f(leaf->vals[pos]); }); }
+
+        size_t erase(key_t const& k) {
+            return modify(k, [](leaf_t *leaf, size_t pos) {
+                size_t const n = leaf->size();
+                std::copy(leaf->keys + pos + 1, leaf->keys + n, leaf->keys + pos);
+                std::copy(leaf->vals + pos + 1, leaf->vals + n, leaf->vals + pos);
+                leaf->count.store((uint32_t)(n - 1), std::memory_order_release);
+                pad(leaf->keys + n - 1, leaf->keys + n);
+            }) ? 1 : 0;
+        }
+
+        // copies the value, returns false if there is no key. Doesn't write shared memory
+        bool find(key_t const& k, val_t &val) const {
+            for (;;) {
+                uint64_t version;
+                leaf_t const *leaf = find_leaf(k, version);
+                size_t const pos = lower_bound(leaf, k);
+                bool const exists = pos < leaf->size() && equal(leaf->keys[pos], k);
+                if (exists) val = leaf->vals[pos];
+                if (leaf->lock.validate(version)) return exists;
+            }
+        }
+
+        bool contains(key_t const& k) const { val_t val; return find(k, val); }
+
+        // f(key, val) for keys in [low, high) in ascending order, returns their count. Leaf by leaf without locks:
+        // each leaf is copied consistently and f() is called for the copy, keys inserted into passed leaves meanwhile are missed
+        template<typename F>
+        size_t scan(key_t const& low, key_t const& high, F &&f) const {
+            key_t keys[node_size];
+            val_t vals[node_size];
+            size_t total = 0;
+            uint64_t version;
+            leaf_t const *leaf = find_leaf(low, version);
+            for (;;) {
+                size_t n = 0;
+                bool end = false;
+                leaf_t const *next;
+                for (;;) {
+                    n = 0; end = false;
+                    for (size_t i = lower_bound(leaf, low); i < leaf->size(); ++i) {
+                        if (!comp(leaf->keys[i], high)) { end = true; break; }
+                        keys[n] = leaf->keys[i];
+                        vals[n++] = leaf->vals[i];
+                    }
+                    next = leaf->next;
+                    if (leaf->lock.validate(version)) break;
+                    while (!leaf->lock.read_lock(version));
+                }
+                for (size_t i = 0; i < n; ++i) f(keys[i], vals[i]);
+                total += n;
+                if (end || !next) return total;
+                leaf = next;
+                while (!leaf->lock.read_lock(version));
+            }
+        }
+
+        // walks all leaves without locks as scan(): count and next of each leaf are read consistently,
+        // keys inserted into passed leaves meanwhile aren't counted
+        size_t size() const {
+            size_t n = 0;
+            uint64_t version;
+            leaf_t const *leaf = first_leaf;
+            while (!leaf->lock.read_lock(version));
+            for (;;) {
+                size_t count;
+                leaf_t const *next;
+                for (;;) {
+                    count = leaf->size();
+                    next = leaf->next;
+                    if (leaf->lock.validate(version)) break;
+                    while (!leaf->lock.read_lock(version));
+                }
+                n += count;
+                if (!next) return n;
+                leaf = next;
+                while (!leaf->lock.read_lock(version));
+            }
+        }
+
+        // isn't thread-safe: without concurrent operations
+        void clear() {
+            destroy(root.load());
+            first_leaf = new leaf_t();
+            root.store(first_leaf);
+        }
+    };
+    // ---------------------------------------------------------------
+
+    // sharded_counter<> and sharded_accumulator<> - statistics (request counts, byte totals, money sums) without contention:
+    // as the slots of contention_free_shared_mutex<>, each thread updates only its own cache-line cell, read() sums the cells
+
+    namespace sharded_details {
+        enum { cache_line_size = 64 };
+
+        // dense indexes of threads from 0: the index of a finished thread is given to a new thread,
+        // so while threads are not more than cells, each thread has its own cell
+        class thread_indexes_t {
+            std::mutex mtx;
+            std::vector<unsigned> free_indexes;
+            unsigned next_index = 0;
+        public:
+            static thread_indexes_t& instance() { static thread_indexes_t indexes; return indexes; }
+            unsigned acquire() {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (free_indexes.empty()) return next_index++;
+                auto const it = std::min_element(free_indexes.begin(), free_indexes.end());
+                unsigned const index = *it;
+                free_indexes.erase(it);
+                return index;
+            }
+            void release(unsigned const index) {
+                std::lock_guard<std::mutex> lock(mtx);
+                free_indexes.push_back(index);
+            }
+        };
+
+        // the index is cached in a trivially destructible thread_local - without the check of its initialization on each update;
+        // after the release by guard_t the cell can be shared with a new thread - that is only slower, cells are locked
+        inline unsigned this_thread_index() {
+            struct guard_t {
+                unsigned const index;
+                guard_t() : index(thread_indexes_t::instance().acquire()) {}
+                ~guard_t() { thread_indexes_t::instance().release(index); }
+            };
+            thread_local static unsigned index = std::numeric_limits<unsigned>::max();
+            if (index == std::numeric_limits<unsigned>::max()) { thread_local static guard_t guard; index = guard.index; }
+            return index;
+        }
+
+        // cells in one cache-line aligned block, the version of a cell is odd while the cell is updated:
+        // the lock of the cell is uncontended, 2 threads share a cell only if threads are more than cells
+        template<typename data_t, size_t cells_count>
+        class cells_t {
+            static_assert(cells_count && (cells_count & (cells_count - 1)) == 0, "cells_count must be a power of two");
+            struct alignas(cache_line_size) cell_t {
+                std::atomic<uint64_t> version;
+                data_t data;
+                cell_t() : version(0) {}
+            };
+
+            std::unique_ptr<char[]> raw;
+            cell_t *cells;
+
+            static uint64_t lock(cell_t &cell) {
+                uint64_t v = cell.version.load(std::memory_order_relaxed);
+                for (size_t i = 1;; ++i) {
+                    if (!(v & 1) && cell.version.compare_exchange_weak(v, v + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                        return v + 1;
+                    if (i % 1000 == 0) std::this_thread::yield(); else adaptive_details::cpu_relax();
+                    v = cell.version.load(std::memory_order_relaxed);
+                }
+            }
+            static void unlock(cell_t &cell, uint64_t const v) { cell.version.store(v + 1, std::memory_order_release); }
+
+            // version of the cell which isn't updated now
+            static uint64_t read_lock(cell_t const& cell) {
+                uint64_t v;
+                while ((v = cell.version.load(std::memory_order_acquire)) & 1) adaptive_details::cpu_relax();
+                return v;
+            }
+            static bool validate(cell_t const& cell, uint64_t const v) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return cell.version.load(std::memory_order_relaxed) == v;
+            }
+
+        public:
+            cells_t() : raw(new char[sizeof(cell_t) * cells_count + cache_line_size]) {
+                cells = reinterpret_cast<cell_t *>(
+                    (reinterpret_cast<uintptr_t>(raw.get()) + cache_line_size - 1) & ~(uintptr_t)(cache_line_size - 1));
+                for (size_t i = 0; i < cells_count; ++i) new (&cells[i]) cell_t();
+            }
+            ~cells_t() { for (size_t i = 0; i < cells_count; ++i) cells[i].~cell_t(); }
+            cells_t(cells_t const&) = delete;
+            cells_t& operator=(cells_t const&) = delete;
+
+            template<typename F>
+            void update(F f) {
+                cell_t &cell = cells[this_thread_index() & (cells_count - 1)];
+                uint64_t const v = lock(cell);
+                f(cell.data);
+                unlock(cell, v);
+            }
+
+            // each cell is read consistently, but cells at different moments - concurrent updates can be seen partially
+            template<typename F>
+            void read(F merge) const {
+                for (size_t i = 0; i < cells_count; ++i) {
+                    cell_t const& cell = cells[i];
+                    for (;;) {
+                        uint64_t const v = read_lock(cell);
+                        auto const value = cell.data.load();
+                        if (validate(cell, v)) { merge(value); break; }
+                    }
+                }
+            }
+
+            // snapshot of all cells at one moment: no version was changed between the collect and its validation (double collect),
+            // if updates are too frequent then all cells are locked - updaters wait for one pass over the cells
+            template<typename result_t, typename F>
+            result_t read_snapshot(F merge) const {
+                std::array<uint64_t, cells_count> versions;
+                for (size_t attempt = 0; attempt < 16; ++attempt) {
+                    result_t result = result_t();
+                    for (size_t i = 0; i < cells_count; ++i) {
+                        versions[i] = read_lock(cells[i]);
+                        merge(result, cells[i].data.load());
+                    }
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    size_t i = 0;
+                    while (i < cells_count && cells[i].version.load(std::memory_order_relaxed) == versions[i]) ++i;
+                    if (i == cells_count) return result;
+                }
+                result_t result = result_t();
+                for_all_locked([&](data_t &data) { merge(result, data.load()); });
+                return result;
+            }
+
+            // f() for each cell while all cells are locked - in the order of cells, as updaters lock only one cell no deadlock
+            template<typename F>
+            void for_all_locked(F f) const {
+                std::array<uint64_t, cells_count> versions;
+                for (size_t i = 0; i < cells_count; ++i) versions[i] = lock(cells[i]);
+                for (size_t i = 0; i < cells_count; ++i) f(cells[i].data);
+                for (size_t i = 0; i < cells_count; ++i) unlock(cells[i], versions[i]);
+            }
+        };
+
+        template<typename T>
+        struct counter_data_t {
+            std::atomic<T> value;
+            counter_data_t() : value(0) {}
+            T load() const { return value.load(std::memory_order_relaxed); }
+            void add(T const delta) { value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed); }
+            void sub(T const delta) { value.store(value.load(std::memory_order_relaxed) - delta, std::memory_order_relaxed); }
+            void reset() { value.store(0, std::memory_order_relaxed); }
+        };
+
+        template<typename T>
+        struct accumulator_data_t {
+            typedef columnar_details::aggregate_t<T> result_t;
+            std::atomic<typename result_t::sum_t> sum;
+            std::atomic<T> min, max;
+            std::atomic<size_t> count;
+            accumulator_data_t() { reset(); }
+            result_t load() const {
+                result_t result;
+                result.sum = sum.load(std::memory_order_relaxed);
+                result.min = min.load(std::memory_order_relaxed);
+                result.max = max.load(std::memory_order_relaxed);
+                result.count = count.load(std::memory_order_relaxed);
+                return result;
+            }
+            void add(T const value) {
+                sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+                if (value < min.load(std::memory_order_relaxed)) min.store(value, std::memory_order_relaxed);
+                if (max.load(std::memory_order_relaxed) < value) max.store(value, std::memory_order_relaxed);
+                count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+            void reset() {
+                result_t const empty;
+                sum.store(empty.sum, std::memory_order_relaxed);
+                min.store(empty.min, std::memory_order_relaxed);
+                max.store(empty.max, std::memory_order_relaxed);
+                count.store(empty.count, std::memory_order_relaxed);
+            }
+        };
+    }
+
+
+    // sum of deltas: add() and sub() don't touch cache lines of other threads, read() is approximate while counters are updated,
+    // read_snapshot() is the exact sum at one moment
+    template<typename T = int64_t, size_t cells_count = 64>
+    class sharded_counter {
+        static_assert(std::is_arithmetic<T>::value, "sharded_counter<> requires an arithmetic type");
+        typedef sharded_details::counter_data_t<T> data_t;
+        sharded_details::cells_t<data_t, cells_count> cells;
+
+    public:
+        typedef T value_type;
+
+        explicit sharded_counter(T const value = 0) { if (value != 0) add(value); }
+
+        void add(T const delta = 1) { cells.update([delta](data_t &data) { data.add(delta); }); }
+        void sub(T const delta = 1) { cells.update([delta](data_t &data) { data.sub(delta); }); }
+        sharded_counter& operator+=(T const delta) { add(delta); return *this; }
+        sharded_counter& operator-=(T const delta) { sub(delta); return *this; }
+        sharded_counter& operator++() { add(1); return *this; }
+        sharded_counter& operator--() { sub(1); return *this; }
+
+        T read() const {
+            T sum = 0;
+            cells.read([&](T const value) { sum += value; });
+            return sum;
+        }
+        T read_snapshot() const { return cells.template read_snapshot<T>([](T &sum, T const value) { sum += value; }); }
+        operator T() const { return read(); }
+
+        // all cells at one moment
+        void reset() { cells.for_all_locked([](data_t &data) { data.reset(); }); }
+    };
+
+
+    // sum, count, min and max of values - columnar_details::aggregate_t<> as columnar_table<>::aggregate() returns
+    template<typename T = int64_t, size_t cells_count = 64>
+    class sharded_accumulator {
+        static_assert(std::is_arithmetic<T>::value, "sharded_accumulator<> requires an arithmetic type");
+        typedef sharded_details::accumulator_data_t<T> data_t;
+        sharded_details::cells_t<data_t, cells_count> cells;
+
+    public:
+        typedef T value_type;
+        typedef typename data_t::result_t result_t;
+
+        void add(T const value) { cells.update([value](data_t &data) { data.add(value); }); }
+        sharded_accumulator& operator+=(T const value) { add(value); return *this; }
+
+        // each cell is consistent: sum, count, min and max of one cell are of the same values
+        result_t read() const {
+            result_t result;
+            cells.read([&](result_t const& value) { result.merge(value); });
+            return result;
+        }
+        result_t read_snapshot() const { return cells.template read_snapshot<result_t>([](result_t &result, result_t const& value) { result.merge(value); }); }
+
+        void reset() { cells.for_all_locked([](data_t &data) { data.reset(); }); }
+    };
+    // ---------------------------------------------------------------
+
+    // concurrent_cache<> - cache bounded in bytes with hash shards as in safe_unordered_map_partitioned_t: a hit takes only
+    // the S-lock of its shard and records the access by the CLOCK reference bit instead of moving a node of an LRU list.
+    // Eviction runs in a shard under its X-lock: the hand passes the clock ring, clears the reference bits and evicts
+    // the first element without the bit - an element which wasn't read during a whole turn of the hand
+
+    namespace cache_details {
+        // memory of std::string / std::vector out of the object
+        template<typename T> size_t heap_bytes(T const&) { return 0; }
+        template<typename char_t, typename traits_t, typename alloc_t>
+        size_t heap_bytes(std::basic_string<char_t, traits_t, alloc_t> const& s) {
+            char const *const data = reinterpret_cast<char const *>(s.data()), *const obj = reinterpret_cast<char const *>(&s);
+            return (data >= obj && data < obj + sizeof(s)) ? 0 : (s.capacity() + 1) * sizeof(char_t);   // small string is inside
+        }
+        template<typename T, typename alloc_t>
+        size_t heap_bytes(std::vector<T, alloc_t> const& v) { return v.capacity() * sizeof(T); }
+
+        // bytes of an element with the node of the hash map and the slot of the clock ring
+        template<typename key_t, typename val_t>
+        struct default_weigh_t {
+            size_t operator()(key_t const& key, val_t const& val) const {
+                return sizeof(key_t) + sizeof(val_t) + 4 * sizeof(void *) + heap_bytes(key) + heap_bytes(val);
+            }
+        };
+
+        template<typename key_t, typename val_t, typename hash_t, typename weigh_t>
+        struct shard_t {
+            struct entry_t {
+                val_t val;
+                size_t bytes, ring_index;
+                mutable std::atomic<bool> referenced;   // set by hits under the S-lock, cleared by the hand under the X-lock
+                template<typename... Args> entry_t(Args &&...args) : val(std::forward<Args>(args)...), bytes(0), ring_index(0), referenced(false) {}
+            };
+            typedef std::unordered_map<key_t, entry_t, hash_t> map_t;
+            typedef typename map_t::value_type element_t;
+
+            map_t map;
+            std::vector<element_t *> ring;      // clock: nodes of the map aren't moved by rehash, nullptr - free slot
+            std::vector<size_t> free_slots;
+            size_t hand = 0, bytes = 0, evictions = 0;
+            size_t const capacity;
+            weigh_t weigh;
+
+            explicit shard_t(size_t const capacity_bytes) : capacity(capacity_bytes) {}
+
+            void remove(typename map_t::iterator it) {
+                ring[it->second.ring_index] = nullptr;
+                free_slots.push_back(it->second.ring_index);
+                bytes -= it->second.bytes;
+                map.erase(it);
+            }
+
+            // the first turn of the hand clears all reference bits - at most 2 turns for each evicted element
+            void evict(size_t const needed) {
+                while (bytes + needed > capacity && bytes != 0) {
+                    if (hand >= ring.size()) hand = 0;
+                    element_t *const element = ring[hand++];
+                    if (!element) continue;
+                    if (element->second.referenced.load(std::memory_order_relaxed))
+                        element->second.referenced.store(false, std::memory_order_relaxed);
+                    else {
+                        remove(map.find(element->first));
+                        ++evictions;
+                    }
+                }
+            }
+
+            // the value is constructed before eviction - its bytes are known only then. Returns true if the element is stored:
+            // false if the key exists and !assign, or the element is larger than the shard
+            template<typename... Args>
+            bool emplace(key_t &&key, bool const assign, Args &&...args) {
+                auto const it = map.find(key);
+                if (it != map.end()) {
+                    if (!assign) return false;
+                    remove(it);
+                }
+                auto const inserted = map.emplace(std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                    std::forward_as_tuple(std::forward<Args>(args)...));
+                entry_t &entry = inserted.first->second;
+                entry.bytes = weigh(inserted.first->first, entry.val);
+                if (entry.bytes > capacity) { map.erase(inserted.first); return false; }
+                evict(entry.bytes);
+                if (free_slots.empty()) {       // the slot freed last is just behind the hand - the new element is checked last
+                    entry.ring_index = ring.size();
+                    ring.push_back(&*inserted.first);
+                }
+                else {
+                    entry.ring_index = free_slots.back();
+                    free_slots.pop_back();
+                    ring[entry.ring_index] = &*inserted.first;
+                }
+                bytes += entry.bytes;
+                return true;
+            }
+
+            void clear() { map.clear(); ring.clear(); free_slots.clear(); hand = bytes = 0; }
+        };
+    }
+
+
+    template<typename key_t, typename val_t, typename weigh_t = cache_details::default_weigh_t<key_t, val_t>,
+        typename hash_t = std::hash<key_t>, template<class> class safe_ptr_t = contfree_safe_ptr>
+    class concurrent_cache
+    {
+        typedef cache_details::shard_t<key_t, val_t, hash_t, weigh_t> shard_t;
+        typedef safe_ptr_t<shard_t> safe_shard_t;
+
+        std::vector<safe_shard_t> shards;
+        unsigned shard_bits;
+        hash_t hasher;
+        size_t const capacity_bytes;
+        mutable sharded_counter<uint64_t> hits, misses;
+
+        static unsigned bits_for(size_t const count) { unsigned bits = 0; while (((size_t)1 << bits) < count) ++bits; return bits; }
+
+        size_t shard_index(key_t const& k) const {
+            uint64_t const h = (uint64_t)hasher(k) * 0x9E3779B97F4A7C15ULL;    // Fibonacci hashing: std::hash<int> is identity
+            return (shard_bits == 0) ? 0 : (size_t)(h >> (64 - shard_bits));
+        }
+        safe_shard_t& shard(key_t const& k) { return shards[shard_index(k)]; }
+        const safe_shard_t& shard(key_t const& k) const { return shards[shard_index(k)]; }
+
+    public:
+        struct stats_t {
+            uint64_t hits, misses, evictions;
+            double hit_ratio() const { return (hits + misses) ? (double)hits / (hits + misses) : 0; }
+        };
+
+        // capacity_bytes is divided between shards equally, shards_count is rounded up to a power of two
+        explicit concurrent_cache(size_t const capacity, size_t const shards_count = 64) :
+            shard_bits(bits_for(std::max<size_t>(shards_count, 1))), capacity_bytes(capacity)
+        {
+            for (size_t i = 0; i < ((size_t)1 << shard_bits); ++i) shards.emplace_back(capacity_bytes >> shard_bits);
+        }
+
+        // a hit copies the value under the S-lock and sets the reference bit only if it isn't set yet
+        bool find(key_t const& key, val_t &val) const {
+            {
+                auto s_shard = slock_safe_ptr(shard(key));
+                auto const it = s_shard->map.find(key);
+                if (it != s_shard->map.end()) {
+                    if (!it->second.referenced.load(std::memory_order_relaxed)) it->second.referenced.store(true, std::memory_order_relaxed);
+                    val = it->second.val;
+                    hits.add(1);
+                    return true;
+                }
+            }
+            misses.add(1);
+            return false;
+        }
+
+        // doesn't count as an access
+        bool contains(key_t const& key) const {
+            auto s_shard = slock_safe_ptr(shard(key));
+            return s_shard->map.count(key) != 0;
+        }
+
+        // the value is constructed only if the key doesn't exist. Returns true if inserted
+        template<typename K, typename... Args> bool try_emplace(K &&key, Args &&...args) {
+            key_t k(std::forward<K>(key));
+            return xlock_safe_ptr(shard(k))->emplace(std::move(k), false, std::forward<Args>(args)...);
+        }
+
+        // the element is replaced if the key exists. Returns false only if the element is larger than a shard
+        template<typename K, typename V> bool insert_or_assign(K &&key, V &&val) {
+            key_t k(std::forward<K>(key));
+            return xlock_safe_ptr(shard(k))->emplace(std::move(k), true, std::forward<V>(val));
+        }
+
+        // on a miss load(key) is called without locks: concurrent misses of the same key can load it more than once
+        template<typename F> val_t get_or_load(key_t const& key, F &&load) {
+            val_t val;
+            if (find(key, val)) return val;
+            val = load(key);
+            try_emplace(key, val);
+            return val;
+        }
+
+        size_t erase(key_t const& key) {
+            auto x_shard = xlock_safe_ptr(shard(key));
+            auto const it = x_shard->map.find(key);
+            if (it == x_shard->map.end()) return 0;
+            x_shard->remove(it);
+            return 1;
+        }
+
+        size_t size() const {
+            size_t size = 0;
+            for (auto &i : shards) size += slock_safe_ptr(i)->map.size();
+            return size;
+        }
+        size_t bytes() const {
+            size_t bytes = 0;
+            for (auto &i : shards) bytes += slock_safe_ptr(i)->bytes;
+            return bytes;
+        }
+        size_t capacity() const { return capacity_bytes; }
+        size_t partitions_count() const { return shards.size(); }
+
+        stats_t stats() const {
+            stats_t stats = { hits.read(), misses.read(), 0 };
+            for (auto &i : shards) stats.evictions += slock_safe_ptr(i)->evictions;
+            return stats;
+        }
+
+        void clear() { for (auto &i : shards) xlock_safe_ptr(i)->clear(); }
+    };
+    // ---------------------------------------------------------------
+
+    // segmented_vector<> - append-heavy log instead of safe_ptr<std::vector<T>>: segments of geometric sizes (first_segment_size,
+    // 2x, 4x, ...) are never moved - no copying on growth, references and iteration stay valid while other threads append.
+    // Appends reserve indexes by one CAS and construct elements without locks, only the append beyond the allocated segments
+    // allocates the next one under the mutex - before its indexes are reserved. Reads and in-place updates take the S- or X-lock
+    // of the segment of the element
+    namespace segmented_details {
+        inline unsigned highest_bit(uint64_t const x) {
+#if defined(_MSC_VER)
+            unsigned long index; _BitScanReverse64(&index, x); return (unsigned)index;
+#else
+            return 63 - (unsigned)__builtin_clzll(x);
+#endif
+        }
+        constexpr unsigned log2(size_t const n) { return (n <= 1) ? 0 : 1 + log2(n / 2); }
+
+        enum : uint8_t { empty_slot = 0, ready_slot = 1, failed_slot = 2 };     // failed - the constructor threw
+    }
+
+    template<typename T, typename mutex_t = contention_free_shared_mutex<>, size_t first_segment_size = 1024>
+    class segmented_vector {
+        static_assert(first_segment_size && (first_segment_size & (first_segment_size - 1)) == 0, "first_segment_size must be a power of two");
+        static const unsigned max_segments = 64 - segmented_details::log2(first_segment_size);
+        typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_t;
+
+        struct segment_t {
+            mutable mutex_t mtx;
+            std::unique_ptr<storage_t[]> storage;
+            std::unique_ptr<std::atomic<uint8_t>[]> states;
+            explicit segment_t(size_t const size) : storage(new storage_t[size]), states(new std::atomic<uint8_t>[size]) {
+                for (size_t i = 0; i < size; ++i) states[i].store(segmented_details::empty_slot, std::memory_order_relaxed);
+            }
+            T * at(size_t const offset) const { return reinterpret_cast<T *>(&storage[offset]); }
+        };
+
+        std::array<std::atomic<segment_t *>, max_segments> segments;
+        std::atomic<size_t> reserved;   // indexes given to appends
+        std::atomic<size_t> capacity;   // end of the allocated segments, >= reserved
+        std::mutex grow_mtx;
+
+        // segment k contains indexes [first_segment_size * (2^k - 1), first_segment_size * (2^(k+1) - 1))
+        static unsigned segment_of(size_t const index) { return segmented_details::highest_bit(index / first_segment_size + 1); }
+        static size_t segment_begin(unsigned const k) { return first_segment_size * (((size_t)1 << k) - 1); }
+
+        // segments are allocated in order, up to the one with the index n - 1
+        void grow(size_t const n) {
+            std::lock_guard<std::mutex> lock(grow_mtx);
+            for (size_t end = capacity.load(std::memory_order_relaxed); end < n; end = capacity.load(std::memory_order_relaxed)) {
+                unsigned const k = segment_of(end);
+                segments[k].store(new segment_t(first_segment_size << k), std::memory_order_release);
+                capacity.store(segment_begin(k + 1), std::memory_order_release);
+            }
+        }
+
+        // n indexes are reserved only after their segments are allocated: if the allocation throws, nothing is reserved -
+        // each index below size() has its segment and gets the ready or failed state
+        size_t reserve_indexes(size_t const n) {
+            size_t index = reserved.load(std::memory_order_relaxed);
+            do {
+                if (index + n > capacity.load(std::memory_order_acquire)) grow(index + n);
+            } while (!reserved.compare_exchange_weak(index, index + n, std::memory_order_relaxed));
+            return index;
+        }
+
+        // the segment of the reserved index is allocated
+        segment_t& segment(size_t const index, size_t &offset) const {
+            unsigned const k = segment_of(index);
+            offset = index - segment_begin(k);
+            return *segments[k].load(std::memory_order_acquire);
+        }
+
+        template<typename... Args>
+        void construct(size_t const index, Args &&...args) {
+            size_t offset;
+            segment_t &s = segment(index, offset);
+            try {
+                new (s.at(offset)) T(std::forward<Args>(args)...);
+            }
+            catch (...) {
+                s.states[offset].store(segmented_details::failed_slot, std::memory_order_release);
+                throw;
+            }
+            s.states[offset].store(segmented_details::ready_slot, std::memory_order_release);
+        }
+
+        // the element with index < size() can be constructed by its append just now - waits for it.
+        // Returns nullptr if the constructor of the element threw
+        segment_t * wait_ready(size_t const index, size_t &offset) const {
+            unsigned const k = segment_of(index);
+            offset = index - segment_begin(k);
+            segment_t *s;
+            for (size_t i = 1;; ++i) {
+                s = segments[k].load(std::memory_order_acquire);
+                if (s && s->states[offset].load(std::memory_order_acquire) != segmented_details::empty_slot) break;
+                if (i % 1000 == 0) std::this_thread::yield(); else adaptive_details::cpu_relax();
+            }
+            return (s->states[offset].load(std::memory_order_relaxed) == segmented_details::ready_slot) ? s : nullptr;
+        }
+
+        segment_t& checked(size_t const index, size_t &offset) const {
+            if (index >= size()) throw std::out_of_range("segmented_vector: index out of range");
+            segment_t *const s = wait_ready(index, offset);
+            if (!s) throw std::out_of_range("segmented_vector: the element wasn't constructed");
+            return *s;
+        }
+
+        void destroy() {
+            size_t const count = reserved.load(std::memory_order_acquire);
+            for (unsigned k = 0; k < max_segments; ++k) {
+                segment_t *const s = segments[k].load(std::memory_order_acquire);
+                if (!s) continue;
+                size_t const end = std::min(count - std::min(count, segment_begin(k)), first_segment_size << k);
+                for (size_t i = 0; i < end; ++i)
+                    if (s->states[i].load(std::memory_order_relaxed) == segmented_details::ready_slot) s->at(i)->~T();
+                delete s;
+                segments[k].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+    public:
+        typedef T value_type;
+
+        segmented_vector() : reserved(0), capacity(0) { for (auto &s : segments) s.store(nullptr, std::memory_order_relaxed); }
+        ~segmented_vector() { destroy(); }
+        segmented_vector(segmented_vector const&) = delete;
+        segmented_vector& operator=(segmented_vector const&) = delete;
+
+        // returns the index of the element
+        template<typename... Args> size_t emplace_back(Args &&...args) {
+            size_t const index = reserve_indexes(1);
+            construct(index, std::forward<Args>(args)...);
+            return index;
+        }
+        size_t push_back(T const& value) { return emplace_back(value); }
+        size_t push_back(T &&value) { return emplace_back(std::move(value)); }
+
+        // one reservation for the whole range - its elements get contiguous indexes. Returns the index of the first one.
+        // If a constructor throws, the rest of the reserved indexes are marked as not constructed
+        template<typename it_t> size_t append(it_t first, it_t const last) {
+            size_t const count = std::distance(first, last);
+            size_t const index = reserve_indexes(count);
+            size_t i = index;
+            try {
+                for (; first != last; ++first, ++i) construct(i, *first);
+            }
+            catch (...) {
+                for (++i; i < index + count; ++i) {
+                    size_t offset;
+                    segment_t &s = segment(i, offset);
+                    s.states[offset].store(segmented_details::failed_slot, std::memory_order_release);
+                }
+                throw;
+            }
+            return index;
+        }
+
+        // indexes given to appends: elements below it can be still constructed - accessors wait for them
+        size_t size() const { return reserved.load(std::memory_order_acquire); }
+        bool empty() const { return size() == 0; }
+
+        // reserved memory for n elements: appends below n don't allocate segments
+        void reserve(size_t const n) { if (n > capacity.load(std::memory_order_acquire)) grow(n); }
+
+        // copy under the S-lock of the segment. Throws std::out_of_range
+        T get(size_t const index) const {
+            size_t offset;
+            segment_t const& s = checked(index, offset);
+            shared_lock_guard<mutex_t> lock(s.mtx);
+            return *s.at(offset);
+        }
+        T operator[](size_t const index) const { return get(index); }
+
+        template<typename F> void read(size_t const index, F &&f) const {
+            size_t offset;
+            segment_t const& s = checked(index, offset);
+            shared_lock_guard<mutex_t> lock(s.mtx);
+            f(static_cast<T const&>(*s.at(offset)));
+        }
+
+        // f(T &) under the X-lock of the segment
+        template<typename F> void update(size_t const index, F &&f) {
+            size_t offset;
+            segment_t &s = checked(index, offset);
+            std::lock_guard<mutex_t> lock(s.mtx);
+            f(*s.at(offset));
+        }
+        void set(size_t const index, T value) { update(index, [&](T &element) { element = std::move(value); }); }
+
+        // f(size_t index, T const&) for elements [first, min(last, size())) - segment after segment, each under its S-lock.
+        // Elements appended meanwhile beyond size() aren't visited. Returns number of visited elements
+        template<typename F> size_t for_each(size_t const first, size_t const last, F &&f) const {
+            size_t const end = std::min(last, size());
+            size_t visited = 0;
+            for (size_t index = first; index < end;) {
+                unsigned const k = segment_of(index);
+                size_t const segment_end = std::min(end, segment_begin(k + 1));
+                size_t offset;
+                wait_ready(index, offset);      // the segment is allocated
+                segment_t const& s = *segments[k].load(std::memory_order_acquire);
+                shared_lock_guard<mutex_t> lock(s.mtx);
+                for (; index < segment_end; ++index) {
+                    if (!wait_ready(index, offset)) continue;
+                    f(index, static_cast<T const&>(*s.at(offset)));
+                    ++visited;
+                }
+            }
+            return visited;
+        }
+        template<typename F> size_t for_each(F &&f) const { return for_each(0, std::numeric_limits<size_t>::max(), std::forward<F>(f)); }
+
+        // isn't thread-safe: without concurrent operations
+        void clear() {
+            destroy();
+            reserved.store(0, std::memory_order_release);
+            capacity.store(0, std::memory_order_release);
         }
-        size_t erase(key_t const& key) throw() { return part(key)->erase(key); }
-        void clear() { for (auto it = partition->begin(); it != partition->end(); ++it) it->second->clear(); }
     };
     // ---------------------------------------------------------------
 
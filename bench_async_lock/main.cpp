@@ -0,0 +1,206 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+#include <condition_variable>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+#ifndef COROUTINE_MTX
+#error "C++20 coroutines are required: g++ -std=c++20"
+#endif
+
+struct field_t { int money, time; field_t(int m, int t) : money(m), time(t) {} field_t() : money(0), time(0) {} };
+
+static const size_t accounts_count = 16;
+std::vector<async_safe_ptr<field_t>> async_accounts(accounts_count);
+std::vector<safe_ptr<field_t>> blocking_accounts(accounts_count);
+
+std::atomic<size_t> tasks_done;
+
+
+// executor: thread pool with FIFO queue of waiters (coroutines and callbacks)
+class thread_pool_t : public async_executor_t {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<async_waiter_t *> queue;
+    bool stop_flag;
+    std::vector<std::thread> threads;
+
+public:
+    explicit thread_pool_t(size_t const threads_count) : stop_flag(false) {
+        for (size_t i = 0; i < threads_count; ++i) threads.emplace_back([this]() {
+            for (;;) {
+                async_waiter_t *waiter;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    cv.wait(lock, [&]() { return stop_flag || !queue.empty(); });
+                    if (queue.empty()) return;
+                    waiter = queue.front();
+                    queue.pop_front();
+                }
+                waiter->resume();
+            }
+        });
+    }
+    ~thread_pool_t() {
+        { std::lock_guard<std::mutex> lock(mtx); stop_flag = true; }
+        cv.notify_all();
+        for (auto &i : threads) i.join();
+    }
+
+    void post(async_waiter_t *waiter) override {
+        { std::lock_guard<std::mutex> lock(mtx); queue.push_back(waiter); }
+        cv.notify_one();
+    }
+
+    // co_await pool.schedule(); - continue the coroutine in the pool (lets other tasks run)
+    struct schedule_t : async_waiter_t {
+        thread_pool_t &pool;
+        std::coroutine_handle<> handle;
+        explicit schedule_t(thread_pool_t &p) : async_waiter_t(false, nullptr, &resume_handle), pool(p) {}
+        static void resume_handle(async_waiter_t *waiter) { static_cast<schedule_t *>(waiter)->handle.resume(); }
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> coro_handle) { handle = coro_handle; pool.post(this); }
+        void await_resume() {}
+    };
+    schedule_t schedule() { return schedule_t(*this); }
+};
+
+// fire-and-forget coroutine
+struct task_t {
+    struct promise_type {
+        task_t get_return_object() { return task_t(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+enum lock_type_t { blocking_lock, co_await_lock, co_await_lock_executor };
+
+// logical task: locks random account, works under the lock, then yields to other tasks of the pool
+template<lock_type_t lock_type>
+task_t account_task(thread_pool_t &pool, size_t const task_index, size_t const ops_count, std::function<void(void)> const& burn_cpu)
+{
+    co_await pool.schedule();
+    std::default_random_engine generator((unsigned)task_index);
+    std::uniform_int_distribution<size_t> index_distribution(0, accounts_count - 1);
+
+    for (size_t i = 0; i < ops_count; ++i) {
+        size_t const index = index_distribution(generator);
+        if (lock_type == blocking_lock) {
+            auto x_account = co_await blocking_accounts[index].xlock();    // blocks the executor thread
+            x_account->money++;
+            burn_cpu();
+        }
+        else {
+            auto x_account = co_await async_accounts[index].xlock((lock_type == co_await_lock_executor) ? &pool : nullptr);
+            x_account->money++;
+            burn_cpu();
+        }
+        co_await pool.schedule();
+    }
+    tasks_done++;
+}
+
+// the same logical task for event loop: chain of callbacks
+struct callback_task_t : async_waiter_t {
+    thread_pool_t &pool;
+    size_t ops_left;
+    std::default_random_engine generator;
+    std::function<void(void)> const& burn_cpu;
+
+    callback_task_t(thread_pool_t &p, size_t const task_index, size_t const ops_count, std::function<void(void)> const& burn) :
+        async_waiter_t(false, nullptr, &step), pool(p), ops_left(ops_count), generator((unsigned)task_index), burn_cpu(burn) {}
+
+    static void step(async_waiter_t *waiter) {
+        auto *const self = static_cast<callback_task_t *>(waiter);
+        if (self->ops_left-- == 0) { tasks_done++; return; }
+        size_t const index = std::uniform_int_distribution<size_t>(0, accounts_count - 1)(self->generator);
+        async_accounts[index].xlock([self](field_t &account) {
+            account.money++;
+            self->burn_cpu();
+            self->pool.post(self);  // next step
+        }, &self->pool);
+    }
+};
+
+
+int64_t money_sum() {
+    int64_t sum = 0;
+    for (auto &i : async_accounts) sum += i->money;
+    for (auto &i : blocking_accounts) sum += i->money;
+    return sum;
+}
+
+void wait_tasks(size_t const tasks_count) {
+    while (tasks_done.load() < tasks_count) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+
+int main(int argc, char** argv) {
+
+    const size_t tasks_count = 10000;           // logical tasks - many more than threads
+    const size_t ops_count = 200;               // locks per task
+    size_t threads_count = std::thread::hardware_concurrency();
+    size_t burn_cpu_iterations = 100;           // work under the lock
+
+    if (argc >= 2) threads_count = std::stoi(std::string(argv[1]));           // threads
+    if (argc >= 3) burn_cpu_iterations = std::stoi(std::string(argv[2]));     // work size
+
+    std::function<void(void)> burn_cpu = [burn_cpu_iterations]() { for (volatile size_t i = 0; i < burn_cpu_iterations;) i = i + 1; };
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark asynchronous locks: " << tasks_count << " tasks x " << ops_count << " X-locks of " << accounts_count <<
+        " accounts, work under lock = " << burn_cpu_iterations << std::endl;
+    std::cout << "Threads in pool = " << threads_count << std::endl << std::endl;
+    std::cout << "                        \t time, sec \t MOps \t money" << std::endl;
+    std::cout << std::setprecision(3);
+
+    auto run_benchmark = [&](std::string const& name, std::function<void(thread_pool_t &)> start_tasks) {
+        std::cout << name;
+        int64_t const money_start = money_sum();
+        tasks_done = 0;
+        std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+        {
+            thread_pool_t pool(threads_count);
+            start_tasks(pool);
+            wait_tasks(tasks_count);
+        }
+        std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+        double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+        bool const money_ok = (money_sum() - money_start == (int64_t)(tasks_count * ops_count));
+        std::cout << "\t" << took_time << " \t" << (tasks_count * ops_count / (took_time * 1000000)) <<
+            " \t" << (money_ok ? "ok" : "ERROR") << std::endl;
+    };
+
+    run_benchmark("blocking safe_ptr<>:     ", [&](thread_pool_t &pool) {
+        for (size_t i = 0; i < tasks_count; ++i) account_task<blocking_lock>(pool, i, ops_count, burn_cpu);
+    });
+    run_benchmark("co_await xlock():        ", [&](thread_pool_t &pool) {
+        for (size_t i = 0; i < tasks_count; ++i) account_task<co_await_lock>(pool, i, ops_count, burn_cpu);
+    });
+    run_benchmark("co_await xlock(&pool):   ", [&](thread_pool_t &pool) {
+        for (size_t i = 0; i < tasks_count; ++i) account_task<co_await_lock_executor>(pool, i, ops_count, burn_cpu);
+    });
+    std::vector<std::unique_ptr<callback_task_t>> callback_tasks;
+    run_benchmark("xlock(callback, &pool):  ", [&](thread_pool_t &pool) {
+        for (size_t i = 0; i < tasks_count; ++i) {
+            callback_tasks.emplace_back(new callback_task_t(pool, i, ops_count, burn_cpu));
+            pool.post(callback_tasks.back().get());
+        }
+    });
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
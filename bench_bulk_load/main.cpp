@@ -0,0 +1,120 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+struct field_t { int money, time; field_t(int m, int t) : money(m), time(t) {} field_t() : money(0), time(0) {} };
+
+typedef std::vector<std::pair<int, field_t>> rows_t;
+
+static const int keys_range = 100000000;
+static const int partition_step = 1000000;      // 100 partitions
+
+// prints M rows/s, the new empty container for each measurement
+template<typename container_t>
+void run_benchmark(rows_t const& rows, std::function<size_t(container_t &)> fill)
+{
+    container_t container(0, keys_range, partition_step);
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    size_t const inserted = fill(container);
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+    std::cout << " \t" << (rows.size() / (took_time * 1000000)) << ((inserted == container.size()) ? "" : " ERROR");
+}
+
+template<typename safe_map_t>
+void run_benchmark_safe_ptr(rows_t const& rows, std::function<size_t(safe_map_t &)> fill)
+{
+    safe_map_t safe_map;
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    size_t const inserted = fill(safe_map);
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+    std::cout << " \t" << (rows.size() / (took_time * 1000000)) << ((inserted == safe_map->size()) ? "" : " ERROR");
+}
+
+
+int main(int argc, char** argv) {
+
+    size_t max_threads = std::thread::hardware_concurrency();
+    size_t rows_count = 2000000;
+
+    if (argc >= 2) max_threads = std::stoi(std::string(argv[1]));     // max threads
+    if (argc >= 3) rows_count = std::stoi(std::string(argv[2]));      // rows
+    max_threads = std::max<size_t>(max_threads, 1);
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark bulk load of " << rows_count << " rows, keys 0 - " << keys_range << ", " <<
+        (keys_range / partition_step) << " partitions" << std::endl;
+
+    rows_t shuffled_rows;
+    std::default_random_engine generator(0);
+    std::uniform_int_distribution<int> key_distribution(0, keys_range - 1);
+    for (size_t i = 0; i < rows_count; ++i) {
+        int const key = key_distribution(generator);
+        shuffled_rows.emplace_back(key, field_t(key, key));
+    }
+    rows_t sorted_rows = shuffled_rows;
+    std::stable_sort(sorted_rows.begin(), sorted_rows.end(), [](rows_t::value_type const& a, rows_t::value_type const& b) { return a.first < b.first; });
+
+    typedef safe_map_partitioned_t<int, field_t, contfree_safe_ptr> safe_part_map_t;
+    typedef safe_map_partitioned_t<int, field_t, contfree_safe_ptr, btree_map<int, field_t>> safe_part_btree_t;
+
+    std::cout << std::endl << "M rows/s: \t\t\t emplace \t bulk sorted \t bulk shuffled" << std::endl;
+    std::cout << std::setprecision(3);
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        auto const emplace_parallel = [&](rows_t const& rows, std::function<void(rows_t::value_type const&)> emplace) {
+            std::vector<std::thread> vec_thread(threads);
+            for (size_t t = 0; t < threads; ++t) vec_thread[t] = std::thread([&, t]() {
+                for (size_t i = t; i < rows.size(); i += threads) emplace(rows[i]);
+            });
+            for (auto &i : vec_thread) i.join();
+        };
+
+        std::cout << std::endl << threads << " threads" << std::endl;
+
+        std::cout << "safe part<map,contf>:  ";
+        run_benchmark<safe_part_map_t>(shuffled_rows, [&](safe_part_map_t &m) {
+            emplace_parallel(shuffled_rows, [&](rows_t::value_type const& r) { m.emplace(r.first, field_t(r.second)); });
+            return m.size(); });
+        run_benchmark<safe_part_map_t>(sorted_rows, [&](safe_part_map_t &m) {
+            return m.bulk_load(sorted_rows.begin(), sorted_rows.end(), threads); });
+        run_benchmark<safe_part_map_t>(shuffled_rows, [&](safe_part_map_t &m) {
+            return m.bulk_load(shuffled_rows.begin(), shuffled_rows.end(), threads); });
+        std::cout << std::endl;
+
+        std::cout << "safe part<btree,contf>:";
+        run_benchmark<safe_part_btree_t>(shuffled_rows, [&](safe_part_btree_t &m) {
+            emplace_parallel(shuffled_rows, [&](rows_t::value_type const& r) { m.emplace(r.first, field_t(r.second)); });
+            return m.size(); });
+        run_benchmark<safe_part_btree_t>(sorted_rows, [&](safe_part_btree_t &m) {
+            return m.bulk_load(sorted_rows.begin(), sorted_rows.end(), threads); });
+        run_benchmark<safe_part_btree_t>(shuffled_rows, [&](safe_part_btree_t &m) {
+            return m.bulk_load(shuffled_rows.begin(), shuffled_rows.end(), threads); });
+        std::cout << std::endl;
+    }
+
+    // one lock for the whole container - bulk_load() doesn't scale with threads
+    typedef contfree_safe_ptr<std::map<int, field_t>> safe_map_t;
+    std::cout << std::endl << "safe_ptr<map,contf>:   ";
+    run_benchmark_safe_ptr<safe_map_t>(shuffled_rows, [&](safe_map_t &m) {
+        for (auto &r : shuffled_rows) m->emplace(r.first, r.second);
+        return m->size(); });
+    run_benchmark_safe_ptr<safe_map_t>(sorted_rows, [&](safe_map_t &m) { return bulk_load(m, sorted_rows.begin(), sorted_rows.end()); });
+    run_benchmark_safe_ptr<safe_map_t>(shuffled_rows, [&](safe_map_t &m) { return bulk_load(m, shuffled_rows.begin(), shuffled_rows.end()); });
+    std::cout << std::endl;
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
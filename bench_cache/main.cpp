@@ -0,0 +1,144 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <list>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+#include <cmath>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+struct field_t { int money, time; field_t(int m, int t) : money(m), time(t) {} field_t() : money(0), time(0) {} };
+
+// LRU cache as it is usually done: the hash map points to nodes of the list, a hit moves its node to the front
+struct lru_cache_t {
+    typedef std::list<std::pair<int, field_t>> list_t;
+    list_t lru_list;
+    std::unordered_map<int, list_t::iterator> map;
+    size_t const capacity;  // elements
+    explicit lru_cache_t(size_t const capacity_elements) : capacity(capacity_elements) {}
+
+    bool find(int const key, field_t &val) {
+        auto const it = map.find(key);
+        if (it == map.end()) return false;
+        lru_list.splice(lru_list.begin(), lru_list, it->second);
+        val = it->second->second;
+        return true;
+    }
+    void insert(int const key, field_t const& val) {
+        if (map.count(key)) return;
+        if (map.size() >= capacity) { map.erase(lru_list.back().first); lru_list.pop_back(); }
+        lru_list.emplace_front(key, val);
+        map.emplace(key, lru_list.begin());
+    }
+};
+
+typedef safe_ptr<lru_cache_t> safe_lru_cache_t;
+typedef concurrent_cache<int, field_t> cache_t;
+
+// Zipf distribution of keys [0, keys_count): probability of the key k is proportional to 1 / (k + 1)^s
+class zipf_distribution_t {
+    std::shared_ptr<std::vector<double>> cdf;
+    std::uniform_real_distribution<double> uniform;
+public:
+    zipf_distribution_t(size_t const keys_count, double const s) : cdf(std::make_shared<std::vector<double>>(keys_count)), uniform(0, 1) {
+        double sum = 0;
+        for (size_t k = 0; k < keys_count; ++k) (*cdf)[k] = (sum += 1 / std::pow((double)(k + 1), s));
+        for (auto &i : *cdf) i /= sum;
+    }
+    template<typename generator_t> int operator()(generator_t &generator) {
+        return (int)std::min<size_t>(std::lower_bound(cdf->begin(), cdf->end(), uniform(generator)) - cdf->begin(), cdf->size() - 1);
+    }
+};
+
+std::atomic<size_t> hits_total;
+
+
+// each thread reads Zipf keys: a miss loads the value from the "backend" and inserts it
+template<typename cache_t>
+void benchmark_cache(cache_t &cache, size_t const iterations_count, zipf_distribution_t key_distribution,
+    std::function<bool(cache_t &, int, field_t &)> find, std::function<void(cache_t &, int, field_t const&)> insert)
+{
+    const unsigned int seed = (unsigned)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine generator(seed);
+    size_t hits = 0;
+    field_t val;
+
+    for (size_t i = 0; i < iterations_count; ++i) {
+        int const key = key_distribution(generator);
+        if (find(cache, key, val)) ++hits;
+        else insert(cache, key, field_t(key, key));
+    }
+    hits_total += hits;
+    volatile int money = val.money; (void)money;
+}
+
+
+template<typename cache_t>
+void run_benchmark(std::string const& name, std::function<cache_t *()> create, std::vector<std::thread> &vec_thread,
+    size_t const iterations_count, zipf_distribution_t const& key_distribution,
+    std::function<bool(cache_t &, int, field_t &)> find, std::function<void(cache_t &, int, field_t const&)> insert)
+{
+    std::unique_ptr<cache_t> cache(create());
+    hits_total = 0;
+    std::cout << name;
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    for (auto &i : vec_thread) i = std::move(std::thread([&]() {
+        benchmark_cache(*cache, iterations_count, key_distribution, find, insert);
+    }));
+    for (auto &i : vec_thread) i.join();
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+
+    std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000)) <<
+        " \t" << (100.0 * hits_total / (vec_thread.size() * iterations_count)) << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    const size_t keys_count = 1000000;
+    const size_t iterations_count = 1000000;    // reads per thread
+    const double zipf_s = 0.99;
+    size_t percent_cached = 10;                 // capacity of caches - % of keys
+    std::vector<std::thread> vec_thread(std::thread::hardware_concurrency());
+
+    if (argc >= 2) vec_thread.resize(std::stoi(std::string(argv[1])));     // max threads
+    if (argc >= 3) percent_cached = std::stoi(std::string(argv[2]));        // capacity, % of keys
+
+    size_t const capacity_elements = keys_count * percent_cached / 100;
+    size_t const capacity_bytes = capacity_elements * cache_details::default_weigh_t<int, field_t>()(0, field_t());
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark caches: Zipf (s = " << zipf_s << ") reads of " << keys_count << " keys, a miss inserts the key, capacity " <<
+        capacity_elements << " elements (" << percent_cached << "% of keys, " << capacity_bytes << " bytes)" << std::endl;
+
+    zipf_distribution_t const key_distribution(keys_count, zipf_s);
+
+    size_t const max_threads = vec_thread.size();
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        vec_thread.resize(threads);
+        std::cout << std::endl << threads << " threads" << std::endl;
+        std::cout << "                                \t time, sec \t MOps \t hits, %" << std::endl;
+        std::cout << std::setprecision(3);
+
+        run_benchmark<safe_lru_cache_t>("safe_ptr<unordered_map + list>: ", [&]() { return new safe_lru_cache_t(capacity_elements); },
+            vec_thread, iterations_count, key_distribution,
+            [](safe_lru_cache_t &c, int key, field_t &val) { return c->find(key, val); },
+            [](safe_lru_cache_t &c, int key, field_t const& val) { c->insert(key, val); });
+        run_benchmark<cache_t>("concurrent_cache<> (CLOCK):     ", [&]() { return new cache_t(capacity_bytes); },
+            vec_thread, iterations_count, key_distribution,
+            [](cache_t &c, int key, field_t &val) { return c.find(key, val); },
+            [](cache_t &c, int key, field_t const& val) { c.try_emplace(key, val); });
+    }
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+struct field_t { int money, time; field_t(int m, int t) : money(m), time(t) {} field_t() : money(0), time(0) {} };
+
+typedef contfree_safe_ptr<std::map<int, field_t>> safe_map_t;
+typedef columnar_table<int, 2> table_t;     // columns: money, time
+enum { money_col, time_col };
+
+std::atomic<size_t> rows_scanned_total;
+
+
+// percent_updates % of operations add to money of a random row, others sum money of scan_rows rows where time is in [time_low, time_high]
+template<typename container_t>
+void benchmark_scans(container_t &container, size_t const iterations_count, size_t const container_size, size_t const scan_rows,
+    size_t const percent_updates, std::function<int64_t(container_t &, int, int, int, int)> scan, std::function<void(container_t &, int)> update)
+{
+    const unsigned int seed = (unsigned)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<int> index_distribution(0, (int)(container_size - scan_rows));
+    std::uniform_int_distribution<int> time_distribution(0, 99);
+    std::uniform_int_distribution<size_t> percent_distribution(1, 100);    // 1 - 100 %
+    size_t rows_scanned = 0;
+    int64_t sum = 0;
+
+    for (size_t i = 0; i < iterations_count; ++i) {
+        int const first = index_distribution(generator);
+        if (percent_distribution(generator) <= percent_updates) update(container, first);
+        else {
+            int const time_low = time_distribution(generator);
+            sum += scan(container, first, first + (int)scan_rows, time_low, time_low + 25);
+            rows_scanned += scan_rows;
+        }
+    }
+    rows_scanned_total += rows_scanned;
+    volatile int64_t result = sum; (void)result;
+}
+
+
+template<typename container_t>
+void run_benchmark(std::string const& name, container_t &container, std::vector<std::thread> &vec_thread, size_t const iterations_count,
+    size_t const container_size, size_t const scan_rows, size_t const percent_updates,
+    std::function<int64_t(container_t &, int, int, int, int)> scan, std::function<void(container_t &, int)> update)
+{
+    rows_scanned_total = 0;
+    std::cout << name;
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    for (auto &i : vec_thread) i = std::move(std::thread([&]() {
+        benchmark_scans(container, iterations_count, container_size, scan_rows, percent_updates, scan, update);
+    }));
+    for (auto &i : vec_thread) i.join();
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+
+    std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000)) <<
+        " \t" << (rows_scanned_total / (took_time * 1000000)) << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    const size_t container_size = 1000000;
+    const size_t iterations_count = 2000;       // operations per thread
+    const size_t scan_rows = 10000;             // rows per scan
+    size_t percent_updates = 10;
+    std::vector<std::thread> vec_thread(std::thread::hardware_concurrency());
+
+    if (argc >= 2) vec_thread.resize(std::stoi(std::string(argv[1])));     // max threads
+    if (argc >= 3) percent_updates = std::stoi(std::string(argv[2]));       // % of updates
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark scans: sum of money where time is in a range of 25 over " << scan_rows << " rows, " << percent_updates <<
+        "% updates of a row, " << container_size << " rows" << std::endl;
+
+    safe_map_t safe_map;
+    table_t table;
+    {
+        std::default_random_engine generator(1);
+        std::uniform_int_distribution<int> money_distribution(-1000, 1000), time_distribution(0, 99);
+        auto x_safe_map = xlock_safe_ptr(safe_map);
+        for (size_t i = 0; i < container_size; ++i) {
+            field_t const field(money_distribution(generator), time_distribution(generator));
+            x_safe_map->emplace_hint(x_safe_map->end(), (int)i, field);
+            table.push_back({ { field.money, field.time } });
+        }
+    }
+
+    auto const map_scan = [](safe_map_t &m, int first, int last, int time_low, int time_high) -> int64_t {
+        int64_t sum = 0;
+        auto s_safe_map = slock_safe_ptr(m);
+        for (auto it = s_safe_map->lower_bound(first); it != s_safe_map->end() && it->first < last; ++it)
+            if (it->second.time >= time_low && it->second.time <= time_high) sum += it->second.money;
+        return sum;
+    };
+    auto const map_update = [](safe_map_t &m, int row) { auto x_safe_map = xlock_safe_ptr(m); x_safe_map->at(row).money += 1; };
+    auto const table_scan = [](table_t &t, int first, int last, int time_low, int time_high) -> int64_t {
+        return t.aggregate(money_col, first, last, time_col, time_low, time_high).sum;
+    };
+    auto const table_update = [](table_t &t, int row) { t.add(row, money_col, 1); };
+
+    bool const equal = map_scan(safe_map, 0, (int)container_size, 10, 35) == table_scan(table, 0, (int)container_size, 10, 35);
+    std::cout << "Sums are equal: " << ((equal) ? "ok" : "ERROR") << std::endl;
+
+    size_t const max_threads = vec_thread.size();
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        vec_thread.resize(threads);
+        std::cout << std::endl << threads << " threads" << std::endl;
+        std::cout << "                         \t time, sec \t MOps \t M rows/sec" << std::endl;
+        std::cout << std::setprecision(3);
+
+        run_benchmark<safe_map_t>("contfree_safe_ptr<map>: ", safe_map, vec_thread, iterations_count, container_size, scan_rows,
+            percent_updates, map_scan, map_update);
+        run_benchmark<table_t>("columnar_table<int, 2>: ", table, vec_thread, iterations_count, container_size, scan_rows,
+            percent_updates, table_scan, table_update);
+    }
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
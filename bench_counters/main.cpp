@@ -0,0 +1,100 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+typedef safe_obj<int64_t, spinlock_t> safe_counter_t;
+typedef std::atomic<int64_t> atomic_counter_t;
+typedef sharded_counter<int64_t> sharded_counter_t;
+
+std::atomic<int64_t> reads_sum;
+
+
+// each thread adds 1 iterations_count times, percent_reads % of operations read the total instead
+template<typename counter_t>
+void benchmark_counter(counter_t &counter, size_t const iterations_count, size_t const percent_reads,
+    std::function<void(counter_t &)> add, std::function<int64_t(counter_t &)> read)
+{
+    const unsigned int seed = (unsigned)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<size_t> percent_distribution(1, 100);    // 1 - 100 %
+    int64_t sum = 0;
+
+    for (size_t i = 0; i < iterations_count; ++i) {
+        if (percent_reads && percent_distribution(generator) <= percent_reads) sum += read(counter);
+        else add(counter);
+    }
+    reads_sum += sum;
+}
+
+
+template<typename counter_t>
+void run_benchmark(std::string const& name, std::vector<std::thread> &vec_thread, size_t const iterations_count, size_t const percent_reads,
+    std::function<void(counter_t &)> add, std::function<int64_t(counter_t &)> read)
+{
+    counter_t counter(0);
+    std::cout << name;
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    for (auto &i : vec_thread) i = std::move(std::thread([&]() {
+        benchmark_counter(counter, iterations_count, percent_reads, add, read);
+    }));
+    for (auto &i : vec_thread) i.join();
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+
+    int64_t const total = read(counter);
+    bool const correct = (percent_reads) ? (total > 0 && total <= (int64_t)(vec_thread.size() * iterations_count)) :
+        (total == (int64_t)(vec_thread.size() * iterations_count));
+
+    std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000)) <<
+        " \t" << ((correct) ? "ok" : "ERROR") << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    const size_t iterations_count = 2000000;    // operations per thread
+    size_t percent_reads = 0;
+    std::vector<std::thread> vec_thread(64);
+
+    if (argc >= 2) vec_thread.resize(std::stoi(std::string(argv[1])));     // max threads
+    if (argc >= 3) percent_reads = std::stoi(std::string(argv[2]));         // % of reads of the total
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark shared counters: each thread adds 1, " << percent_reads << "% reads of the total, " <<
+        iterations_count << " operations per thread" << std::endl;
+
+    size_t const max_threads = vec_thread.size();
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        vec_thread.resize(threads);
+        std::cout << std::endl << threads << " threads" << std::endl;
+        std::cout << "                                   \t time, sec \t MOps \t total" << std::endl;
+        std::cout << std::setprecision(3);
+
+        run_benchmark<safe_counter_t>("safe_obj<int64_t, spinlock_t>:     ", vec_thread, iterations_count, percent_reads,
+            [](safe_counter_t &c) { *xlock_safe_ptr(c).operator->() += 1; },
+            [](safe_counter_t &c) { return (int64_t)c; });
+        run_benchmark<atomic_counter_t>("std::atomic<int64_t>:              ", vec_thread, iterations_count, percent_reads,
+            [](atomic_counter_t &c) { c.fetch_add(1, std::memory_order_relaxed); },
+            [](atomic_counter_t &c) { return c.load(std::memory_order_relaxed); });
+        run_benchmark<sharded_counter_t>("sharded_counter<int64_t>:          ", vec_thread, iterations_count, percent_reads,
+            [](sharded_counter_t &c) { c.add(1); },
+            [](sharded_counter_t &c) { return c.read(); });
+        run_benchmark<sharded_counter_t>("sharded_counter<> read_snapshot(): ", vec_thread, iterations_count, percent_reads,
+            [](sharded_counter_t &c) { c.add(1); },
+            [](sharded_counter_t &c) { return c.read_snapshot(); });
+    }
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
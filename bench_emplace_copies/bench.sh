@@ -0,0 +1,7 @@
+echo ------------------------------- >> bench_log.txt
+##date +%F >> bench_log.txt
+date +%T >> bench_log.txt
+
+numactl --localalloc --cpunodebind=0 ./benchmark >> bench_log.txt
+
+# ./benchmark >> bench_log.txt
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+#include <cstdlib>
+#include <new>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+// all allocations of the program are counted. Replacements aren't inlined: after inlining the compiler sees
+// free() of the pointer returned by operator new and warns about mismatched new-delete
+#if defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+std::atomic<size_t> allocs_count(0);
+NOINLINE void * operator new(size_t size) {
+    allocs_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+NOINLINE void operator delete(void *ptr) noexcept { std::free(ptr); }
+NOINLINE void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+// value with a heap payload which counts its copies and moves
+struct value_t {
+    static std::atomic<size_t> copies, moves;
+    std::vector<char> payload;
+    explicit value_t(size_t size = 0) : payload(size, 'a') {}
+    value_t(value_t const& other) : payload(other.payload) { copies++; }
+    value_t(value_t &&other) noexcept : payload(std::move(other.payload)) { moves++; }
+    value_t & operator=(value_t const& other) { payload = other.payload; copies++; return *this; }
+    value_t & operator=(value_t &&other) noexcept { payload = std::move(other.payload); moves++; return *this; }
+};
+std::atomic<size_t> value_t::copies(0), value_t::moves(0);
+
+typedef safe_map_partitioned_t<std::string, value_t> safe_part_map_t;
+typedef safe_unordered_map_partitioned_t<std::string, value_t> safe_part_umap_t;
+
+
+// keys and values are prepared before the measurement - only allocations, copies and moves of the operation are counted
+void run_benchmark(std::string const& name, size_t const ops_count, std::function<void(std::vector<std::string> &, std::vector<value_t> &)> prepare,
+    std::function<void(std::vector<std::string> &, std::vector<value_t> &, size_t)> op)
+{
+    std::vector<std::string> keys;
+    std::vector<value_t> values;
+    for (size_t i = 0; i < ops_count; ++i) {
+        keys.emplace_back("key_of_the_benchmark_" + std::to_string(1000000 + i));    // longer than SSO - each copy allocates
+        values.emplace_back(64);
+    }
+    prepare(keys, values);
+
+    size_t const allocs_start = allocs_count.load(), copies_start = value_t::copies.load(), moves_start = value_t::moves.load();
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ops_count; ++i) op(keys, values, i);
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+    double const allocs = (double)(allocs_count.load() - allocs_start) / ops_count;
+    double const copies = (double)(value_t::copies.load() - copies_start) / ops_count;
+    double const moves = (double)(value_t::moves.load() - moves_start) / ops_count;
+
+    std::cout << name << "\t " << allocs << " \t\t " << copies << " \t\t " << moves << " \t\t " << (took_time * 1000000000 / ops_count) << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    size_t ops_count = 100000;
+    if (argc >= 2) ops_count = std::stoi(std::string(argv[1]));     // operations
+
+    std::cout << "Benchmark allocations, copies and moves of the value per operation: " << ops_count <<
+        " operations, std::string keys (not in SSO), values with 64 bytes heap payload" << std::endl;
+    std::cout << "Each new element needs exactly 1 allocation (the node) and no copies, the value is moved at most once" << std::endl << std::endl;
+    std::cout << std::setprecision(3);
+
+    safe_ptr<std::map<std::string, value_t>> safe_map;
+    safe_part_map_t part_map({ "", "key_of_the_benchmark_1025", "key_of_the_benchmark_1050", "key_of_the_benchmark_1075" });
+    safe_part_umap_t part_umap(16);
+    std::vector<safe_ptr<value_t>> safe_values;
+    std::vector<safe_obj<value_t>> safe_objs;
+    safe_values.reserve(ops_count);
+    safe_objs.reserve(ops_count);
+
+    auto const nothing = [](std::vector<std::string> &, std::vector<value_t> &) {};
+    auto const fill_part_map = [&](std::vector<std::string> &keys, std::vector<value_t> &values) {
+        for (size_t i = 0; i < keys.size(); ++i) part_map.emplace(keys[i], values[i]);
+    };
+
+    std::cout << "                                     \t allocs/op \t copies/op \t moves/op \t ns/op" << std::endl;
+
+    std::cout << std::endl << "Construction:" << std::endl;
+    run_benchmark("safe_ptr<T>(T&&):                    ", ops_count, nothing, [&](std::vector<std::string> &, std::vector<value_t> &values, size_t i) {
+        safe_values.emplace_back(std::move(values[i]));
+    });
+    run_benchmark("safe_obj<T>(T&&):                    ", ops_count, nothing, [&](std::vector<std::string> &, std::vector<value_t> &values, size_t i) {
+        safe_objs.emplace_back(std::move(values[i]));
+    });
+
+    std::cout << std::endl << "New keys:" << std::endl;
+    run_benchmark("std::map emplace(&&, &&) - no lock:  ", ops_count, nothing, [&](std::vector<std::string> &keys, std::vector<value_t> &values, size_t i) {
+        static std::map<std::string, value_t> map;
+        map.emplace(std::move(keys[i]), std::move(values[i]));
+    });
+    run_benchmark("safe_ptr<map> try_emplace(&&, &&):   ", ops_count, nothing, [&](std::vector<std::string> &keys, std::vector<value_t> &values, size_t i) {
+        try_emplace(safe_map, std::move(keys[i]), std::move(values[i]));
+    });
+    run_benchmark("safe part emplace(const&, const&):   ", ops_count, nothing, [&](std::vector<std::string> &keys, std::vector<value_t> &values, size_t i) {
+        part_map.emplace(keys[i], values[i]);      // both are copied
+    });
+    part_map.clear();
+    run_benchmark("safe part emplace(&&, &&):           ", ops_count, nothing, [&](std::vector<std::string> &keys, std::vector<value_t> &values, size_t i) {
+        part_map.emplace(std::move(keys[i]), std::move(values[i]));
+    });
+    part_map.clear();
+    run_benchmark("safe part try_emplace(&&, &&):       ", ops_count, nothing, [&](std::vector<std::string> &keys, std::vector<value_t> &values, size_t i) {
+        part_map.try_emplace(std::move(keys[i]), std::move(values[i]));
+    });
+    run_benchmark("safe part unordered emplace(&&, &&): ", ops_count, nothing, [&](std::vector<std::string> &keys, std::vector<value_t> &values, size_t i) {
+        part_umap.emplace(std::move(keys[i]), std::move(values[i]));
+    });
+
+    std::cout << std::endl << "Existing keys:" << std::endl;
+    part_map.clear();
+    run_benchmark("safe part try_emplace(&&, &&):       ", ops_count, fill_part_map, [&](std::vector<std::string> &keys, std::vector<value_t> &values, size_t i) {
+        part_map.try_emplace(std::move(keys[i]), std::move(values[i]));     // the value isn't touched
+    });
+    part_map.clear();
+    run_benchmark("safe part insert_or_assign(&&, &&):  ", ops_count, fill_part_map, [&](std::vector<std::string> &keys, std::vector<value_t> &values, size_t i) {
+        part_map.insert_or_assign(std::move(keys[i]), std::move(values[i]));
+    });
+    run_benchmark("safe_ptr<map> insert_or_assign(&&, &&):", ops_count, [&](std::vector<std::string> &keys, std::vector<value_t> &values) {
+        for (size_t i = 0; i < keys.size(); ++i) safe_map->emplace(keys[i], values[i]);
+    }, [&](std::vector<std::string> &keys, std::vector<value_t> &values, size_t i) {
+        insert_or_assign(safe_map, std::move(keys[i]), std::move(values[i]));
+    });
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
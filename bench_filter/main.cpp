@@ -0,0 +1,125 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+struct field_t { int money, time; field_t(int m, int t) : money(m), time(t) {} field_t() : money(0), time(0) {} };
+
+typedef contfree_safe_ptr<std::map<int, field_t>> safe_map_t;
+typedef safe_map_filtered_t<int, field_t> safe_map_filtered_int_t;
+typedef safe_map_partitioned_t<int, field_t, contfree_safe_ptr> safe_map_partitioned_int_t;
+
+std::atomic<size_t> hits_total;
+
+
+// even keys exist, odd keys are missing: percent_miss % of lookups (find or erase) are of odd keys,
+// percent_write % of operations update an existing key
+template<typename map_t>
+void benchmark_lookups(map_t &map, size_t const iterations_count, size_t const container_size, size_t const percent_miss,
+    size_t const percent_write, std::function<bool(map_t &, int)> find, std::function<size_t(map_t &, int)> erase,
+    std::function<void(map_t &, int)> update)
+{
+    const unsigned int seed = (unsigned)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<int> index_distribution(0, (int)container_size - 1);
+    std::uniform_int_distribution<size_t> percent_distribution(1, 100);    // 1 - 100 %
+    size_t hits = 0;
+
+    for (size_t i = 0; i < iterations_count; ++i) {
+        int const index = index_distribution(generator);
+        if (percent_distribution(generator) <= percent_write) update(map, index * 2);
+        else {
+            bool const miss = percent_distribution(generator) <= percent_miss;
+            int const key = index * 2 + (miss ? 1 : 0);
+            if (miss && (i & 1)) hits += erase(map, key);   // erase of a missing key - nothing is erased
+            else hits += find(map, key);
+        }
+    }
+    hits_total += hits;
+}
+
+
+template<typename map_t>
+void run_benchmark(std::string const& name, map_t &map, std::vector<std::thread> &vec_thread, size_t const iterations_count,
+    size_t const container_size, size_t const percent_miss, size_t const percent_write,
+    std::function<bool(map_t &, int)> find, std::function<size_t(map_t &, int)> erase, std::function<void(map_t &, int)> update)
+{
+    hits_total = 0;
+    std::cout << name;
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    for (auto &i : vec_thread) i = std::move(std::thread([&]() {
+        benchmark_lookups(map, iterations_count, container_size, percent_miss, percent_write, find, erase, update);
+    }));
+    for (auto &i : vec_thread) i.join();
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+
+    std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000)) <<
+        " \t" << hits_total << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    const size_t container_size = 1000000;
+    const size_t iterations_count = 200000;     // operations per thread
+    size_t percent_write = 5;
+    std::vector<std::thread> vec_thread(std::thread::hardware_concurrency());
+
+    if (argc >= 2) vec_thread.resize(std::stoi(std::string(argv[1])));     // threads
+    if (argc >= 3) percent_write = std::stoi(std::string(argv[2]));         // % of updates
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark lookups of missing keys: " << container_size << " elements, " << percent_write << "% updates" << std::endl;
+    std::cout << "Threads = " << vec_thread.size() << ", operations per thread = " << iterations_count << std::endl;
+
+    safe_map_t safe_map;
+    safe_map_filtered_int_t safe_map_filtered(container_size);
+    safe_map_partitioned_int_t safe_map_part(0, 2 * (int)container_size, 2 * (int)container_size / 16);
+    safe_map_partitioned_int_t safe_map_part_filtered(0, 2 * (int)container_size, 2 * (int)container_size / 16);
+    for (int i = 0; i < (int)container_size; ++i) {
+        safe_map->emplace(i * 2, field_t(i, i));
+        safe_map_filtered.try_emplace(i * 2, i, i);
+        safe_map_part.emplace(i * 2, field_t(i, i));
+        safe_map_part_filtered.emplace(i * 2, field_t(i, i));
+    }
+    safe_map_part_filtered.enable_filter(container_size);
+
+    auto const map_find = [](safe_map_t &m, int k) { auto s_safe_map = slock_safe_ptr(m); return s_safe_map->find(k) != s_safe_map->end(); };
+    auto const map_erase = [](safe_map_t &m, int k) { return m->erase(k); };
+    auto const map_update = [](safe_map_t &m, int k) { auto x_safe_map = xlock_safe_ptr(m); x_safe_map->at(k).money += 1; };
+    auto const filtered_find = [](safe_map_filtered_int_t &m, int k) { field_t val; return m.find(k, val); };
+    auto const filtered_erase = [](safe_map_filtered_int_t &m, int k) { return m.erase(k); };
+    auto const filtered_update = [](safe_map_filtered_int_t &m, int k) { m.insert_or_assign(k, field_t(k, k)); };
+    auto const part_find = [](safe_map_partitioned_int_t &m, int k) { field_t val; return m.find(k, val); };
+    auto const part_erase = [](safe_map_partitioned_int_t &m, int k) { return m.erase(k); };
+    auto const part_update = [](safe_map_partitioned_int_t &m, int k) { m.insert_or_assign(k, field_t(k, k)); };
+
+    for (size_t percent_miss : { 0, 50, 90, 99 })
+    {
+        std::cout << std::endl << percent_miss << "\t % of lookups of missing keys" << std::endl;
+        std::cout << "                                   \t time, sec \t MOps \t hits" << std::endl;
+        std::cout << std::setprecision(3);
+
+        run_benchmark<safe_map_t>("contfree_safe_ptr<map>:            ", safe_map, vec_thread, iterations_count, container_size,
+            percent_miss, percent_write, map_find, map_erase, map_update);
+        run_benchmark<safe_map_filtered_int_t>("safe_map_filtered_t<>:             ", safe_map_filtered, vec_thread, iterations_count,
+            container_size, percent_miss, percent_write, filtered_find, filtered_erase, filtered_update);
+        run_benchmark<safe_map_partitioned_int_t>("safe_map_partitioned_t<>:          ", safe_map_part, vec_thread, iterations_count,
+            container_size, percent_miss, percent_write, part_find, part_erase, part_update);
+        run_benchmark<safe_map_partitioned_int_t>("safe_map_partitioned_t<> + filter: ", safe_map_part_filtered, vec_thread,
+            iterations_count, container_size, percent_miss, percent_write, part_find, part_erase, part_update);
+    }
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+struct field_t { int money, time; field_t(int m, int t) : money(m), time(t) {} field_t() : money(0), time(0) {} };
+
+typedef lock_group_safe_ptr<std::map<int, field_t>> safe_table_t;
+
+static const size_t tables_count = 4;
+std::vector<safe_table_t> tables(tables_count);
+
+struct ops_counter_t { char tmp[60]; std::atomic<size_t> value; ops_counter_t() : value(0) {} };   // tmp[] to avoid false sharing
+std::vector<ops_counter_t> ops_counters(256);
+std::atomic<bool> stop_flag;
+
+enum { insert_op, delete_op, update_op, read_op };
+
+
+void benchmark_tables(size_t const thread_index, size_t const container_size, size_t const percent_joint)
+{
+    const unsigned int seed = (unsigned)std::chrono::system_clock::now().time_since_epoch().count() + (unsigned)thread_index;
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<size_t> index_distribution(0, container_size - 1);
+    std::uniform_int_distribution<size_t> table_distribution(0, tables_count - 1);
+    std::uniform_int_distribution<size_t> percent_distribution(1, 100);    // 1 - 100 %
+    std::uniform_int_distribution<size_t> operation_distribution(insert_op, read_op);
+    auto &ops = ops_counters[thread_index].value;
+
+    while (!stop_flag.load(std::memory_order_relaxed)) {
+        int const rnd_index = (int)index_distribution(generator);
+        size_t const table_1 = table_distribution(generator);
+
+        if (percent_distribution(generator) <= percent_joint) {    // joint update of 2 tables - locks in the order of tables
+            size_t const table_2 = (table_1 + 1) % tables_count;
+            std::lock_guard<safe_table_t> lock_1(tables[std::min(table_1, table_2)]);
+            std::lock_guard<safe_table_t> lock_2(tables[std::max(table_1, table_2)]);
+            auto x_table_1 = xlock_safe_ptr(tables[table_1]);
+            auto x_table_2 = xlock_safe_ptr(tables[table_2]);
+            auto it_1 = x_table_1->find(rnd_index);
+            auto it_2 = x_table_2->find(rnd_index);
+            if (it_1 != x_table_1->end() && it_2 != x_table_2->end()) { it_1->second.money--; it_2->second.money++; }
+        }
+        else {
+            auto &table = tables[table_1];
+            switch (operation_distribution(generator)) {
+            case insert_op: table->emplace(rnd_index, field_t(rnd_index, rnd_index)); break;
+            case delete_op: table->erase(rnd_index); break;
+            case update_op: {
+                auto x_table = xlock_safe_ptr(table);
+                auto it = x_table->find(rnd_index);
+                if (it != x_table->end()) it->second.money += 10;
+            }
+                break;
+            case read_op: {
+                auto x_table = xlock_safe_ptr(table);
+                auto it = x_table->find(rnd_index);
+                if (it != x_table->end()) { volatile int money = it->second.money; (void)money; }
+            }
+                break;
+            default: std::cout << "\n wrong way! \n";  break;
+            }
+        }
+        ops.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+int main(int argc, char** argv) {
+
+    const size_t container_size = 100000;       // elements in each table
+    const size_t percent_joint = 5;             // % of joint updates of 2 tables
+    const std::chrono::milliseconds interval(100);
+    const size_t intervals_per_phase = 10;
+    const double max_contention = 0.05;         // unlink_if_contended() threshold
+    std::vector<std::thread> vec_thread(std::thread::hardware_concurrency());
+
+    if (argc >= 2) vec_thread.resize(std::stoi(std::string(argv[1])));     // threads
+    if (vec_thread.size() > ops_counters.size()) vec_thread.resize(ops_counters.size());
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark dynamic lock groups: " << tables_count << " tables lock_group_safe_ptr<std::map> with size = " << container_size <<
+        ", " << percent_joint << "% joint updates of 2 tables" << std::endl;
+    std::cout << "Threads = " << vec_thread.size() << ", interval = " << interval.count() << " ms" << std::endl;
+
+    for (auto &table : tables)
+        for (size_t i = 0; i < container_size; ++i) table->emplace(i, field_t(i, i));
+
+    stop_flag = false;
+    for (size_t t = 0; t < vec_thread.size(); ++t) vec_thread[t] = std::thread([&, t]() { benchmark_tables(t, container_size, percent_joint); });
+
+    auto measure_phase = [&](std::string const& name, std::function<void(void)> on_interval) {
+        double ops_sum = 0;
+        std::cout << std::endl << name << std::endl << "MOps:";
+        for (size_t k = 0; k < intervals_per_phase; ++k) {
+            size_t ops_start = 0, ops_end = 0;
+            for (size_t t = 0; t < vec_thread.size(); ++t) ops_start += ops_counters[t].value.load();
+            auto const steady_start = std::chrono::steady_clock::now();
+            std::this_thread::sleep_for(interval);
+            for (size_t t = 0; t < vec_thread.size(); ++t) ops_end += ops_counters[t].value.load();
+            double const took_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - steady_start).count();
+            double const mops = (ops_end - ops_start) / (took_time * 1000000);
+            ops_sum += mops;
+            std::cout << " " << std::setprecision(3) << mops;
+            on_interval();
+        }
+        std::cout << std::endl << "average MOps: " << (ops_sum / intervals_per_phase) << std::endl;
+    };
+
+    measure_phase("1. split - own mutex per table", []() {});
+
+    {
+        auto link_guard = link_safe_ptrs::link_temporary(tables[0], tables[1], tables[2], tables[3]);
+        measure_phase("2. linked - one mutex for all tables (temporary link)", []() {});
+    }
+    measure_phase("3. unlinked - throughput recovers", []() {});
+
+    link_safe_ptrs::relink(tables[0], tables[1], tables[2], tables[3]);
+    bool splitted = false;
+    link_safe_ptrs::unlink_if_contended(max_contention, tables[0], tables[1], tables[2], tables[3]);   // reset stats
+    measure_phase("4. linked, split automatically when contention > " + std::to_string(max_contention), [&]() {
+        if (!splitted && link_safe_ptrs::unlink_if_contended(max_contention, tables[0], tables[1], tables[2], tables[3])) {
+            splitted = true;
+            std::cout << " [split]";
+        }
+    });
+
+    stop_flag = true;
+    for (auto &i : vec_thread) i.join();
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
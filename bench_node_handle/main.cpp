@@ -0,0 +1,116 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+// std::mutex which measures hold time of X-locks in CPU ticks
+class hold_time_mutex_t {
+    std::mutex mtx;
+    uint64_t hold_start = 0;
+public:
+    static std::atomic<uint64_t> hold_ticks, locks_count;
+    void lock() { mtx.lock(); hold_start = adaptive_details::ticks(); }
+    bool try_lock() { if (!mtx.try_lock()) return false; hold_start = adaptive_details::ticks(); return true; }
+    void unlock() {
+        hold_ticks.fetch_add(adaptive_details::ticks() - hold_start, std::memory_order_relaxed);
+        locks_count.fetch_add(1, std::memory_order_relaxed);
+        mtx.unlock();
+    }
+    static void reset() { hold_ticks = 0; locks_count = 0; }
+};
+std::atomic<uint64_t> hold_time_mutex_t::hold_ticks(0), hold_time_mutex_t::locks_count(0);
+
+template<typename T> using hold_time_safe_ptr = safe_ptr<T, hold_time_mutex_t, std::unique_lock<hold_time_mutex_t>, std::unique_lock<hold_time_mutex_t>>;
+
+typedef hold_time_safe_ptr<std::map<int, std::string>> safe_map_t;
+typedef safe_map_partitioned_t<int, std::string, hold_time_safe_ptr> safe_part_map_t;
+
+
+// 50% emplace, 50% erase of random keys
+template<typename container_t>
+void benchmark_writes(container_t &container, size_t const iterations_count, size_t const container_size, size_t const value_size,
+    std::function<void(container_t &, int, std::string &&)> emplace, std::function<void(container_t &, int)> erase)
+{
+    const unsigned int seed = (unsigned)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<int> index_distribution(0, (int)container_size - 1);
+    std::uniform_int_distribution<int> op_distribution(0, 1);
+
+    for (size_t i = 0; i < iterations_count; ++i) {
+        int const key = index_distribution(generator);
+        if (op_distribution(generator) == 0) emplace(container, key, std::string(value_size, 'a' + key % 26));
+        else erase(container, key);
+    }
+}
+
+
+template<typename container_t>
+void run_benchmark(std::string const& name, container_t &container, std::vector<std::thread> &vec_thread, size_t const iterations_count,
+    size_t const container_size, size_t const value_size,
+    std::function<void(container_t &, int, std::string &&)> emplace, std::function<void(container_t &, int)> erase)
+{
+    hold_time_mutex_t::reset();
+    std::cout << name;
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    for (auto &i : vec_thread) i = std::thread([&]() {
+        benchmark_writes(container, iterations_count, container_size, value_size, emplace, erase);
+    });
+    for (auto &i : vec_thread) i.join();
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+    std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000)) << " \t" <<
+        ((double)hold_time_mutex_t::hold_ticks / std::max<uint64_t>(hold_time_mutex_t::locks_count, 1)) << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    const size_t iterations_count = 1000000;    // operations per thread
+    size_t container_size = 10000;
+    std::vector<std::thread> vec_thread(std::thread::hardware_concurrency());
+
+    if (argc >= 2) vec_thread.resize(std::stoi(std::string(argv[1])));     // threads
+    if (argc >= 3) container_size = std::stoi(std::string(argv[2]));        // range of keys
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark X-lock hold time of writes with std::string values, 50% emplace, 50% erase, keys 0 - " << container_size << std::endl;
+    std::cout << "Threads = " << vec_thread.size() << ", operations per thread = " << iterations_count <<
+        ", node handles: " << (node_details::has_node_handle<std::map<int, std::string>>::value ? "yes" : "no (C++14)") << std::endl;
+
+    for (size_t value_size : { 16, 256, 4096 })
+    {
+        std::cout << std::endl << "std::string of " << value_size << " chars" << std::endl;
+        std::cout << "                                 \t time, sec \t MOps \t hold, ticks" << std::endl;
+        std::cout << std::setprecision(3);
+
+        safe_map_t safe_map;
+        run_benchmark<safe_map_t>("safe_ptr<map>: emplace, erase     ", safe_map, vec_thread, iterations_count, container_size, value_size,
+            [](safe_map_t &m, int k, std::string &&v) { m->emplace(k, std::move(v)); },
+            [](safe_map_t &m, int k) { m->erase(k); });
+        safe_map->clear();
+        run_benchmark<safe_map_t>("safe_ptr<map>: emplace_node, erase_deferred", safe_map, vec_thread, iterations_count, container_size, value_size,
+            [](safe_map_t &m, int k, std::string &&v) { emplace_node(m, k, std::move(v)); },
+            [](safe_map_t &m, int k) { erase_deferred(m, k); });
+
+        safe_part_map_t safe_part_map(0, (int)container_size, (int)container_size / 10);
+        run_benchmark<safe_part_map_t>("safe part<map>: emplace, erase    ", safe_part_map, vec_thread, iterations_count, container_size, value_size,
+            [](safe_part_map_t &m, int k, std::string &&v) { m.write_part(k)->emplace(k, std::move(v)); },
+            [](safe_part_map_t &m, int k) { m.erase(k); });
+        safe_part_map.clear();
+        run_benchmark<safe_part_map_t>("safe part<map>: emplace_node, erase_deferred", safe_part_map, vec_thread, iterations_count, container_size, value_size,
+            [](safe_part_map_t &m, int k, std::string &&v) { m.emplace_node(k, std::move(v)); },
+            [](safe_part_map_t &m, int k) { m.erase_deferred(k); });
+    }
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
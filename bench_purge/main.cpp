@@ -0,0 +1,106 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+struct field_t { int money, time; field_t(int m, int t) : money(m), time(t) {} field_t() : money(0), time(0) {} };
+
+typedef safe_map_partitioned_t<int, field_t, contfree_safe_ptr> safe_part_map_t;
+
+static const int rows_count = 4000000;
+static const int partition_step = 400000;      // 10 partitions
+
+std::atomic<bool> stop_flag;
+
+
+// 0% of writes: find() of random keys, latency of each operation in nanoseconds
+void benchmark_reader(safe_part_map_t const& safe_map, size_t const thread_index, std::vector<uint32_t> &latencies)
+{
+    std::default_random_engine generator((unsigned)thread_index);
+    std::uniform_int_distribution<int> key_distribution(0, rows_count - 1);
+
+    while (!stop_flag.load(std::memory_order_relaxed)) {
+        int const key = key_distribution(generator);
+        auto const start = std::chrono::steady_clock::now();
+        {
+            auto slock_container = safe_map.read_only_part(key);
+            auto const it = slock_container->find(key);
+            if (it != slock_container->end()) { volatile int money = it->second.money; (void)money; }
+        }
+        auto const end = std::chrono::steady_clock::now();
+        latencies.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+}
+
+
+void run_benchmark(std::string const& name, size_t const readers_count, std::function<size_t(safe_part_map_t &)> purge)
+{
+    safe_part_map_t safe_map(0, rows_count, partition_step);
+    std::vector<std::pair<int, field_t>> rows;
+    for (int i = 0; i < rows_count; ++i) rows.emplace_back(i, field_t(i, i));
+    safe_map.bulk_load(rows.begin(), rows.end());
+
+    std::vector<std::vector<uint32_t>> latencies(readers_count);
+    std::vector<std::thread> vec_thread(readers_count);
+    stop_flag = false;
+    for (size_t t = 0; t < readers_count; ++t) vec_thread[t] = std::thread([&, t]() { benchmark_reader(safe_map, t, latencies[t]); });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    size_t const erased = purge(safe_map);
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    stop_flag = true;
+    for (auto &i : vec_thread) i.join();
+
+    std::vector<uint32_t> all;
+    for (auto &i : latencies) all.insert(all.end(), i.begin(), i.end());
+    std::sort(all.begin(), all.end());
+    auto const percentile = [&](double const p) { return all[std::min(all.size() - 1, (size_t)(p * all.size()))] / 1000.0; };
+
+    std::cout << name << "\t" << took_time << " \t" << erased << " \t" << (all.size() / 1000000.0) << " \t" <<
+        percentile(0.5) << " \t" << percentile(0.99) << " \t" << percentile(0.999) << " \t" << (all.back() / 1000.0) << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    size_t readers_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    if (argc >= 2) readers_count = std::max(std::stoi(std::string(argv[1])), 1);     // reader threads
+
+    int const purge_low = 0, purge_up = rows_count / 2 - 1;     // the half of rows - "expired" rows of 5 partitions
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark purge of " << (purge_up - purge_low + 1) << " of " << rows_count << " rows from " <<
+        (rows_count / partition_step) << " partitions of safe_map_partitioned_t<int, field_t, contfree_safe_ptr>" << std::endl;
+    std::cout << "Reader threads = " << readers_count << " (0% of writes), reader latency in usec" << std::endl;
+    std::cout << std::endl << "                        \t purge, sec \t erased \t M reads \t median \t p99 \t p99.9 \t max" << std::endl;
+    std::cout << std::setprecision(3);
+
+    run_benchmark("no purge:               ", readers_count, [](safe_part_map_t &) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        return 0; });
+    run_benchmark("erase_lower_upper():    ", readers_count, [&](safe_part_map_t &m) {
+        size_t const old_size = m.size();
+        m.erase_lower_upper(purge_low, purge_up);
+        return old_size - m.size(); });
+    for (size_t chunk_size : { 16384, 4096, 1024 }) {
+        std::string const name = "chunks of " + std::to_string(chunk_size) + ":                ";
+        run_benchmark(name.substr(0, 24), readers_count, [&](safe_part_map_t &m) {
+            return m.erase_lower_upper(purge_low, purge_up, chunk_size); });
+    }
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+typedef safe_ptr<std::vector<double>> safe_vector_t;
+typedef segmented_vector<double> segmented_vector_double_t;
+
+
+// each thread appends elements_count latencies: one by one, or by batches of batch_size as safe_vec_median_latency in benchmark/main.cpp
+template<typename vector_t>
+void run_benchmark(std::string const& name, std::vector<std::thread> &vec_thread, size_t const elements_count, size_t const batch_size,
+    std::function<void(vector_t &, std::vector<double> const&)> append, std::function<size_t(vector_t &)> size)
+{
+    vector_t vec;
+    std::cout << name;
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    for (auto &i : vec_thread) i = std::move(std::thread([&]() {
+        std::vector<double> batch(batch_size);
+        for (size_t k = 0; k < elements_count; k += batch_size) {
+            for (size_t j = 0; j < batch_size; ++j) batch[j] = (double)(k + j);
+            append(vec, batch);
+        }
+    }));
+    for (auto &i : vec_thread) i.join();
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+
+    bool const correct = size(vec) == vec_thread.size() * (elements_count / batch_size) * batch_size;
+    std::cout << "\t" << took_time << " \t" << (vec_thread.size() * elements_count / (took_time * 1000000)) <<
+        " \t" << ((correct) ? "ok" : "ERROR") << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    const size_t elements_count = 2000000;      // appended elements per thread
+    const size_t batch_size = 1000;
+    std::vector<std::thread> vec_thread(std::thread::hardware_concurrency());
+
+    if (argc >= 2) vec_thread.resize(std::stoi(std::string(argv[1])));     // max threads
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark appends: " << elements_count << " doubles per thread, one by one or by batches of " << batch_size << std::endl;
+
+    size_t const max_threads = vec_thread.size();
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        vec_thread.resize(threads);
+        std::cout << std::endl << threads << " threads" << std::endl;
+        std::cout << "                                   \t time, sec \t M elements/sec \t size" << std::endl;
+        std::cout << std::setprecision(3);
+
+        run_benchmark<safe_vector_t>("safe_ptr<vector>::push_back():     ", vec_thread, elements_count, 1,
+            [](safe_vector_t &v, std::vector<double> const& batch) { v->push_back(batch[0]); },
+            [](safe_vector_t &v) { return v->size(); });
+        run_benchmark<segmented_vector_double_t>("segmented_vector<>::push_back():   ", vec_thread, elements_count, 1,
+            [](segmented_vector_double_t &v, std::vector<double> const& batch) { v.push_back(batch[0]); },
+            [](segmented_vector_double_t &v) { return v.size(); });
+        run_benchmark<safe_vector_t>("safe_ptr<vector>::insert(batch):   ", vec_thread, elements_count, batch_size,
+            [](safe_vector_t &v, std::vector<double> const& batch) { v->insert(v->end(), batch.begin(), batch.end()); },
+            [](safe_vector_t &v) { return v->size(); });
+        run_benchmark<segmented_vector_double_t>("segmented_vector<>::append(batch): ", vec_thread, elements_count, batch_size,
+            [](segmented_vector_double_t &v, std::vector<double> const& batch) { v.append(batch.begin(), batch.end()); },
+            [](segmented_vector_double_t &v) { return v.size(); });
+    }
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+struct field_t { int money, time; field_t(int m, int t) : money(m), time(t) {} field_t() : money(0), time(0) {} };
+
+static const int partitions_count = 100;
+
+
+template<typename container_t>
+void run_benchmark(std::string const& name, size_t const rows_count, size_t const max_threads, std::string const& file_name)
+{
+    int const keys_range = (int)rows_count * 4;
+    std::default_random_engine generator(0);
+    std::uniform_int_distribution<int> key_distribution(0, keys_range - 1);
+    std::vector<std::pair<int, field_t>> rows;
+    for (size_t i = 0; i < rows_count; ++i) {
+        int const key = key_distribution(generator);
+        rows.emplace_back(key, field_t(key, key));
+    }
+
+    std::cout << std::endl << name << std::endl;
+    std::cout << "                           \t time, sec \t M rows/s \t MB/s" << std::endl;
+    double const file_mb = (double)rows_count * (sizeof(int) + sizeof(field_t)) / (1024 * 1024);
+    auto const measure = [&](std::string const& operation, std::function<size_t(void)> run) {
+        std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+        size_t const count = run();
+        std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+        double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+        std::cout << operation << "\t " << took_time << " \t " << (count / (took_time * 1000000)) << " \t " <<
+            (file_mb * count / rows_count / took_time) << std::endl;
+    };
+
+    container_t source(0, keys_range, keys_range / partitions_count);
+    measure("rebuild key by key:        ", [&]() {    // as from upstream
+        for (auto &row : rows) source.emplace(row.first, field_t(row.second));
+        return source.size(); });
+    size_t const source_size = source.size();
+
+    measure("save_snapshot():           ", [&]() { return source.save_snapshot(file_name); });
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        container_t restored;
+        std::string const operation = "load_snapshot(), " + std::to_string(threads) + " threads:            ";
+        measure(operation.substr(0, 27), [&]() { return restored.load_snapshot(file_name, threads); });
+        if (restored.size() != source_size || restored.partitions_count() != source.partitions_count()) std::cout << "ERROR" << std::endl;
+    }
+    std::remove(file_name.c_str());
+}
+
+
+int main(int argc, char** argv) {
+
+    size_t max_threads = std::thread::hardware_concurrency();
+    size_t rows_count = 4000000;
+    std::string file_name = "snapshot.bin";
+
+    if (argc >= 2) max_threads = std::max(std::stoi(std::string(argv[1])), 1);     // max threads
+    if (argc >= 3) rows_count = std::stoi(std::string(argv[2]));                   // rows
+    if (argc >= 4) file_name = argv[3];                                             // snapshot file
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark snapshot and restore of " << rows_count << " rows (" << (sizeof(int) + sizeof(field_t)) <<
+        " bytes each), " << partitions_count << " partitions, file: " << file_name << std::endl;
+
+    run_benchmark<safe_map_partitioned_t<int, field_t, contfree_safe_ptr>>("safe part<map,contf>:", rows_count, max_threads, file_name);
+    run_benchmark<safe_map_partitioned_t<int, field_t, contfree_safe_ptr, btree_map<int, field_t>>>("safe part<btree,contf>:",
+        rows_count, max_threads, file_name);
+
+    std::cout << "\n end \n";
+
+    return 0;
+}
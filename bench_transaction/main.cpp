@@ -0,0 +1,133 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <functional>
+
+#include "safe_ptr.h"
+
+using namespace sf;
+
+// bank account from examples/main_30.cpp - main_43.cpp: money is transferred between 2 accounts atomically
+struct field_t { int money, time; field_t(int m, int t) : money(m), time(t) {} field_t() : money(0), time(0) {} };
+
+typedef safe_ptr<field_t> safe_account_t;
+std::vector<safe_account_t> accounts;
+
+static const size_t hot_accounts_count = 4;     // conflicting transactions use only these accounts
+std::atomic<size_t> aborts_total;
+
+enum lock_type_t { ordered_lock_guard, timed_any, wound_wait, wait_die };
+
+
+void transfer(safe_account_t &from, safe_account_t &to, int const amount) {
+    xlock_safe_ptr(from)->money -= amount;      // recursive X-lock - already locked by transaction
+    xlock_safe_ptr(to)->money += amount;
+    xlock_safe_ptr(to)->time++;
+}
+
+template<lock_type_t lock_type>
+void benchmark_transfer(size_t const iterations_count, size_t const percent_conflict)
+{
+    const unsigned int seed = (unsigned)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<size_t> index_distribution(hot_accounts_count, accounts.size() - 1);
+    std::uniform_int_distribution<size_t> hot_index_distribution(0, hot_accounts_count - 1);
+    std::uniform_int_distribution<size_t> percent_distribution(1, 100);    // 1 - 100 %
+    size_t aborts = 0;
+
+    for (size_t i = 0; i < iterations_count; ++i) {
+        bool const conflict_flag = (percent_distribution(generator) <= percent_conflict);
+        size_t const from_index = (conflict_flag) ? hot_index_distribution(generator) : index_distribution(generator);
+        size_t to_index = (conflict_flag) ? hot_index_distribution(generator) : index_distribution(generator);
+        if (to_index == from_index) to_index = (conflict_flag) ? (to_index + 1) % hot_accounts_count : hot_accounts_count + (to_index + 1) % (accounts.size() - hot_accounts_count);
+        auto &from = accounts[from_index];
+        auto &to = accounts[to_index];
+
+        switch (lock_type) {
+        case ordered_lock_guard: {  // classic deadlock avoidance - lock in the global order of accounts
+            std::lock_guard<safe_account_t> lock_1(accounts[std::min(from_index, to_index)]);
+            std::lock_guard<safe_account_t> lock_2(accounts[std::max(from_index, to_index)]);
+            transfer(from, to, 1);
+        }
+            break;
+        case timed_any: {   // lock in any order, fixed sleep on conflict
+            lock_timed_any_infinity lock_all(from, to);
+            transfer(from, to, 1);
+        }
+            break;
+        case wound_wait: {
+            lock_transaction_wound_wait lock_all(from, to);
+            aborts += lock_all.aborts_count();
+            transfer(from, to, 1);
+        }
+            break;
+        case wait_die: {
+            lock_transaction_wait_die lock_all(from, to);
+            aborts += lock_all.aborts_count();
+            transfer(from, to, 1);
+        }
+            break;
+        default: std::cout << "\n wrong way! \n";  break;
+        }
+    }
+    aborts_total += aborts;
+}
+
+
+template<lock_type_t lock_type>
+void run_benchmark(std::string const& name, std::vector<std::thread> &vec_thread, size_t const iterations_count, size_t const percent_conflict)
+{
+    aborts_total = 0;
+    std::cout << name;
+    std::chrono::steady_clock::time_point steady_start = std::chrono::steady_clock::now();
+    for (auto &i : vec_thread) i = std::move(std::thread([&]() {
+        benchmark_transfer<lock_type>(iterations_count, percent_conflict);
+    }));
+    for (auto &i : vec_thread) i.join();
+    std::chrono::steady_clock::time_point steady_end = std::chrono::steady_clock::now();
+    double const took_time = std::chrono::duration<double>(steady_end - steady_start).count();
+
+    int64_t money_sum = 0;
+    for (auto &account : accounts) money_sum += slock_safe_ptr(account)->money;
+
+    std::cout << "\t" << took_time << " \t" << (vec_thread.size() * iterations_count / (took_time * 1000000)) <<
+        " \t" << aborts_total << " \t" << ((money_sum == 0) ? "ok" : "ERROR") << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    const size_t iterations_count = 100000;     // transfers per thread
+    const size_t accounts_count = 10000;
+    std::vector<std::thread> vec_thread(std::thread::hardware_concurrency());
+
+    if (argc >= 2) vec_thread.resize(std::stoi(std::string(argv[1])));     // threads
+    size_t percent_conflict_max = 100;
+    if (argc >= 3) percent_conflict_max = std::stoi(std::string(argv[2]));  // max % of transfers between hot accounts
+
+    std::cout << "CPU Cores: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Benchmark bank transfers between " << accounts_count << " accounts (" << hot_accounts_count << " hot accounts)" << std::endl;
+    std::cout << "Threads = " << vec_thread.size() << ", transfers per thread = " << iterations_count << std::endl;
+
+    for (size_t i = 0; i < accounts_count; ++i) accounts.emplace_back(0, 0);
+
+    for (size_t percent_conflict = 0; percent_conflict <= percent_conflict_max; percent_conflict += 25)
+    {
+        std::cout << std::endl << percent_conflict << "\t % of conflicting transfers (between hot accounts)" << std::endl;
+        std::cout << "                     \t time, sec \t MOps \t aborts \t money" << std::endl;
+        std::cout << std::setprecision(3);
+
+        run_benchmark<ordered_lock_guard>("ordered lock_guard:", vec_thread, iterations_count, percent_conflict);
+        run_benchmark<timed_any>("lock_timed_any:     ", vec_thread, iterations_count, percent_conflict);
+        run_benchmark<wound_wait>("transaction wound-wait:", vec_thread, iterations_count, percent_conflict);
+        run_benchmark<wait_die>("transaction wait-die:", vec_thread, iterations_count, percent_conflict);
+    }
+
+    std::cout << "\n end \n";
+
+    return 0;
+}